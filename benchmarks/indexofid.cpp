@@ -0,0 +1,72 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Times StatisticsStore::indexOfId() while an hour archive of 100k rows
+ * is loaded the way loadHourArchives() used to do it: append a row, then
+ * look its id up twice.
+ *
+ *   ascending: ids ascend, so every lookup is a binary search
+ *   unordered: one out of order id forces the linear search that every
+ *              lookup did before
+ *
+ * Build:  g++ -O2 -o indexofid indexofid.cpp ../src/knemod/statisticsstore.cpp \
+ *             -I../src/knemod -I../src/common -I$(kde4-config --path include) \
+ *             $(pkg-config --cflags --libs QtCore)
+ * Run:    ./indexofid [rows]     (default: 100000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "statisticsstore.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double loadArchive( int rows, bool ordered, long long *found )
+{
+    StatisticsStore store;
+    QDateTime dateTime( QDate( 2000, 1, 1 ), QTime( 0, 0 ) );
+    double start = now();
+    for ( int id = 0; id < rows; ++id )
+    {
+        // An id that is larger than all that follow breaks the order
+        int rowId = ( !ordered && id == 0 ) ? rows : id;
+        store.append( dateTime.addSecs( id * 3600 ), rowId, 3600 );
+        *found += store.indexOfId( rowId );
+        *found += store.indexOfId( rowId );
+    }
+    return now() - start;
+}
+
+int main( int argc, char **argv )
+{
+    int rows = argc > 1 ? atoi( argv[ 1 ] ) : 100000;
+    long long found = 0;
+    double ascending = loadArchive( rows, true, &found );
+    double unordered = loadArchive( rows, false, &found );
+    printf( "rows %d  ascending %.3f s  unordered %.3f s\n", rows, ascending, unordered );
+    return found == 42;
+}
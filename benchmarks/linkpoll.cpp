@@ -0,0 +1,166 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Compares the cost of one counter poll as the number of links on the host
+ * grows:
+ *
+ *   dump:     refill the whole link cache, then look up each monitored
+ *             interface by name (what NetlinkBackend did before)
+ *   targeted: one RTM_GETLINK per monitored ifindex, all sent with a single
+ *             sendmsg (what NetlinkBackend::readCounters() does now)
+ *
+ * Build:  g++ -O2 -o linkpoll linkpoll.cpp $(pkg-config --cflags --libs libnl-route-3.0)
+ * Run:    ./linkpoll [iterations] [iface...]     (default: 1000 lo)
+ *
+ * Add links to compare, e.g. as root:
+ *   for i in $(seq 1 500); do ip link add kb$i type veth peer name kbp$i; done
+ *   for i in $(seq 1 500); do ip link del kb$i; done
+ */
+
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include <netlink/netlink.h>
+#include <netlink/msg.h>
+#include <netlink/route/link.h>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static unsigned long long sink;
+
+static void pollDump( nl_sock *sock, nl_cache *cache, const std::vector<const char *> &names )
+{
+    nl_cache_refill( sock, cache );
+    for ( size_t i = 0; i < names.size(); ++i )
+    {
+        struct rtnl_link *link = rtnl_link_get_by_name( cache, names[ i ] );
+        if ( !link )
+            continue;
+        sink += rtnl_link_get_stat( link, RTNL_LINK_RX_BYTES );
+        sink += rtnl_link_get_stat( link, RTNL_LINK_TX_BYTES );
+        rtnl_link_put( link );
+    }
+}
+
+static void pollTargeted( nl_sock *sock, const std::vector<int> &indexes, unsigned int *seq )
+{
+    struct
+    {
+        struct nlmsghdr hdr;
+        struct ifinfomsg ifi;
+    } req;
+    std::vector<char> requests;
+    for ( size_t i = 0; i < indexes.size(); ++i )
+    {
+        memset( &req, 0, sizeof( req ) );
+        req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof( struct ifinfomsg ) );
+        req.hdr.nlmsg_type = RTM_GETLINK;
+        req.hdr.nlmsg_flags = NLM_F_REQUEST;
+        req.hdr.nlmsg_seq = ++*seq;
+        req.ifi.ifi_family = AF_UNSPEC;
+        req.ifi.ifi_index = indexes[ i ];
+        const char *p = reinterpret_cast<const char *>(&req);
+        requests.insert( requests.end(), p, p + NLMSG_ALIGN( req.hdr.nlmsg_len ) );
+    }
+    if ( nl_sendto( sock, &requests[ 0 ], requests.size() ) < 0 )
+        return;
+
+    int replies = indexes.size();
+    while ( replies > 0 )
+    {
+        unsigned char *buf = NULL;
+        struct sockaddr_nl peer;
+        int n = nl_recv( sock, &peer, &buf, NULL );
+        if ( n <= 0 )
+        {
+            free( buf );
+            break;
+        }
+        struct nlmsghdr *hdr = reinterpret_cast<struct nlmsghdr *>(buf);
+        while ( nlmsg_ok( hdr, n ) )
+        {
+            struct nlattr *tb[ IFLA_MAX + 1 ];
+            if ( hdr->nlmsg_type == RTM_NEWLINK &&
+                 nlmsg_parse( hdr, sizeof( struct ifinfomsg ), tb, IFLA_MAX, NULL ) >= 0 &&
+                 tb[ IFLA_STATS64 ] )
+            {
+                struct rtnl_link_stats64 stats;
+                memset( &stats, 0, sizeof( stats ) );
+                int len = nla_len( tb[ IFLA_STATS64 ] );
+                memcpy( &stats, nla_data( tb[ IFLA_STATS64 ] ), len < (int)sizeof( stats ) ? len : sizeof( stats ) );
+                sink += stats.rx_bytes + stats.tx_bytes;
+            }
+            replies--;
+            hdr = nlmsg_next( hdr, &n );
+        }
+        free( buf );
+    }
+}
+
+int main( int argc, char **argv )
+{
+    int iterations = argc > 1 ? atoi( argv[ 1 ] ) : 1000;
+    std::vector<const char *> names;
+    for ( int i = 2; i < argc; ++i )
+        names.push_back( argv[ i ] );
+    if ( names.empty() )
+        names.push_back( "lo" );
+    std::vector<int> indexes;
+    for ( size_t i = 0; i < names.size(); ++i )
+        indexes.push_back( if_nametoindex( names[ i ] ) );
+
+    nl_sock *sock = nl_socket_alloc();
+    nl_sock *statsock = nl_socket_alloc();
+    if ( !sock || !statsock || nl_connect( sock, NETLINK_ROUTE ) < 0 || nl_connect( statsock, NETLINK_ROUTE ) < 0 )
+    {
+        fprintf( stderr, "cannot open a netlink socket\n" );
+        return 1;
+    }
+    nl_cache *cache = NULL;
+    rtnl_link_alloc_cache( sock, AF_UNSPEC, &cache );
+
+    unsigned int seq = 0;
+    double start = now();
+    for ( int i = 0; i < iterations; ++i )
+        pollDump( sock, cache, names );
+    double dump = ( now() - start ) / iterations;
+
+    start = now();
+    for ( int i = 0; i < iterations; ++i )
+        pollTargeted( statsock, indexes, &seq );
+    double targeted = ( now() - start ) / iterations;
+
+    printf( "links %d  monitored %d  dump %.1f us/poll  targeted %.1f us/poll\n",
+            nl_cache_nitems( cache ), (int)names.size(), dump, targeted );
+
+    nl_cache_free( cache );
+    nl_socket_free( sock );
+    nl_socket_free( statsock );
+    return sink == 42;
+}
@@ -4,15 +4,22 @@
 #  LIBNL_FOUND - whether the libnl library was found
 #  LIBNL_LIBRARIES - the libnl library
 #  LIBNL_INCLUDE_DIR - the include path of the libnl library
+#  LIBNL_GENL_FOUND - whether the generic netlink library was found
 
 find_library (LIBNL_LIBRARY nl-3)
 find_library (LIBNL_ROUTE_LIBRARY nl-route-3)
+find_library (LIBNL_GENL_LIBRARY nl-genl-3)
 
 set(LIBNL_LIBRARIES
     ${LIBNL_LIBRARY}
     ${LIBNL_ROUTE_LIBRARY}
 )
 
+if (LIBNL_GENL_LIBRARY)
+    set(LIBNL_GENL_FOUND TRUE)
+    set(LIBNL_LIBRARIES ${LIBNL_LIBRARIES} ${LIBNL_GENL_LIBRARY})
+endif (LIBNL_GENL_LIBRARY)
+
 find_path (LIBNL_INCLUDE_DIR
   NAMES
   netlink/netlink.h
@@ -24,4 +31,4 @@ include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(Libnl  DEFAULT_MSG  LIBNL_LIBRARIES LIBNL_INCLUDE_DIR)
 
 include_directories("${LIBNL_INCLUDE_DIR}")
-mark_as_advanced(LIBNL_INCLUDE_DIR LIBNL_LIBRARY LIBNL_ROUTE_LIBRARY)
+mark_as_advanced(LIBNL_INCLUDE_DIR LIBNL_LIBRARY LIBNL_ROUTE_LIBRARY LIBNL_GENL_LIBRARY)
@@ -2,3 +2,4 @@
 
 #cmakedefine KNEMO_VERSION "${KNEMO_VERSION}"
 #cmakedefine HAVE_LIBIW 1
+#cmakedefine HAVE_NL80211 1
@@ -193,7 +193,11 @@ static const char conf_toolTipContent[] = "ToolTipContent";
 static const char conf_pollInterval[] = "PollInterval";
 static const char conf_saveInterval[] = "SaveInterval";
 static const char conf_statisticsDir[] = "StatisticsDir";
+static const char conf_sharedStatistics[] = "SharedStatistics";
 static const char conf_useBitrate[] = "UseBitrate";
+static const char conf_addressInterval[] = "AddressInterval";
+static const char conf_routeInterval[] = "RouteInterval";
+static const char conf_wirelessInterval[] = "WirelessInterval";
 static const char conf_plotterPos[] = "PlotterPos";
 static const char conf_plotterSize[] = "PlotterSize";
 static const char conf_statisticsPos[] = "StatisticsPos";
@@ -265,9 +269,15 @@ struct BackendData
         prevTxPackets( 0L ),
         rxPackets( 0L ),
         txPackets( 0L ),
+        counterIndex( -1 ),
+        haveCounters( false ),
+        sampleTime( 0 ),
+        prevSampleTime( 0 ),
         prevRxBytes( 0L ),
         prevTxBytes( 0L ),
         incomingBytes( 0L ),
+        addrIndex( -1 ),
+        addrGeneration( 0 ),
         outgoingBytes( 0L ),
         rxBytes( 0L ),
         txBytes( 0L ),
@@ -278,15 +288,25 @@ struct BackendData
     int index;
     KNemoIface::Type interfaceType;
     bool isWireless;
-    unsigned long prevRxPackets;
-    unsigned long prevTxPackets;
-    unsigned long rxPackets;
-    unsigned long txPackets;
-    unsigned long prevRxBytes;
-    unsigned long prevTxBytes;
-    unsigned long incomingBytes;
-    unsigned long outgoingBytes;
+    quint64 prevRxPackets;
+    quint64 prevTxPackets;
+    quint64 rxPackets;
+    quint64 txPackets;
+    // ifindex the previous counter sample was taken from
+    int counterIndex;
+    bool haveCounters;
+    // CLOCK_MONOTONIC time of the current and previous counter samples
+    // in microseconds
+    quint64 sampleTime;
+    quint64 prevSampleTime;
+    quint64 prevRxBytes;
+    quint64 prevTxBytes;
+    quint64 incomingBytes;
+    quint64 outgoingBytes;
     QMap<QString, AddrData> addrData;
+    // ifindex and backend generation addrData was built from
+    int addrIndex;
+    unsigned int addrGeneration;
     QString hwAddress;
     QString ip4DefaultGateway;
     QString ip6DefaultGateway;
@@ -319,14 +339,26 @@ struct GeneralSettings
     GeneralSettings()
       : toolTipContent( defaultTip ),
         pollInterval( 1.0 ),
+        addressInterval( 5.0 ),
+        routeInterval( 5.0 ),
+        wirelessInterval( 3.0 ),
         saveInterval( 60 ),
         useBitrate( false ),
+        sharedStatistics( false ),
         statisticsDir( KGlobal::dirs()->saveLocation( "data", "knemo/" ) )
     {}
     int toolTipContent;
     double pollInterval;
+    // How often addresses, routes and wireless details are refreshed
+    // when nothing signals a change.  Not exposed in the kcm.
+    double addressInterval;
+    double routeInterval;
+    double wirelessInterval;
     int saveInterval;
     bool useBitrate;
+    // Keep all interfaces in one db instead of a file each.  Not exposed
+    // in the kcm.
+    bool sharedStatistics;
     KUrl statisticsDir;
 };
 
@@ -456,6 +488,6 @@ enum rt_scope_t
 };
 #endif
 
-static const double pollIntervals[] = { 0.1, 0.2, 0.25, 0.5, 1.0, 2.0 };
+static const double pollIntervals[] = { 0.05, 0.1, 0.2, 0.25, 0.5, 1.0, 2.0 };
 
 #endif // DATA_H
@@ -28,6 +28,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <string.h>
 #include <QFontMetrics>
 #include <KGlobalSettings>
 #include <KSharedConfig>
@@ -37,6 +38,7 @@
 #include "utils.h"
 
 #ifdef __linux__
+  #include <netlink/msg.h>
   #include <netlink/route/rtnl.h>
   #include <netlink/route/route.h>
 #else
@@ -52,85 +54,99 @@
 
 #ifdef __linux__
 
-QString ipv4gwi;
-QString ipv6gwi;
-
-QString ipv4gw;
-QString ipv6gw;
-
-void parseNetlinkRoute( struct nl_object *object, void * )
+bool parseDefaultRoute( struct nlmsghdr *hdr, DefaultRoute *route )
 {
-    struct rtnl_route *const route = reinterpret_cast<struct rtnl_route *>(object);
-
-    int rtfamily = rtnl_route_get_family( route );
-
-    if ( rtfamily == AF_INET ||
-         rtfamily == AF_INET6 )
+    if ( ( hdr->nlmsg_type != RTM_NEWROUTE && hdr->nlmsg_type != RTM_DELROUTE ) ||
+         hdr->nlmsg_len < NLMSG_LENGTH( sizeof( struct rtmsg ) ) )
+        return false;
+
+    // Everything but the default routes is turned down right here
+    struct rtmsg *rtm = static_cast<struct rtmsg *>(NLMSG_DATA( hdr ));
+    if ( rtm->rtm_dst_len != 0 ||
+         rtm->rtm_table != RT_TABLE_MAIN ||
+         rtm->rtm_type != RTN_UNICAST ||
+         ( rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6 ) )
+        return false;
+
+    struct rtnl_route *r = NULL;
+    if ( rtnl_route_parse( hdr, &r ) < 0 )
+        return false;
+
+    route->afType = rtm->rtm_family;
+    route->priority = rtnl_route_get_priority( r );
+    route->gateway.clear();
+    route->iface.clear();
+    if ( rtnl_route_get_nnexthops( r ) > 0 )
     {
-        struct rtnl_nexthop *nh = NULL;
-        struct nl_addr *addr = NULL;
-        if ( rtnl_route_get_nnexthops( route ) > 0 )
-        {
-            nh = rtnl_route_nexthop_n ( route, 0 );
-            addr = rtnl_route_nh_get_gateway( nh );
-        }
-
+        struct rtnl_nexthop *nh = rtnl_route_nexthop_n( r, 0 );
+        struct nl_addr *addr = rtnl_route_nh_get_gateway( nh );
+        char gwaddr[ INET6_ADDRSTRLEN ];
+        char gwname[ IFNAMSIZ ];
+        memset( gwaddr, 0, sizeof( gwaddr ) );
+        memset( gwname, 0, sizeof( gwname ) );
         if ( addr )
         {
-            char gwaddr[ INET6_ADDRSTRLEN ];
-            char gwname[ IFNAMSIZ ];
-            memset( gwaddr, 0, sizeof( gwaddr ) );
-            struct in_addr * inad = reinterpret_cast<struct in_addr *>(nl_addr_get_binary_addr( addr ));
-            nl_addr2str( addr, gwaddr, sizeof( gwaddr ) );
-            inet_ntop( rtfamily, &inad->s_addr, gwaddr, sizeof( gwaddr ) );
-            int oif = rtnl_route_nh_get_ifindex( nh );
-            if_indextoname( oif, gwname );
-
-            if ( rtfamily == AF_INET )
-            {
-                ipv4gw = gwaddr;
-                ipv4gwi = gwname;
-            }
-            else if ( rtfamily == AF_INET6 )
-            {
-                ipv6gw = gwaddr;
-                ipv6gwi = gwname;
-            }
+            inet_ntop( route->afType, nl_addr_get_binary_addr( addr ), gwaddr, sizeof( gwaddr ) );
+            route->gateway = gwaddr;
         }
+        if ( if_indextoname( rtnl_route_nh_get_ifindex( nh ), gwname ) )
+            route->iface = gwname;
+    }
+    rtnl_route_put( r );
+    return true;
+}
+
+struct RouteDump
+{
+    int afType;
+    bool found;
+    DefaultRoute best;
+};
+
+static int parseDumpedRoute( struct nl_msg *msg, void *arg )
+{
+    RouteDump *dump = static_cast<RouteDump *>(arg);
+    DefaultRoute route;
+    if ( parseDefaultRoute( nlmsg_hdr( msg ), &route ) &&
+         route.afType == dump->afType &&
+         ( !dump->found || route.priority < dump->best.priority ) )
+    {
+        dump->best = route;
+        dump->found = true;
     }
+    return NL_OK;
 }
 
+// This walks the routing table, which is fine once in a while.  Anything
+// that polls should follow the route events instead.
 QString getNetlinkRoute( int afType, QString *defaultGateway, void *data )
 {
+    if ( defaultGateway )
+        defaultGateway->clear();
     if ( !data )
         return QString();
 
-    struct nl_cache* rtlcache = static_cast<struct nl_cache*>(data);
+    struct nl_sock *rtsock = static_cast<struct nl_sock*>(data);
+    RouteDump dump;
+    dump.afType = afType;
+    dump.found = false;
 
-    if ( afType == AF_INET )
-    {
-        ipv4gw.clear();
-        ipv4gwi.clear();
-    }
-    else if ( afType == AF_INET6 )
-    {
-        ipv6gw.clear();
-        ipv6gwi.clear();
-    }
-    nl_cache_foreach( rtlcache, parseNetlinkRoute, NULL);
+    struct rtmsg rtm;
+    memset( &rtm, 0, sizeof( rtm ) );
+    rtm.rtm_family = afType;
+    if ( nl_send_simple( rtsock, RTM_GETROUTE, NLM_F_DUMP, &rtm, sizeof( rtm ) ) < 0 )
+        return QString();
 
-    if ( afType == AF_INET )
-    {
-        if ( defaultGateway )
-            *defaultGateway = ipv4gw;
-        return ipv4gwi;
-    }
-    else
-    {
-        if ( defaultGateway )
-            *defaultGateway = ipv6gw;
-        return ipv6gwi;
-    }
+    struct nl_cb *cb = nl_cb_clone( nl_socket_get_cb( rtsock ) );
+    if ( !cb )
+        return QString();
+    nl_cb_set( cb, NL_CB_VALID, NL_CB_CUSTOM, parseDumpedRoute, &dump );
+    nl_recvmsgs( rtsock, cb );
+    nl_cb_put( cb );
+
+    if ( defaultGateway )
+        *defaultGateway = dump.best.gateway;
+    return dump.best.iface;
 }
 #else
 
@@ -38,10 +38,33 @@ template <class T> inline T clamp(T x, T a, T b)
  * Finds the default gateway for AF_INET or AF_INET6
  * It fills defaultGateway with the address and returns the interface name
  * If one isn't found, both are empty.
- * The netlink backend uses data to nl_cache data
+ * On Linux data is a connected NETLINK_ROUTE nl_sock
  */
 QString getDefaultRoute( int afType, QString * defaultGateway = NULL, void * data = NULL );
 
+#ifdef __linux__
+struct nlmsghdr;
+
+/*
+ * A default route of the main routing table
+ */
+struct DefaultRoute
+{
+    int afType;
+    quint32 priority;
+    QString gateway;
+    QString iface;
+};
+
+/*
+ * If hdr is an RTM_NEWROUTE or RTM_DELROUTE of a default route in the main
+ * table, fill in route and return true.  Other routes are turned down by
+ * their header alone, so this is cheap enough for the route events of a
+ * full table.
+ */
+bool parseDefaultRoute( struct nlmsghdr * hdr, DefaultRoute * route );
+#endif
+
 QList<KNemoTheme> findThemes();
 
 /*
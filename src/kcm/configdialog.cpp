@@ -392,7 +392,7 @@ void ConfigDialog::load()
     bool startKNemo = generalGroup.readEntry( conf_autoStart, true );
     mDlg->checkBoxStartKNemo->setChecked( startKNemo );
     GeneralSettings g;
-    double pollVal = clamp<double>(generalGroup.readEntry( conf_pollInterval, g.pollInterval ), 0.1, 2.0 );
+    double pollVal = clamp<double>(generalGroup.readEntry( conf_pollInterval, g.pollInterval ), pollIntervals[0], 2.0 );
     pollVal = validatePoll( pollVal );
     int index = mDlg->comboBoxPoll->findData( pollVal );
     if ( index >= 0 )
@@ -739,22 +739,19 @@ void ConfigDialog::defaults()
     updateControls( &emptySettings );
 
     // Default interface
-    void *cache = NULL;
+    void *routeData = NULL;
 
 #ifdef __linux__
 	struct nl_sock *rtsock = nl_socket_alloc();
 	int c = nl_connect(rtsock, NETLINK_ROUTE);
     if ( c >= 0 )
-    {
-	    rtnl_route_alloc_cache( rtsock, AF_UNSPEC, 0, reinterpret_cast<nl_cache**>(&cache) );
-    }
+        routeData = rtsock;
 #endif
 
-    QString interface = getDefaultRoute( AF_INET, NULL, cache );
+    QString interface = getDefaultRoute( AF_INET, NULL, routeData );
     if ( interface.isEmpty() )
-        interface = getDefaultRoute( AF_INET6, NULL, cache );
+        interface = getDefaultRoute( AF_INET6, NULL, routeData );
 #ifdef __linux__
-    nl_cache_free( static_cast<nl_cache*>(cache) );
     nl_close( rtsock );
     nl_socket_free( rtsock );
 #endif
@@ -18,98 +18,353 @@
    Boston, MA 02110-1301, USA.
 */
 
+#include <time.h>
+
+#include <QMutexLocker>
+
 #include "backendbase.h"
 
-BackendBase::BackendBase() : QObject()
+BackendBase::BackendBase() : QObject(),
+    mSampler( NULL ),
+    mResolveIndexes( false ),
+    mDirtyTiers( AllTiers ),
+    mAddressInterval( 0 ),
+    mRouteInterval( 0 ),
+    mWirelessInterval( 0 )
 {
 }
 
 BackendBase::~BackendBase()
 {
+    stopSampler();
+    for ( int i = 0; i < mSlots.count(); ++i )
+    {
+        delete mSlots.at( i ).data;
+        delete mTargets.at( i ).slot;
+    }
+}
+
+quint64 BackendBase::monotonicTime()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<quint64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
 }
 
 const BackendData* BackendBase::addIface( const QString& iface )
 {
-    BackendData * data;
-    if ( mInterfaces.contains( iface ) )
-    {
-        return mInterfaces.value( iface );
-    }
-    else
-    {
-        data = new BackendData();
-        mInterfaces.insert( iface, data );
-        return data;
-    }
+    int slot = mNameSlots.value( iface, -1 );
+    if ( slot >= 0 )
+        return mSlots.at( slot ).data;
+
+    IfaceSlot ifaceSlot;
+    ifaceSlot.name = iface;
+    ifaceSlot.data = new BackendData();
+
+    SampleTarget target;
+    target.name = iface.toLocal8Bit();
+    target.index = ifaceIndex( iface );
+    target.slot = new SampleSlot();
+
+    QMutexLocker locker( &mSampleMutex );
+    slot = mSlots.count();
+    mSlots.append( ifaceSlot );
+    mTargets.append( target );
+    mNameSlots.insert( iface, slot );
+    if ( target.index > 0 )
+        mIndexSlots.insert( target.index, slot );
+
+    markDirty( AllTiers );
+    return ifaceSlot.data;
 }
 
 void BackendBase::removeIface( const QString& iface )
 {
-    mInterfaces.remove( iface );
+    int slot = mNameSlots.value( iface, -1 );
+    if ( slot < 0 )
+        return;
+
+    BackendData *data = mSlots.at( slot ).data;
+    SampleSlot *sampleSlot = mTargets.at( slot ).slot;
+
+    mSampleMutex.lock();
+    mNameSlots.remove( iface );
+    if ( mTargets.at( slot ).index > 0 )
+        mIndexSlots.remove( mTargets.at( slot ).index );
+
+    // Keep the table dense by moving the last slot into the hole
+    int last = mSlots.count() - 1;
+    if ( slot != last )
+    {
+        mSlots[ slot ] = mSlots.at( last );
+        mTargets[ slot ] = mTargets.at( last );
+        mNameSlots.insert( mSlots.at( slot ).name, slot );
+        if ( mTargets.at( slot ).index > 0 )
+            mIndexSlots.insert( mTargets.at( slot ).index, slot );
+    }
+    mSlots.remove( last );
+    mTargets.remove( last );
+    mSampleMutex.unlock();
+
+    // A read that started before we changed the table may still write to
+    // the slot
+    mReadMutex.lock();
+    delete sampleSlot;
+    mReadMutex.unlock();
+    delete data;
 }
 
 void BackendBase::clearTraffic( const QString& iface )
 {
-    if ( mInterfaces.value( iface ) )
+    int slot = mNameSlots.value( iface, -1 );
+    if ( slot >= 0 )
     {
-        BackendData * data = mInterfaces.value( iface );
+        BackendData * data = mSlots.at( slot ).data;
         data->prevTxBytes = data->txBytes = 0;
         data->prevRxBytes = data->rxBytes = 0;
         data->prevTxPackets = data->txPackets = 0;
         data->prevRxPackets = data->rxPackets = 0;
+        data->haveCounters = false;
     }
 }
 
 void BackendBase::updatePackets( const QString& iface )
 {
-    if ( mInterfaces.value( iface ) )
+    int slot = mNameSlots.value( iface, -1 );
+    if ( slot >= 0 )
     {
-        BackendData * data = mInterfaces.value( iface );
+        BackendData * data = mSlots.at( slot ).data;
         data->prevRxPackets = data->rxPackets;
         data->prevTxPackets = data->txPackets;
     }
 }
 
-void BackendBase::incBytes( KNemoIface::Type type,
-                            unsigned long bytes,
-                            unsigned long &changed,
-                            unsigned long &prevDataBytes,
-                            quint64 &curDataBytes
-                          )
+void BackendBase::update()
+{
+    int tiers = CounterTier;
+    if ( tierDue( AddressTier, mAddressInterval, mAddressTimer ) )
+        tiers |= AddressTier;
+    if ( tierDue( RouteTier, mRouteInterval, mRouteTimer ) )
+        tiers |= RouteTier;
+    if ( tierDue( WirelessTier, mWirelessInterval, mWirelessTimer ) )
+        tiers |= WirelessTier;
+    mDirtyTiers = 0;
+
+    if ( mResolveIndexes )
+        resolveIndexes();
+    // The sampler publishes new samples on its own, and we don't want to
+    // wait for one of its reads.  Without it, fill in what's missing.
+    if ( !mSampler || !mSampler->isRunning() )
+        sampleCounters( true );
+
+    updateIfaces( tiers );
+    emit updateComplete();
+}
+
+void BackendBase::setSampleInterval( int usec )
+{
+    if ( !mSampler )
+        mSampler = new CounterSampler( this );
+    mSampler->setInterval( usec );
+    if ( !mSampler->isRunning() )
+        mSampler->start();
+}
+
+void BackendBase::stopSampler()
 {
-    // We count the traffic on ourself to avoid an overflow after
-    // 4GB of traffic.
-    if ( bytes < prevDataBytes )
+    if ( mSampler )
     {
-        // there was an overflow
-        if ( type == KNemoIface::Ethernet )
+        delete mSampler;
+        mSampler = NULL;
+    }
+}
+
+int BackendBase::ifaceIndex( const QString& )
+{
+    return 0;
+}
+
+const QByteArray& BackendBase::localName( int slot ) const
+{
+    return mTargets.at( slot ).name;
+}
+
+bool BackendBase::readSample( int slot, CounterSample& sample ) const
+{
+    // Only the GUI thread changes the table, so no need to lock here
+    return mTargets.at( slot ).slot->read( sample );
+}
+
+const SampleRing *BackendBase::sampleRing( const QString& iface ) const
+{
+    int slot = mNameSlots.value( iface, -1 );
+    if ( slot < 0 )
+        return NULL;
+    return mTargets.at( slot ).slot->ring();
+}
+
+void BackendBase::linkChanged( int index, const QString& name )
+{
+    int slot = mIndexSlots.value( index, -1 );
+    if ( slot >= 0 && mSlots.at( slot ).name == name )
+        return;
+
+    QMutexLocker locker( &mSampleMutex );
+    // The link was renamed, so it isn't the interface we know any more
+    if ( slot >= 0 )
+        bindIndex( slot, 0 );
+
+    slot = mNameSlots.value( name, -1 );
+    if ( slot >= 0 )
+        bindIndex( slot, index );
+}
+
+void BackendBase::linkRemoved( int index )
+{
+    int slot = mIndexSlots.value( index, -1 );
+    if ( slot < 0 )
+        return;
+
+    QMutexLocker locker( &mSampleMutex );
+    bindIndex( slot, 0 );
+}
+
+void BackendBase::invalidateIndexes()
+{
+    mResolveIndexes = true;
+}
+
+void BackendBase::resolveIndexes()
+{
+    mResolveIndexes = false;
+
+    QVector<int> indexes( mSlots.count() );
+    bool changed = false;
+    for ( int i = 0; i < mSlots.count(); ++i )
+    {
+        indexes[ i ] = ifaceIndex( mSlots.at( i ).name );
+        if ( indexes.at( i ) != mTargets.at( i ).index )
+            changed = true;
+    }
+
+    if ( !changed )
+        return;
+
+    QMutexLocker locker( &mSampleMutex );
+    for ( int i = 0; i < mSlots.count(); ++i )
+        bindIndex( i, indexes.at( i ) );
+}
+
+void BackendBase::bindIndex( int slot, int index )
+{
+    int oldIndex = mTargets.at( slot ).index;
+    if ( oldIndex == index )
+        return;
+
+    if ( oldIndex > 0 && mIndexSlots.value( oldIndex, -1 ) == slot )
+        mIndexSlots.remove( oldIndex );
+    mTargets[ slot ].index = index;
+    if ( index > 0 )
+        mIndexSlots.insert( index, slot );
+}
+
+void BackendBase::sampleCounters( bool missingOnly )
+{
+    QMutexLocker reading( &mReadMutex );
+
+    // Work on a copy, so the table is free again while we wait for the
+    // kernel
+    QVector<SampleTarget> targets;
+    mSampleMutex.lock();
+    if ( !missingOnly )
+        targets = mTargets;
+    else
+    {
+        for ( int i = 0; i < mTargets.count(); ++i )
         {
-            // This makes data counting more accurate but will not work
-            // for interfaces that reset the transfered data to zero
-            // when deactivated like ppp does.
-            // BSD uses uint32_t for byte counters, so no need to test
-            // size
-#ifdef __linux__
-            if ( 4 == sizeof(long) )
-#endif
-                curDataBytes += 0xFFFFFFFF - prevDataBytes;
+            CounterSample sample;
+            if ( !mTargets.at( i ).slot->read( sample ) )
+                targets.append( mTargets.at( i ) );
         }
-        prevDataBytes = 0L;
     }
-    if ( curDataBytes == 0L )
+    mSampleMutex.unlock();
+
+    if ( targets.count() )
+        readCounters( targets );
+}
+
+void BackendBase::setTierIntervals( int addressMsec, int routeMsec, int wirelessMsec )
+{
+    mAddressInterval = addressMsec;
+    mRouteInterval = routeMsec;
+    mWirelessInterval = wirelessMsec;
+}
+
+void BackendBase::markDirty( int tiers )
+{
+    mDirtyTiers |= tiers;
+}
+
+bool BackendBase::tierDue( int tier, int interval, QElapsedTimer& timer )
+{
+    if ( mDirtyTiers & tier || !timer.isValid() || timer.elapsed() >= interval )
     {
-        // on startup set to currently received bytes
-        curDataBytes = bytes;
-        // this is new: KNemo only counts the traffic transfered
-        // while it is running. Important to not falsify statistics!
-        prevDataBytes = bytes;
+        timer.start();
+        return true;
+    }
+    return false;
+}
+
+// A narrow counter that went down most likely wrapped.  A 64-bit one
+// never does in practice, so there it means the counter started over.
+void BackendBase::incBytes( BackendData *data, quint64 rxBytes, quint64 txBytes, int counterBits, quint64 sampleTime )
+{
+    if ( data->haveCounters && sampleTime == data->sampleTime )
+    {
+        data->incomingBytes = 0;
+        data->outgoingBytes = 0;
+        return;
+    }
+    data->prevSampleTime = data->sampleTime;
+    data->sampleTime = sampleTime;
+
+    if ( !data->haveCounters )
+    {
+        // On startup show the kernel's totals, but KNemo only counts the
+        // traffic transfered while it is running.  Important to not
+        // falsify statistics!
+        data->rxBytes = rxBytes;
+        data->txBytes = txBytes;
+        data->incomingBytes = 0;
+        data->outgoingBytes = 0;
+        data->prevSampleTime = 0;
+    }
+    else if ( data->counterIndex != data->index ||
+              ( rxBytes < data->prevRxBytes && !counterWrapped( rxBytes, data->prevRxBytes, counterBits ) ) ||
+              ( txBytes < data->prevTxBytes && !counterWrapped( txBytes, data->prevTxBytes, counterBits ) ) )
+    {
+        // The counters started over: the link was recreated, the driver
+        // was reloaded or a ppp link reconnected.  Everything counted
+        // since then is new traffic.
+        data->incomingBytes = rxBytes;
+        data->outgoingBytes = txBytes;
+        data->rxBytes += rxBytes;
+        data->txBytes += txBytes;
+        data->prevRxPackets = 0;
+        data->prevTxPackets = 0;
     }
     else
-        // afterwards only add difference to previous number of bytes
-        curDataBytes += bytes - prevDataBytes;
+    {
+        data->incomingBytes = counterDelta( rxBytes, data->prevRxBytes, counterBits );
+        data->outgoingBytes = counterDelta( txBytes, data->prevTxBytes, counterBits );
+        data->rxBytes += data->incomingBytes;
+        data->txBytes += data->outgoingBytes;
+    }
 
-    changed = bytes - prevDataBytes;
-    prevDataBytes = bytes;
+    data->prevRxBytes = rxBytes;
+    data->prevTxBytes = txBytes;
+    data->counterIndex = data->index;
+    data->haveCounters = true;
 }
 
 #include "backendbase.moc"
@@ -21,14 +21,23 @@
 #ifndef BACKENDBASE_H
 #define BACKENDBASE_H
 
+#include <QElapsedTimer>
 #include <QHash>
+#include <QMutex>
+#include <QVector>
 
 #include "../../common/data.h"
+#include "countersampler.h"
 
 /**
  * This is the baseclass for all backends. Every backend that
  * should be used for KNemo must inherit from this class.
  *
+ * Counters are read by a CounterSampler thread, and every poll picks up
+ * the latest sample.  Addresses, routes and wireless details are
+ * refreshed in their own tiers, either when their interval has elapsed or
+ * when a backend marks them dirty after a change.
+ *
  * @short Baseclass for all backends
  * @author Percy Leonhardt <percy@eris23.de>
  */
@@ -36,7 +45,17 @@
 class BackendBase : public QObject
 {
     Q_OBJECT
+    friend class CounterSampler;
 public:
+    enum Tier
+    {
+        CounterTier  = 0x1,
+        AddressTier  = 0x2,
+        RouteTier    = 0x4,
+        WirelessTier = 0x8,
+        AllTiers     = 0xF
+    };
+
     BackendBase();
     virtual ~BackendBase();
 
@@ -48,15 +67,30 @@ public:
     /**
      * This function is called from KNemo whenever the
      * backend shall update the information of the
-     * interfaces in the QHash.
+     * interfaces in the QHash.  It works out which tiers
+     * are due and hands them to updateIfaces().
+     */
+    void update();
+    /**
+     * Set how often the slow tiers are refreshed, in milliseconds.
      */
-    virtual void update() = 0;
+    void setTierIntervals( int addressMsec, int routeMsec, int wirelessMsec );
+    /**
+     * Set how often the counters are sampled, in microseconds.  Starts
+     * the sampler thread if it isn't running yet.
+     */
+    void setSampleInterval( int usec );
     virtual QStringList ifaceList() = 0;
     virtual QString defaultRouteIface( int afInet ) = 0;
     const BackendData* addIface( const QString& iface );
     void removeIface( const QString& iface );
     void clearTraffic( const QString& iface );
     void updatePackets( const QString& iface );
+    /**
+     * History of the counter samples of iface, for consumers that read
+     * at their own pace.  Valid until the interface is removed.
+     */
+    const SampleRing *sampleRing( const QString& iface ) const;
 
 signals:
     /**
@@ -67,12 +101,90 @@ signals:
     void updateComplete();
 
 protected:
-    QHash<QString, BackendData *> mInterfaces;
+    struct IfaceSlot
+    {
+        QString name;
+        // Handed out by addIface(), so it must stay put
+        BackendData *data;
+    };
+
+    /**
+     * Update the interfaces.  tiers is a combination of Tier values;
+     * CounterTier is always set.
+     */
+    virtual void updateIfaces( int tiers ) = 0;
+    /**
+     * Read the counters of the given interfaces and write them to their
+     * slots.  Runs in the sampler thread, or in the GUI thread for
+     * interfaces that haven't been sampled yet, but never in both at once.
+     * It must not touch anything else the GUI thread uses.
+     */
+    virtual void readCounters( const QVector<SampleTarget>& targets ) = 0;
+    /**
+     * Return the kernel's index for iface, or 0 if it doesn't exist.
+     */
+    virtual int ifaceIndex( const QString& iface );
+    /**
+     * The name of the interface in slot, ready for system calls.
+     */
+    const QByteArray& localName( int slot ) const;
+    /**
+     * Copy the latest counter sample of the interface in slot.
+     */
+    bool readSample( int slot, CounterSample& sample ) const;
+    /**
+     * The kernel now calls the link with this index name.  Handles
+     * renames without looking up every interface again.
+     */
+    void linkChanged( int index, const QString& name );
+    void linkRemoved( int index );
+    /**
+     * Look up the index of every interface again on the next update.
+     */
+    void invalidateIndexes();
+    void stopSampler();
+    static quint64 monotonicTime();
+    /**
+     * Force the given tiers to be refreshed on the next update.
+     */
+    void markDirty( int tiers );
+
+    // Dense table of the monitored interfaces
+    QVector<IfaceSlot> mSlots;
     QString ip4DefGw;
     QString ip6DefGw;
-    void incBytes( KNemoIface::Type type, unsigned long bytes,
-                   unsigned long &changed,
-                   unsigned long &prevDataBytes, quint64 &curDataBytes );
+    /**
+     * Account for a new sample of the byte counters taken at sampleTime.
+     * Counters narrower than 64 bits are expected to wrap.  Must be called
+     * once index and the packet counters have been updated.  A sample that
+     * was already accounted for is ignored.
+     */
+    void incBytes( BackendData *data, quint64 rxBytes, quint64 txBytes, int counterBits, quint64 sampleTime );
+
+private:
+    void sampleCounters( bool missingOnly );
+    void resolveIndexes();
+    void bindIndex( int slot, int index );
+    bool tierDue( int tier, int interval, QElapsedTimer& timer );
+    CounterSampler *mSampler;
+    // Guards changes to the table against the sampler thread.  It is only
+    // held long enough to copy or change mTargets.  mTargets[i] belongs to
+    // mSlots[i].
+    QMutex mSampleMutex;
+    // Held across readCounters(), which may only run in one thread at a
+    // time.  A SampleSlot is only deleted while holding it.
+    QMutex mReadMutex;
+    QVector<SampleTarget> mTargets;
+    QHash<QString, int> mNameSlots;
+    QHash<int, int> mIndexSlots;
+    bool mResolveIndexes;
+    int mDirtyTiers;
+    int mAddressInterval;
+    int mRouteInterval;
+    int mWirelessInterval;
+    QElapsedTimer mAddressTimer;
+    QElapsedTimer mRouteTimer;
+    QElapsedTimer mWirelessTimer;
 };
 
 extern BackendBase *backend;
@@ -69,6 +69,7 @@ BSDBackend::BSDBackend()
 
 BSDBackend::~BSDBackend()
 {
+    stopSampler();
     if ( m_fd >= 0 )
         close( m_fd );
 }
@@ -92,33 +93,36 @@ QStringList BSDBackend::ifaceList()
     return ifaces;
 }
 
-void BSDBackend::update()
+void BSDBackend::updateIfaces( int tiers )
 {
     struct ifaddrs *ifap;
     getifaddrs( &ifap );
 
-    QString ip4DefGw, ip6DefGw;
-    getDefaultRoute( AF_INET, &ip4DefGw );
-    getDefaultRoute( AF_INET6, &ip6DefGw );
+    // getifaddrs() returns addresses and counters together, so only the
+    // route and wireless tiers can be skipped.
+    if ( tiers & RouteTier )
+    {
+        getDefaultRoute( AF_INET, &ip4DefGw );
+        getDefaultRoute( AF_INET6, &ip6DefGw );
+    }
 
-    foreach ( QString key, mInterfaces.keys() )
+    for ( int i = 0; i < mSlots.count(); ++i )
     {
-        BackendData *interface = mInterfaces.value( key );
+        const QString& key = mSlots.at( i ).name;
+        BackendData *interface = mSlots.at( i ).data;
         interface->status = KNemoIface::UnknownState;
         interface->incomingBytes = 0;
         interface->outgoingBytes = 0;
         interface->prevRxPackets = interface->rxPackets;
         interface->prevTxPackets = interface->txPackets;
-        interface->rxPackets = 0;
-        interface->txPackets = 0;
         interface->addrData.clear();
         interface->ip4DefaultGateway = ip4DefGw;
         interface->ip6DefaultGateway = ip6DefGw;
         interface->interfaceType = KNemoIface::Ethernet;
 
-        updateIfaceData( ifap, key, interface );
+        updateIfaceData( ifap, i, interface );
 
-        if ( m_fd >= 0 )
+        if ( m_fd >= 0 && tiers & WirelessTier )
         {
             char essidData[ 32 ];
             int len;
@@ -131,7 +135,43 @@ void BSDBackend::update()
     }
 
     freeifaddrs( ifap );
-    updateComplete();
+}
+
+void BSDBackend::readCounters( const QVector<SampleTarget>& targets )
+{
+    struct ifaddrs *ifap;
+    if ( getifaddrs( &ifap ) < 0 )
+        return;
+    quint64 now = monotonicTime();
+
+    for ( int i = 0; i < targets.count(); ++i )
+    {
+        const SampleTarget& target = targets.at( i );
+        CounterSample sample;
+        sample.time = now;
+
+        struct ifaddrs *ifa;
+        for ( ifa = ifap; ifa != NULL; ifa = ifa->ifa_next )
+        {
+            if ( target.name != ifa->ifa_name )
+                continue;
+            sample.present = true;
+            sample.flags = ifa->ifa_flags;
+            if ( ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_LINK && ifa->ifa_data )
+            {
+                struct if_data * stats = static_cast<if_data *>(ifa->ifa_data);
+                sample.rxPackets += stats->ifi_ipackets;
+                sample.txPackets += stats->ifi_opackets;
+                sample.rxBytes += stats->ifi_ibytes;
+                sample.txBytes += stats->ifi_obytes;
+                // u_long on some platforms
+                sample.counterBits = sizeof( stats->ifi_ibytes ) * 8;
+            }
+        }
+        target.slot->write( sample );
+    }
+
+    freeifaddrs( ifap );
 }
 
 QString BSDBackend::defaultRouteIface( int afInet )
@@ -281,14 +321,13 @@ int BSDBackend::getSubnet( struct ifaddrs * ifa )
     return len;
 }
 
-void BSDBackend::updateIfaceData( struct ifaddrs * ifap, const QString& ifName, BackendData* data )
+void BSDBackend::updateIfaceData( struct ifaddrs * ifap, int slot, BackendData* data )
 {
+    const QByteArray& ifName = localName( slot );
     struct ifaddrs *ifa;
-    unsigned long rx_bytes = 0, tx_bytes = 0;
     for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next)
     {
-        QString ifaddrName( ifa->ifa_name );
-        if ( ifName != ifaddrName )
+        if ( ifName != ifa->ifa_name )
             continue;
 
         data->status = KNemoIface::Available;
@@ -313,14 +352,6 @@ void BSDBackend::updateIfaceData( struct ifaddrs * ifap, const QString& ifName,
                          && sdl->sdl_alen == ETHER_ADDR_LEN )
                         data->hwAddress = ether_ntoa((struct ether_addr *)LLADDR(sdl));
                 }
-                if ( ifa->ifa_data )
-                {
-                    struct if_data * stats = static_cast<if_data *>(ifa->ifa_data);
-                    data->rxPackets += stats->ifi_ipackets;
-                    data->txPackets += stats->ifi_opackets;
-                    rx_bytes += stats->ifi_ibytes;
-                    tx_bytes += stats->ifi_obytes;
-                }
             }
             // inet address
             else if ( ifa->ifa_addr->sa_family == AF_INET ||
@@ -334,7 +365,7 @@ void BSDBackend::updateIfaceData( struct ifaddrs * ifap, const QString& ifName,
                 // Check here too for non-ethernet interfaces
                 struct ifmediareq ifmr;
                 memset( &ifmr, 0, sizeof( ifmr ) );
-                strncpy( ifmr.ifm_name, ifName.toLatin1(), sizeof( ifmr.ifm_name ) );
+                strncpy( ifmr.ifm_name, ifName, sizeof( ifmr.ifm_name ) );
                 if ( ioctl( m_fd, SIOCGIFMEDIA, &ifmr ) >= 0 &&
                      ifmr.ifm_status & IFM_AVALID &&
                      ifmr.ifm_status & IFM_ACTIVE &&
@@ -359,11 +390,16 @@ void BSDBackend::updateIfaceData( struct ifaddrs * ifap, const QString& ifName,
 
     }
 
-    // Traffic stats. No check needed: if there were no stats,
-    // values are and always were 0
-    incBytes( data->interfaceType, rx_bytes, data->incomingBytes, data->prevRxBytes, data->rxBytes );
+    // Traffic stats come from the sampler thread. No check needed: if
+    // there were no stats, values are and always were 0
+    CounterSample sample;
+    if ( readSample( slot, sample ) )
+    {
+        data->rxPackets = sample.rxPackets;
+        data->txPackets = sample.txPackets;
+        incBytes( data, sample.rxBytes, sample.txBytes, sample.counterBits, sample.time );
+    }
     data->rxString = KIO::convertSize( data->rxBytes );
-    incBytes( data->interfaceType, tx_bytes, data->outgoingBytes, data->prevTxBytes, data->txBytes );
     data->txString = KIO::convertSize( data->txBytes );
 
     if ( data->status < KNemoIface::Available )
@@ -46,12 +46,15 @@ public:
 
     static BackendBase* createInstance();
 
-    virtual void update();
     virtual QStringList ifaceList();
     virtual QString defaultRouteIface( int afInet );
 
+protected:
+    virtual void updateIfaces( int tiers );
+    virtual void readCounters( const QVector<SampleTarget>& targets );
+
 private:
-    void updateIfaceData( struct ifaddrs * ifap, const QString& ifName, BackendData* data );
+    void updateIfaceData( struct ifaddrs * ifap, int slot, BackendData* data );
     void updateWirelessData( const QString& ifName, BackendData* data );
     QString formattedAddr( struct sockaddr * addr );
     QString getAddr( struct ifaddrs *ifa, AddrData& addrData );
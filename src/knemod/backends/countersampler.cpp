@@ -0,0 +1,264 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+#include "backendbase.h"
+#include "countersampler.h"
+
+SampleRing::SampleRing()
+    : mHead( 0 )
+{
+}
+
+void SampleRing::append( const RingEntry& entry )
+{
+    // Only the writer changes mHead, so a plain read is fine here
+    quint32 pos = static_cast<quint32>(static_cast<int>(mHead));
+    mEntries[ pos & ( Capacity - 1 ) ] = entry;
+    mHead.fetchAndStoreRelease( static_cast<int>(pos + 1) );
+}
+
+quint32 SampleRing::head() const
+{
+    return static_cast<quint32>(mHead.fetchAndAddAcquire( 0 ));
+}
+
+bool SampleRing::read( quint32 pos, RingEntry& entry ) const
+{
+    entry = mEntries[ pos & ( Capacity - 1 ) ];
+    // The writer overwrites pos while the head is at pos + Capacity
+    quint32 headAfter = static_cast<quint32>(mHead.fetchAndAddOrdered( 0 ));
+    return headAfter - pos < Capacity;
+}
+
+
+RingCursor::RingCursor()
+    : mRing( NULL ),
+      mPos( 0 )
+{
+}
+
+void RingCursor::attach( const SampleRing *ring )
+{
+    mRing = ring;
+    mPos = ring ? ring->head() : 0;
+}
+
+void RingCursor::keepLast( quint32 count )
+{
+    if ( !mRing )
+        return;
+    quint32 head = mRing->head();
+    if ( head - mPos > count )
+        mPos = head - count;
+}
+
+bool RingCursor::next( RingEntry& entry )
+{
+    if ( !mRing )
+        return false;
+
+    keepLast( SampleRing::Capacity );
+    while ( mPos != mRing->head() )
+    {
+        if ( mRing->read( mPos, entry ) )
+        {
+            mPos++;
+            return true;
+        }
+        // Lapped by the writer while reading; skip to the oldest entry
+        // that is still safe.
+        mPos = mRing->head() - SampleRing::Capacity + 1;
+    }
+    return false;
+}
+
+
+SampleSlot::SampleSlot()
+    : mSeq( 0 )
+{
+}
+
+void SampleSlot::write( const CounterSample& sample )
+{
+    // Odd while the write is in progress
+    mSeq.fetchAndAddOrdered( 1 );
+    mSample = sample;
+    mSeq.fetchAndAddOrdered( 1 );
+
+    if ( sample.present )
+    {
+        RingEntry entry;
+        entry.time = sample.time;
+        entry.rxBytes = sample.rxBytes;
+        entry.txBytes = sample.txBytes;
+        entry.rxPackets = sample.rxPackets;
+        entry.txPackets = sample.txPackets;
+        entry.counterBits = sample.counterBits;
+        mRing.append( entry );
+    }
+}
+
+bool SampleSlot::read( CounterSample& sample ) const
+{
+    forever
+    {
+        int before = mSeq.fetchAndAddAcquire( 0 );
+        if ( before == 0 )
+            return false;
+        if ( before & 1 )
+        {
+            QThread::yieldCurrentThread();
+            continue;
+        }
+        sample = mSample;
+        if ( mSeq.fetchAndAddOrdered( 0 ) == before )
+            return true;
+    }
+}
+
+const SampleRing *SampleSlot::ring() const
+{
+    return &mRing;
+}
+
+
+CounterSampler::CounterSampler( BackendBase *backend )
+    : QThread(),
+      mBackend( backend ),
+      mInterval( 1000000 ),
+      mStop( 0 ),
+      mTimerFd( -1 )
+{
+#ifdef __linux__
+    mTimerFd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+#endif
+}
+
+CounterSampler::~CounterSampler()
+{
+    stop();
+    if ( mTimerFd >= 0 )
+        close( mTimerFd );
+}
+
+void CounterSampler::setInterval( int usec )
+{
+    if ( usec > 0 )
+        mInterval = usec;
+}
+
+void CounterSampler::stop()
+{
+    if ( !isRunning() )
+        return;
+
+    mStop = 1;
+    // Wake the thread up right away instead of waiting for the next tick
+    if ( mTimerFd >= 0 )
+        armTimer( 0 );
+    wait();
+    mStop = 0;
+}
+
+void CounterSampler::armTimer( int usec )
+{
+#ifdef __linux__
+    struct itimerspec spec;
+    if ( usec > 0 )
+    {
+        spec.it_interval.tv_sec = usec / 1000000;
+        spec.it_interval.tv_nsec = ( usec % 1000000 ) * 1000;
+        spec.it_value = spec.it_interval;
+    }
+    else
+    {
+        // Fire once, as soon as possible
+        spec.it_interval.tv_sec = 0;
+        spec.it_interval.tv_nsec = 0;
+        spec.it_value.tv_sec = 0;
+        spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime( mTimerFd, 0, &spec, NULL );
+#else
+    Q_UNUSED( usec );
+#endif
+}
+
+void CounterSampler::run()
+{
+    if ( mTimerFd >= 0 )
+    {
+        int armed = 0;
+        while ( !mStop )
+        {
+            int interval = mInterval;
+            if ( interval != armed )
+            {
+                armTimer( interval );
+                armed = interval;
+            }
+
+            quint64 expirations;
+            if ( read( mTimerFd, &expirations, sizeof( expirations ) ) < 0 && errno != EINTR )
+                break;
+            if ( mStop )
+                break;
+            mBackend->sampleCounters( false );
+        }
+        return;
+    }
+
+    struct timespec next;
+    clock_gettime( CLOCK_MONOTONIC, &next );
+    while ( !mStop )
+    {
+        int interval = mInterval;
+        next.tv_sec += interval / 1000000;
+        next.tv_nsec += ( interval % 1000000 ) * 1000;
+        if ( next.tv_nsec >= 1000000000 )
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+
+        // If we fell behind, start counting from now instead of
+        // firing a burst of ticks to catch up.
+        struct timespec now;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        if ( now.tv_sec > next.tv_sec ||
+             ( now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec ) )
+            next = now;
+
+        while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL ) == EINTR )
+            ;
+        if ( mStop )
+            break;
+        mBackend->sampleCounters( false );
+    }
+}
+
+#include "countersampler.moc"
@@ -0,0 +1,217 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef COUNTERSAMPLER_H
+#define COUNTERSAMPLER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QThread>
+
+class BackendBase;
+
+/**
+ * One reading of an interface's counters, taken by the sampler thread.
+ */
+struct CounterSample
+{
+    CounterSample()
+      : time( 0 ),
+        rxBytes( 0 ),
+        txBytes( 0 ),
+        rxPackets( 0 ),
+        txPackets( 0 ),
+        index( 0 ),
+        flags( 0 ),
+        hwAddrLen( 0 ),
+        counterBits( 64 ),
+        present( false )
+    {}
+
+    // CLOCK_MONOTONIC time the counters were read, in microseconds
+    quint64 time;
+    quint64 rxBytes;
+    quint64 txBytes;
+    quint64 rxPackets;
+    quint64 txPackets;
+    int index;
+    // IFF_* flags of the link
+    unsigned int flags;
+    int hwAddrLen;
+    unsigned char hwAddr[ 32 ];
+    // Width of the kernel's byte counters; narrower ones wrap
+    int counterBits;
+    // false if the interface didn't exist when sampled
+    bool present;
+};
+
+struct RingEntry
+{
+    // CLOCK_MONOTONIC time of the sample, in microseconds
+    quint64 time;
+    quint64 rxBytes;
+    quint64 txBytes;
+    quint64 rxPackets;
+    quint64 txPackets;
+    // Width of the byte counters, as in CounterSample
+    int counterBits;
+};
+
+/**
+ * Whether a counterBits wide counter went from prev to value by wrapping
+ * around.  A counter that went backwards otherwise was reset.
+ */
+inline bool counterWrapped( quint64 value, quint64 prev, int counterBits )
+{
+    return value < prev && counterBits < 64 && prev < ( Q_UINT64_C( 1 ) << counterBits );
+}
+
+/**
+ * What a counter that didn't reset counted from prev to value.
+ */
+inline quint64 counterDelta( quint64 value, quint64 prev, int counterBits )
+{
+    if ( counterWrapped( value, prev, counterBits ) )
+        return value + ( Q_UINT64_C( 1 ) << counterBits ) - prev;
+    return value - prev;
+}
+
+/**
+ * A fixed size history of samples with a single writer.  Readers keep
+ * their own position, see RingCursor, and never block the writer.  A
+ * reader that falls more than Capacity entries behind loses the oldest
+ * ones.
+ */
+class SampleRing
+{
+public:
+    // Must be a power of 2
+    enum { Capacity = 1024 };
+
+    SampleRing();
+
+    void append( const RingEntry& entry );
+    /**
+     * Position one past the newest entry.
+     */
+    quint32 head() const;
+    /**
+     * Copy the entry at pos.  Returns false if the writer overwrote it
+     * while we were reading.
+     */
+    bool read( quint32 pos, RingEntry& entry ) const;
+
+private:
+    mutable QAtomicInt mHead;
+    RingEntry mEntries[ Capacity ];
+};
+
+/**
+ * One consumer's read position in a SampleRing.
+ */
+class RingCursor
+{
+public:
+    RingCursor();
+
+    /**
+     * Start reading ring from its newest entry on.
+     */
+    void attach( const SampleRing *ring );
+    /**
+     * Drop all but the newest count unread entries.
+     */
+    void keepLast( quint32 count );
+    /**
+     * Copy the next unread entry.  Returns false once caught up.
+     */
+    bool next( RingEntry& entry );
+
+private:
+    const SampleRing *mRing;
+    quint32 mPos;
+};
+
+/**
+ * Holds the latest sample of one interface and a history of the previous
+ * ones.  There is only ever one writer at a time, and readers never block
+ * it: a sequence counter that is odd while a write is in progress tells
+ * them to try again.
+ */
+class SampleSlot
+{
+public:
+    SampleSlot();
+
+    void write( const CounterSample& sample );
+    /**
+     * Copy the latest sample.  Returns false if there is none yet.
+     */
+    bool read( CounterSample& sample ) const;
+    /**
+     * History of the samples taken while the interface was present.
+     */
+    const SampleRing *ring() const;
+
+private:
+    mutable QAtomicInt mSeq;
+    CounterSample mSample;
+    SampleRing mRing;
+};
+
+struct SampleTarget
+{
+    QByteArray name;
+    int index;
+    SampleSlot *slot;
+};
+
+/**
+ * Reads the interface counters at a fixed rate in its own thread, so
+ * that a busy GUI thread doesn't delay the samples.  On Linux the thread
+ * waits on a timerfd; elsewhere it sleeps until the next absolute
+ * deadline.
+ */
+class CounterSampler : public QThread
+{
+    Q_OBJECT
+public:
+    CounterSampler( BackendBase *backend );
+    virtual ~CounterSampler();
+
+    /**
+     * Set the sampling interval in microseconds.  Takes effect at the
+     * next tick.
+     */
+    void setInterval( int usec );
+    void stop();
+
+protected:
+    virtual void run();
+
+private:
+    void armTimer( int usec );
+
+    BackendBase *mBackend;
+    QAtomicInt mInterval;
+    QAtomicInt mStop;
+    int mTimerFd;
+};
+
+#endif // COUNTERSAMPLER_H
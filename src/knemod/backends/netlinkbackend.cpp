@@ -18,6 +18,12 @@
    Boston, MA 02110-1301, USA.
 */
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <netlink/msg.h>
 #include <netlink/route/addr.h>
 #include <netlink/route/rtnl.h>
 #include <netlink/route/link.h>
@@ -27,6 +33,8 @@
 #include <net/if.h>
 #endif
 
+#include <QSocketNotifier>
+
 #include <KLocale>
 #include <kio/global.h>
 
@@ -38,20 +46,43 @@
 #define IFF_LOWER_UP   0x10000
 #endif
 
+// Keep each batch of link requests small enough that the replies can't
+// overrun the socket's receive buffer.
+static const int maxLinkRequests = 32;
+
 NetlinkBackend::NetlinkBackend()
     : rtsock( NULL ),
+      evsock( NULL ),
+      statsock( NULL ),
+      mLinkSeq( 0 ),
+      mngr( NULL ),
+      mngrNotifier( NULL ),
+      routesock( NULL ),
+      routeNotifier( NULL ),
+      mRouteDumpPending( false ),
+      mRouteResync( false ),
       addrCache( NULL ),
       linkCache( NULL ),
-      routeCache( NULL )
+      mAddrEpoch( 0 ),
+      mAddrSerial( 0 )
 {
     rtsock = nl_socket_alloc();
     int c = nl_connect(rtsock, NETLINK_ROUTE);
-    if ( c >= 0 )
+    if ( c >= 0 && !setupCacheManager() )
     {
         rtnl_addr_alloc_cache( rtsock, &addrCache );
         rtnl_link_alloc_cache( rtsock, AF_UNSPEC, &linkCache );
-        rtnl_route_alloc_cache( rtsock, AF_UNSPEC, 0, &routeCache );
     }
+    setupRouteMonitor();
+
+    statsock = nl_socket_alloc();
+    if ( statsock && nl_connect( statsock, NETLINK_ROUTE ) >= 0 )
+        nl_socket_set_nonblocking( statsock );
+
+#ifdef HAVE_NL80211
+    if ( nl80211.openSocket() )
+        connect( &nl80211, SIGNAL( changed() ), this, SLOT( wirelessChanged() ) );
+#endif
 #ifdef HAVE_LIBIW
     wireless.openSocket();
 #endif
@@ -59,16 +90,280 @@ NetlinkBackend::NetlinkBackend()
 
 NetlinkBackend::~NetlinkBackend()
 {
-    nl_cache_free( addrCache );
-    nl_cache_free( linkCache );
-    nl_cache_free( routeCache );
+    // The sampler thread uses statsock
+    stopSampler();
+    delete mngrNotifier;
+    delete routeNotifier;
+    nl_close( routesock );
+    nl_socket_free( routesock );
+    if ( mngr )
+    {
+        // The manager frees the caches it owns
+        nl_cache_mngr_free( mngr );
+        nl_socket_free( evsock );
+    }
+    else
+    {
+        nl_cache_free( addrCache );
+        nl_cache_free( linkCache );
+    }
     nl_close( rtsock );
     nl_socket_free( rtsock );
+    nl_close( statsock );
+    nl_socket_free( statsock );
+#ifdef HAVE_NL80211
+    nl80211.closeSocket();
+#endif
 #ifdef HAVE_LIBIW
     wireless.closeSocket();
 #endif
 }
 
+bool NetlinkBackend::setupCacheManager()
+{
+    evsock = nl_socket_alloc();
+    if ( !evsock )
+        return false;
+
+    if ( nl_cache_mngr_alloc( evsock, NETLINK_ROUTE, NL_AUTO_PROVIDE, &mngr ) < 0 )
+    {
+        nl_socket_free( evsock );
+        evsock = NULL;
+        mngr = NULL;
+        return false;
+    }
+
+    // A bigger receive buffer makes it less likely that we overrun when a
+    // lot of interfaces change at once.
+    nl_socket_set_buffer_size( evsock, 1024 * 1024, 0 );
+
+    if ( nl_cache_mngr_add( mngr, "route/link", cacheChanged, this, &linkCache ) < 0 ||
+         nl_cache_mngr_add( mngr, "route/addr", cacheChanged, this, &addrCache ) < 0 )
+    {
+        nl_cache_mngr_free( mngr );
+        nl_socket_free( evsock );
+        evsock = NULL;
+        mngr = NULL;
+        addrCache = linkCache = NULL;
+        return false;
+    }
+
+    mngrNotifier = new QSocketNotifier( nl_cache_mngr_get_fd( mngr ), QSocketNotifier::Read, this );
+    connect( mngrNotifier, SIGNAL( activated( int ) ), this, SLOT( processEvents() ) );
+    return true;
+}
+
+void NetlinkBackend::setupRouteMonitor()
+{
+    // Without this socket there are no default routes at all.  Falling back
+    // to polling the route table is exactly what this is here to avoid.
+    routesock = nl_socket_alloc();
+    if ( !routesock )
+        return;
+
+    // Events and dump replies come in unasked, so there is no sequence to
+    // check and nothing to acknowledge.
+    nl_socket_disable_seq_check( routesock );
+    nl_socket_disable_auto_ack( routesock );
+    nl_socket_modify_cb( routesock, NL_CB_VALID, NL_CB_CUSTOM, routeEvent, this );
+    nl_socket_modify_cb( routesock, NL_CB_FINISH, NL_CB_CUSTOM, routeDumpDone, this );
+    if ( nl_connect( routesock, NETLINK_ROUTE ) < 0 ||
+         nl_socket_add_memberships( routesock, RTNLGRP_IPV4_ROUTE, RTNLGRP_IPV6_ROUTE, 0 ) < 0 )
+    {
+        nl_close( routesock );
+        nl_socket_free( routesock );
+        routesock = NULL;
+        return;
+    }
+    nl_socket_set_nonblocking( routesock );
+    nl_socket_set_buffer_size( routesock, 1024 * 1024, 0 );
+
+    routeNotifier = new QSocketNotifier( nl_socket_get_fd( routesock ), QSocketNotifier::Read, this );
+    connect( routeNotifier, SIGNAL( activated( int ) ), this, SLOT( processRouteEvents() ) );
+    requestRoutes();
+}
+
+void NetlinkBackend::requestRoutes()
+{
+    if ( !routesock )
+        return;
+
+    // The kernel runs one dump per socket at a time
+    if ( mRouteDumpPending )
+    {
+        mRouteResync = true;
+        return;
+    }
+
+    struct rtmsg rtm;
+    memset( &rtm, 0, sizeof( rtm ) );
+    rtm.rtm_family = AF_UNSPEC;
+    if ( nl_send_simple( routesock, RTM_GETROUTE, NLM_F_DUMP, &rtm, sizeof( rtm ) ) >= 0 )
+    {
+        mDumpedRoutes.clear();
+        mRouteDumpPending = true;
+        mRouteResync = false;
+    }
+}
+
+void NetlinkBackend::processRouteEvents()
+{
+    // This reads whatever is queued; the notifier fires again if more
+    // arrives.
+    int err = nl_recvmsgs_default( routesock );
+    if ( err == -NLE_NOMEM )
+    {
+        // An overrun (ENOBUFS) lost events, and maybe the end of a dump
+        mRouteDumpPending = false;
+        requestRoutes();
+    }
+    else if ( err == -NLE_BUSY )
+    {
+        // An older dump is still running; go again once it's done
+        mRouteDumpPending = true;
+        mRouteResync = true;
+    }
+}
+
+int NetlinkBackend::routeEvent( struct nl_msg * msg, void * arg )
+{
+    NetlinkBackend *backend = static_cast<NetlinkBackend *>(arg);
+    struct nlmsghdr *hdr = nlmsg_hdr( msg );
+    DefaultRoute route;
+    if ( !parseDefaultRoute( hdr, &route ) )
+        return NL_OK;
+
+    if ( hdr->nlmsg_flags & NLM_F_MULTI )
+    {
+        // Part of a dump reply
+        backend->mDumpedRoutes.append( route );
+        return NL_OK;
+    }
+
+    QList<DefaultRoute> *lists[] = { &backend->mDefaultRoutes, &backend->mDumpedRoutes };
+    int count = backend->mRouteDumpPending ? 2 : 1;
+    for ( int l = 0; l < count; ++l )
+    {
+        QList<DefaultRoute> *routes = lists[ l ];
+        for ( int i = routes->count() - 1; i >= 0; --i )
+        {
+            const DefaultRoute &r = routes->at( i );
+            if ( r.afType != route.afType || r.priority != route.priority )
+                continue;
+            // A replace takes the place of whatever had the same metric
+            if ( ( hdr->nlmsg_type == RTM_NEWROUTE && hdr->nlmsg_flags & NLM_F_REPLACE ) ||
+                 ( r.gateway == route.gateway && r.iface == route.iface ) )
+                routes->removeAt( i );
+        }
+        if ( hdr->nlmsg_type == RTM_NEWROUTE )
+            routes->append( route );
+    }
+    backend->markDirty( RouteTier );
+    return NL_OK;
+}
+
+int NetlinkBackend::routeDumpDone( struct nl_msg *, void * arg )
+{
+    NetlinkBackend *backend = static_cast<NetlinkBackend *>(arg);
+    if ( backend->mRouteDumpPending )
+    {
+        backend->mDefaultRoutes = backend->mDumpedRoutes;
+        backend->mDumpedRoutes.clear();
+        backend->mRouteDumpPending = false;
+        backend->markDirty( RouteTier );
+        if ( backend->mRouteResync )
+            backend->requestRoutes();
+    }
+    return NL_STOP;
+}
+
+QString NetlinkBackend::defaultRoute( int afType, QString * gateway ) const
+{
+    const DefaultRoute *best = NULL;
+    for ( int i = 0; i < mDefaultRoutes.count(); ++i )
+    {
+        const DefaultRoute &route = mDefaultRoutes.at( i );
+        if ( route.afType == afType && ( !best || route.priority < best->priority ) )
+            best = &route;
+    }
+
+    if ( gateway )
+        *gateway = best ? best->gateway : QString();
+    return best ? best->iface : QString();
+}
+
+void NetlinkBackend::processEvents()
+{
+    // Anything other than EAGAIN means we lost messages (usually ENOBUFS),
+    // so the caches could be stale.
+    if ( nl_cache_mngr_data_ready( mngr ) < 0 )
+        resyncCaches();
+}
+
+void NetlinkBackend::wirelessChanged()
+{
+    markDirty( WirelessTier );
+}
+
+void NetlinkBackend::cacheChanged( nl_cache * cache, nl_object * obj, int action, void * arg )
+{
+    NetlinkBackend *backend = static_cast<NetlinkBackend *>(arg);
+    if ( cache == backend->linkCache )
+    {
+        struct rtnl_link * link = reinterpret_cast<struct rtnl_link *>(obj);
+        if ( action == NL_ACT_DEL )
+        {
+            backend->linkRemoved( rtnl_link_get_ifindex( link ) );
+            backend->mAddrGenerations.remove( rtnl_link_get_ifindex( link ) );
+        }
+        else
+            backend->linkChanged( rtnl_link_get_ifindex( link ),
+                                  QString::fromLocal8Bit( rtnl_link_get_name( link ) ) );
+        // Routes usually come and go with the link, but the kernel doesn't
+        // announce the IPv4 routes it drops along with a downed link.
+        if ( action == NL_ACT_DEL || !( rtnl_link_get_flags( link ) & IFF_UP ) )
+            backend->requestRoutes();
+        backend->markDirty( AddressTier | RouteTier | WirelessTier );
+    }
+    else if ( cache == backend->addrCache )
+    {
+        backend->addrChanged( rtnl_addr_get_ifindex( reinterpret_cast<struct rtnl_addr *>(obj) ) );
+        backend->markDirty( AddressTier | RouteTier );
+    }
+}
+
+void NetlinkBackend::addrChanged( int ifindex )
+{
+    // Address events can still trickle in after their link is gone, and
+    // an entry for a dead link would never be removed
+    struct rtnl_link *link = rtnl_link_get( linkCache, ifindex );
+    if ( !link )
+        return;
+    rtnl_link_put( link );
+    mAddrGenerations.insert( ifindex, ++mAddrSerial );
+}
+
+unsigned int NetlinkBackend::addrGeneration( int ifindex ) const
+{
+    return qMax( mAddrGenerations.value( ifindex ), mAddrEpoch );
+}
+
+void NetlinkBackend::newAddrEpoch()
+{
+    // Every generation we have is older than the new epoch
+    mAddrEpoch = ++mAddrSerial;
+    mAddrGenerations.clear();
+}
+
+void NetlinkBackend::resyncCaches()
+{
+    markDirty( AllTiers );
+    invalidateIndexes();
+    newAddrEpoch();
+    nl_cache_resync( rtsock, linkCache, NULL, NULL );
+    nl_cache_resync( rtsock, addrCache, NULL, NULL );
+}
+
 QStringList NetlinkBackend::ifaceList()
 {
     QStringList ifaces;
@@ -83,30 +378,76 @@ QStringList NetlinkBackend::ifaceList()
     }
     return ifaces;
 }
-void NetlinkBackend::update()
+void NetlinkBackend::updateIfaces( int tiers )
 {
-    nl_cache_refill( rtsock, addrCache );
-    nl_cache_refill( rtsock, linkCache );
-    nl_cache_refill( rtsock, routeCache );
+    if ( !mngr && tiers & AddressTier )
+    {
+        nl_cache_refill( rtsock, addrCache );
+        nl_cache_refill( rtsock, linkCache );
+        invalidateIndexes();
+        newAddrEpoch();
+    }
 
-    getDefaultRoute( AF_INET, &ip4DefGw, routeCache );
-    getDefaultRoute( AF_INET6, &ip6DefGw, routeCache );
+    if ( tiers & RouteTier )
+    {
+        defaultRoute( AF_INET, &ip4DefGw );
+        defaultRoute( AF_INET6, &ip6DefGw );
+    }
 
-    foreach ( QString key, mInterfaces.keys() )
+    for ( int i = 0; i < mSlots.count(); ++i )
     {
-        BackendData *interface = mInterfaces.value( key );
-        updateIfaceData( key, interface );
+        BackendData *interface = mSlots.at( i ).data;
+        interface->prevRxPackets = interface->rxPackets;
+        interface->prevTxPackets = interface->txPackets;
+
+        CounterSample sample;
+        if ( readSample( i, sample ) && sample.present )
+            updateLinkData( interface, sample );
+        else
+        {
+            interface->status = KNemoIface::Unavailable;
+            interface->incomingBytes = 0;
+            interface->outgoingBytes = 0;
+        }
+    }
 
+    if ( tiers & AddressTier )
+        updateAddresses();
+#ifdef HAVE_NL80211
+    if ( tiers & WirelessTier )
+        nl80211.refresh();
+#endif
+
+    for ( int i = 0; i < mSlots.count(); ++i )
+    {
+        BackendData *interface = mSlots.at( i ).data;
+        updateIfaceData( interface, tiers );
+
+        if ( tiers & WirelessTier )
+        {
+            bool done = false;
+#ifdef HAVE_NL80211
+            done = nl80211.update( interface->index, interface );
+#endif
 #ifdef HAVE_LIBIW
-        wireless.update( key, interface );
+            if ( !done )
+                wireless.update( localName( i ), interface );
 #endif
+            Q_UNUSED( done );
+        }
     }
-    emit updateComplete();
+}
+
+int NetlinkBackend::ifaceIndex( const QString& iface )
+{
+    if ( !linkCache )
+        return 0;
+    return rtnl_link_name2i( linkCache, iface.toLocal8Bit().data() );
 }
 
 QString NetlinkBackend::defaultRouteIface( int afInet )
 {
-    return getDefaultRoute( afInet, NULL, routeCache );
+    return defaultRoute( afInet, NULL );
 }
 
 BackendBase* NetlinkBackend::createInstance()
@@ -114,15 +455,37 @@ BackendBase* NetlinkBackend::createInstance()
     return new NetlinkBackend();
 }
 
-void NetlinkBackend::updateAddresses( BackendData *data )
+void NetlinkBackend::updateAddresses()
 {
+    if ( !addrCache )
+        return;
+
+    // Only interfaces whose addresses changed since we last looked
+    QHash<int, BackendData *> stale;
+    for ( int i = 0; i < mSlots.count(); ++i )
+    {
+        BackendData *data = mSlots.at( i ).data;
+        if ( data->status < KNemoIface::Available || data->index <= 0 )
+            continue;
+        unsigned int generation = addrGeneration( data->index );
+        if ( data->addrIndex == data->index && data->addrGeneration == generation )
+            continue;
+        data->addrData.clear();
+        data->addrIndex = data->index;
+        data->addrGeneration = generation;
+        stale.insert( data->index, data );
+    }
+    if ( stale.isEmpty() )
+        return;
+
     struct rtnl_addr * rtaddr;
     for ( rtaddr = reinterpret_cast<struct rtnl_addr *>(nl_cache_get_first( addrCache ));
           rtaddr != NULL;
           rtaddr = reinterpret_cast<struct rtnl_addr *>(nl_cache_get_next( reinterpret_cast<struct nl_object *>(rtaddr) ))
         )
     {
-        if ( data->index != rtnl_addr_get_ifindex( rtaddr ) )
+        BackendData *data = stale.value( rtnl_addr_get_ifindex( rtaddr ) );
+        if ( !data )
             continue;
 
         struct nl_addr * addr = rtnl_addr_get_local( rtaddr );
@@ -183,69 +546,207 @@ void NetlinkBackend::updateAddresses( BackendData *data )
     }
 }
 
-void NetlinkBackend::updateIfaceData( const QString& ifName, BackendData* data )
+void NetlinkBackend::readCounters( const QVector<SampleTarget>& targets )
 {
-    if ( !linkCache || !addrCache )
-        return;
+    QHash<int, SampleSlot *> pending;
+    QByteArray requests;
+    struct
+    {
+        struct nlmsghdr hdr;
+        struct ifinfomsg ifi;
+    } req;
 
-    data->status = KNemoIface::UnknownState;
-    data->incomingBytes = 0;
-    data->outgoingBytes = 0;
-    data->prevRxPackets = data->rxPackets;
-    data->prevTxPackets = data->txPackets;
-    data->addrData.clear();
-    data->ip4DefaultGateway = ip4DefGw;
-    data->ip6DefaultGateway = ip6DefGw;
-
-    struct rtnl_link * link = rtnl_link_get_by_name( linkCache, ifName.toLocal8Bit().data() );
-    if ( link )
-    {
-        data->index = rtnl_link_get_ifindex( link );
-        unsigned long rx_bytes = 0, tx_bytes = 0;
-        char mac[ 20 ];
-        memset( mac, 0, sizeof( mac ) );
-
-        unsigned int flags = rtnl_link_get_flags( link );
-        if ( flags & IFF_POINTOPOINT )
-            data->interfaceType = KNemoIface::PPP;
-        else
-            data->interfaceType = KNemoIface::Ethernet;
+    for ( int i = 0; i < targets.count(); ++i )
+    {
+        const SampleTarget& target = targets.at( i );
+        if ( target.index <= 0 )
+        {
+            CounterSample sample;
+            sample.time = monotonicTime();
+            target.slot->write( sample );
+            continue;
+        }
 
-        // hw address
-        struct nl_addr * addr = rtnl_link_get_addr( link );
-        if ( addr && nl_addr_get_len( addr ) )
-            nl_addr2str( addr, mac, sizeof( mac ) );
-        data->hwAddress = mac;
+        memset( &req, 0, sizeof( req ) );
+        req.hdr.nlmsg_len = NLMSG_LENGTH( sizeof( struct ifinfomsg ) );
+        req.hdr.nlmsg_type = RTM_GETLINK;
+        req.hdr.nlmsg_flags = NLM_F_REQUEST;
+        req.hdr.nlmsg_seq = ++mLinkSeq;
+        req.ifi.ifi_family = AF_UNSPEC;
+        req.ifi.ifi_index = target.index;
+        requests.append( reinterpret_cast<const char *>(&req), NLMSG_ALIGN( req.hdr.nlmsg_len ) );
+        pending.insert( target.index, target.slot );
+
+        if ( pending.count() == maxLinkRequests )
+        {
+            sendLinkRequests( requests, pending );
+            requests.clear();
+            pending.clear();
+        }
+    }
 
-        // traffic statistics
-        data->rxPackets = rtnl_link_get_stat( link, RTNL_LINK_RX_PACKETS );
-        data->txPackets = rtnl_link_get_stat( link, RTNL_LINK_TX_PACKETS );
-        rx_bytes = rtnl_link_get_stat( link, RTNL_LINK_RX_BYTES );
-        tx_bytes = rtnl_link_get_stat( link, RTNL_LINK_TX_BYTES );
+    if ( pending.count() )
+        sendLinkRequests( requests, pending );
+}
+
+void NetlinkBackend::sendLinkRequests( const QByteArray& requests, QHash<int, SampleSlot *>& pending )
+{
+    // The requests carry the sequence numbers up to mLinkSeq
+    unsigned int firstSeq = mLinkSeq - pending.count() + 1;
+    unsigned int count = pending.count();
 
-        incBytes( data->interfaceType, rx_bytes, data->incomingBytes, data->prevRxBytes, data->rxBytes );
-        incBytes( data->interfaceType, tx_bytes, data->outgoingBytes, data->prevTxBytes, data->txBytes );
-        data->rxString = KIO::convertSize( data->rxBytes );
-        data->txString = KIO::convertSize( data->txBytes );
+    // The kernel handles every request in the buffer before sendmsg returns,
+    // so all of the replies are already queued when we start reading.
+    int replies = 0;
+    if ( nl_sendto( statsock, const_cast<char *>(requests.data()), requests.size() ) >= 0 )
+        replies = pending.count();
 
-        updateAddresses( data );
+    while ( replies > 0 )
+    {
+        unsigned char *buf = NULL;
+        struct sockaddr_nl peer;
+        int n = nl_recv( statsock, &peer, &buf, NULL );
+        if ( n <= 0 )
+        {
+            free( buf );
+            break;
+        }
 
-        data->status = KNemoIface::Available;
-        if ( flags & IFF_UP )
+        struct nlmsghdr *hdr = reinterpret_cast<struct nlmsghdr *>(buf);
+        while ( nlmsg_ok( hdr, n ) )
         {
-            data->status |= KNemoIface::Up;
-            if ( rtnl_link_get_flags( link ) & IFF_LOWER_UP )
+            // Anything else is left over from a batch we gave up on
+            bool ours = hdr->nlmsg_seq - firstSeq < count;
+            if ( ours && hdr->nlmsg_type == RTM_NEWLINK )
             {
-                if ( !(flags & IFF_POINTOPOINT) || data->addrData.size() )
-                    data->status |= KNemoIface::Connected;
+                parseLink( hdr, pending );
+                replies--;
             }
+            else if ( ours && hdr->nlmsg_type == NLMSG_ERROR )
+            {
+                // Most likely the link vanished after we looked up its index
+                replies--;
+            }
+            hdr = nlmsg_next( hdr, &n );
         }
+        free( buf );
+    }
 
+    // Whatever is left didn't answer
+    CounterSample sample;
+    sample.time = monotonicTime();
+    foreach ( SampleSlot *slot, pending )
+        slot->write( sample );
+}
 
-        rtnl_link_put( link );
+void NetlinkBackend::parseLink( struct nlmsghdr * hdr, QHash<int, SampleSlot *>& pending )
+{
+    struct ifinfomsg *ifi = static_cast<struct ifinfomsg *>(nlmsg_data( hdr ));
+    SampleSlot *slot = pending.take( ifi->ifi_index );
+    if ( !slot )
+        return;
+
+    CounterSample sample;
+    sample.time = monotonicTime();
+
+    struct nlattr *tb[ IFLA_MAX + 1 ];
+    if ( nlmsg_parse( hdr, sizeof( struct ifinfomsg ), tb, IFLA_MAX, NULL ) < 0 )
+    {
+        slot->write( sample );
+        return;
+    }
+
+    sample.present = true;
+    sample.index = ifi->ifi_index;
+    sample.flags = ifi->ifi_flags;
+
+    if ( tb[ IFLA_ADDRESS ] )
+    {
+        sample.hwAddrLen = qMin( nla_len( tb[ IFLA_ADDRESS ] ), static_cast<int>(sizeof( sample.hwAddr )) );
+        memcpy( sample.hwAddr, nla_data( tb[ IFLA_ADDRESS ] ), sample.hwAddrLen );
+    }
+
+    // Older kernels send shorter stats than our headers describe; the
+    // fields we read are at the front and the rest stays zero.
+    if ( tb[ IFLA_STATS64 ] )
+    {
+        struct rtnl_link_stats64 stats;
+        memset( &stats, 0, sizeof( stats ) );
+        memcpy( &stats, nla_data( tb[ IFLA_STATS64 ] ),
+                qMin( nla_len( tb[ IFLA_STATS64 ] ), static_cast<int>(sizeof( stats )) ) );
+        sample.rxPackets = stats.rx_packets;
+        sample.txPackets = stats.tx_packets;
+        sample.rxBytes = stats.rx_bytes;
+        sample.txBytes = stats.tx_bytes;
     }
+    else if ( tb[ IFLA_STATS ] )
+    {
+        struct rtnl_link_stats stats;
+        memset( &stats, 0, sizeof( stats ) );
+        memcpy( &stats, nla_data( tb[ IFLA_STATS ] ),
+                qMin( nla_len( tb[ IFLA_STATS ] ), static_cast<int>(sizeof( stats )) ) );
+        sample.rxPackets = stats.rx_packets;
+        sample.txPackets = stats.tx_packets;
+        sample.rxBytes = stats.rx_bytes;
+        sample.txBytes = stats.tx_bytes;
+        sample.counterBits = 32;
+    }
+
+    slot->write( sample );
+}
+
+void NetlinkBackend::updateLinkData( BackendData* data, const CounterSample& sample )
+{
+    data->index = sample.index;
+    if ( sample.flags & IFF_POINTOPOINT )
+        data->interfaceType = KNemoIface::PPP;
     else
-        data->status = KNemoIface::Unavailable;
+        data->interfaceType = KNemoIface::Ethernet;
+
+    // hw address
+    data->hwAddress.clear();
+    for ( int i = 0; i < sample.hwAddrLen; ++i )
+    {
+        if ( i )
+            data->hwAddress += ':';
+        data->hwAddress += QString( "%1" ).arg( sample.hwAddr[ i ], 2, 16, QChar( '0' ) );
+    }
+
+    // traffic statistics
+    data->rxPackets = sample.rxPackets;
+    data->txPackets = sample.txPackets;
+    incBytes( data, sample.rxBytes, sample.txBytes, sample.counterBits, sample.time );
+    data->rxString = KIO::convertSize( data->rxBytes );
+    data->txString = KIO::convertSize( data->txBytes );
+
+    // A point-to-point link also needs an address before it counts as
+    // connected.  updateIfaceData() takes care of that.
+    data->status = KNemoIface::Available;
+    if ( sample.flags & IFF_UP )
+    {
+        data->status |= KNemoIface::Up;
+        if ( sample.flags & IFF_LOWER_UP )
+            data->status |= KNemoIface::Connected;
+    }
+}
+
+void NetlinkBackend::updateIfaceData( BackendData* data, int tiers )
+{
+    if ( tiers & RouteTier )
+    {
+        data->ip4DefaultGateway = ip4DefGw;
+        data->ip6DefaultGateway = ip6DefGw;
+    }
+
+    if ( !addrCache || data->status < KNemoIface::Available )
+    {
+        data->addrData.clear();
+        data->addrIndex = -1;
+        return;
+    }
+
+    if ( data->interfaceType == KNemoIface::PPP && !data->addrData.size() )
+        data->status &= ~KNemoIface::Connected;
 }
 
 #include "netlinkbackend.moc"
@@ -21,17 +21,39 @@
 #define NETLINKBACKEND_H
 
 #include "backendbase.h"
+#include "utils.h"
+#include <netlink/cache.h>
 #include <netlink/route/link.h>
 
+#ifdef HAVE_NL80211
+#include "netlinkbackend_nl80211.h"
+#endif
 #ifdef HAVE_LIBIW
 #include "netlinkbackend_wireless.h"
 #endif
 
+class QSocketNotifier;
+
 /**
- * This uses libnl and libiw to get information.
+ * This uses libnl and nl80211 (or libiw on older systems) to get information.
  * It then triggers the interface monitor to look for changes
  * in the state of the interface.
  *
+ * Link and address caches are kept current by a netlink cache manager
+ * listening to rtnetlink multicast groups, and changes to them mark the
+ * matching update tier dirty.  Routes are not cached, since a router can
+ * carry a full table.  A socket of their own listens to the route groups
+ * and keeps just the default routes of the main table; the table is only
+ * dumped at startup, after link changes (the kernel drops IPv4 routes of a
+ * downed link silently) and after an overrun.  The sampler thread queries
+ * the counters with one RTM_GETLINK per monitored interface sent in a
+ * single batch on a socket of its own.  If the cache manager cannot be set up, the caches
+ * get refilled whenever the address tier is due instead.
+ *
+ * Every address event bumps a generation number for its ifindex.  When the
+ * address tier is due, a single walk over the address cache rebuilds the
+ * addresses of just those interfaces whose generation moved.
+ *
  * @short Update the information of the interfaces via netlink
  * @author John Stamp <jstamp@users.sourceforge.net>
  */
@@ -45,15 +67,61 @@ public:
 
     static BackendBase* createInstance();
 
-    virtual void update();
     virtual QStringList ifaceList();
     virtual QString defaultRouteIface( int afInet );
 
+protected:
+    virtual void updateIfaces( int tiers );
+    virtual void readCounters( const QVector<SampleTarget>& targets );
+    virtual int ifaceIndex( const QString& iface );
+
+private slots:
+    void processEvents();
+    void processRouteEvents();
+    void wirelessChanged();
+
 private:
-    void updateIfaceData( const QString& ifName, BackendData* data );
-    void updateAddresses( BackendData* data );
+    static void cacheChanged( nl_cache * cache, nl_object * obj, int action, void * arg );
+    static int routeEvent( struct nl_msg * msg, void * arg );
+    static int routeDumpDone( struct nl_msg * msg, void * arg );
+    bool setupCacheManager();
+    void setupRouteMonitor();
+    void requestRoutes();
+    QString defaultRoute( int afType, QString * gateway ) const;
+    void resyncCaches();
+    void sendLinkRequests( const QByteArray& requests, QHash<int, SampleSlot *>& pending );
+    void parseLink( struct nlmsghdr * hdr, QHash<int, SampleSlot *>& pending );
+    void updateLinkData( BackendData* data, const CounterSample& sample );
+    void updateIfaceData( BackendData* data, int tiers );
+    void addrChanged( int ifindex );
+    void updateAddresses();
+    unsigned int addrGeneration( int ifindex ) const;
+    void newAddrEpoch();
     nl_sock * rtsock;
-    nl_cache *addrCache, *linkCache, *routeCache;
+    nl_sock * evsock;
+    // Only used from readCounters()
+    nl_sock * statsock;
+    unsigned int mLinkSeq;
+    nl_cache_mngr * mngr;
+    QSocketNotifier * mngrNotifier;
+    nl_sock * routesock;
+    QSocketNotifier * routeNotifier;
+    // Default routes of the main table, and the ones a dump in progress
+    // has brought in so far
+    QList<DefaultRoute> mDefaultRoutes;
+    QList<DefaultRoute> mDumpedRoutes;
+    bool mRouteDumpPending;
+    bool mRouteResync;
+    nl_cache *addrCache, *linkCache;
+    // Last generation each ifindex's addresses changed at, for links that
+    // exist.  Emptied whenever a new epoch starts.
+    QHash<int, unsigned int> mAddrGenerations;
+    // Generation of the last refill; everything before it is stale
+    unsigned int mAddrEpoch;
+    unsigned int mAddrSerial;
+#ifdef HAVE_NL80211
+    NetlinkBackend_Nl80211 nl80211;
+#endif
 #ifdef HAVE_LIBIW
     NetlinkBackend_Wireless wireless;
 #endif
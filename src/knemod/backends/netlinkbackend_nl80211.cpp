@@ -0,0 +1,407 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <linux/nl80211.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+#include <netlink/msg.h>
+#include <netlink/netlink.h>
+
+#include <QSocketNotifier>
+
+#include "netlinkbackend_nl80211.h"
+
+// Capability bit of a BSS that requires encryption
+static const int capabilityPrivacy = 1 << 4;
+
+struct StationReply
+{
+    StationReply() : valid( false ), haveSignal( false ), signal( 0 ), bitrate( 0 ) {}
+    bool valid;
+    QString mac;
+    bool haveSignal;
+    int signal;
+    // in 100 kbit/s
+    int bitrate;
+};
+
+static struct nlattr ** parseReply( struct nl_msg * msg, struct nlattr ** tb )
+{
+    struct genlmsghdr *gnlh = static_cast<struct genlmsghdr *>(nlmsg_data( nlmsg_hdr( msg ) ));
+    if ( nla_parse( tb, NL80211_ATTR_MAX, genlmsg_attrdata( gnlh, 0 ),
+                    genlmsg_attrlen( gnlh, 0 ), NULL ) < 0 )
+        return NULL;
+    return tb;
+}
+
+static int interfaceHandler( struct nl_msg * msg, void * arg )
+{
+    QHash<int, Nl80211Interface> *interfaces = static_cast<QHash<int, Nl80211Interface> *>(arg);
+    struct nlattr *tb[ NL80211_ATTR_MAX + 1 ];
+    if ( !parseReply( msg, tb ) || !tb[ NL80211_ATTR_IFINDEX ] )
+        return NL_SKIP;
+
+    Nl80211Interface *reply = &(*interfaces)[ nla_get_u32( tb[ NL80211_ATTR_IFINDEX ] ) ];
+    if ( tb[ NL80211_ATTR_IFTYPE ] )
+        reply->iftype = nla_get_u32( tb[ NL80211_ATTR_IFTYPE ] );
+    if ( tb[ NL80211_ATTR_SSID ] )
+        reply->ssid = QString::fromUtf8( static_cast<const char *>(nla_data( tb[ NL80211_ATTR_SSID ] )),
+                                         nla_len( tb[ NL80211_ATTR_SSID ] ) );
+    if ( tb[ NL80211_ATTR_WIPHY_FREQ ] )
+        reply->freq = nla_get_u32( tb[ NL80211_ATTR_WIPHY_FREQ ] );
+    return NL_SKIP;
+}
+
+static int stationHandler( struct nl_msg * msg, void * arg )
+{
+    StationReply *reply = static_cast<StationReply *>(arg);
+    // A station interface only has one peer: its access point
+    if ( reply->valid )
+        return NL_SKIP;
+
+    struct nlattr *tb[ NL80211_ATTR_MAX + 1 ];
+    struct nlattr *sinfo[ NL80211_STA_INFO_MAX + 1 ];
+    if ( !parseReply( msg, tb ) || !tb[ NL80211_ATTR_STA_INFO ] ||
+         nla_parse_nested( sinfo, NL80211_STA_INFO_MAX, tb[ NL80211_ATTR_STA_INFO ], NULL ) < 0 )
+        return NL_SKIP;
+
+    reply->valid = true;
+    if ( tb[ NL80211_ATTR_MAC ] )
+    {
+        const unsigned char *mac = static_cast<const unsigned char *>(nla_data( tb[ NL80211_ATTR_MAC ] ));
+        for ( int i = 0; i < nla_len( tb[ NL80211_ATTR_MAC ] ); ++i )
+        {
+            if ( i )
+                reply->mac += ':';
+            reply->mac += QString( "%1" ).arg( static_cast<uint>(mac[ i ]), 2, 16, QChar( '0' ) ).toUpper();
+        }
+    }
+
+    if ( sinfo[ NL80211_STA_INFO_SIGNAL ] )
+    {
+        reply->haveSignal = true;
+        reply->signal = static_cast<qint8>(nla_get_u8( sinfo[ NL80211_STA_INFO_SIGNAL ] ));
+    }
+
+    struct nlattr *rinfo[ NL80211_RATE_INFO_MAX + 1 ];
+    if ( sinfo[ NL80211_STA_INFO_TX_BITRATE ] &&
+         nla_parse_nested( rinfo, NL80211_RATE_INFO_MAX, sinfo[ NL80211_STA_INFO_TX_BITRATE ], NULL ) >= 0 )
+    {
+        if ( rinfo[ NL80211_RATE_INFO_BITRATE32 ] )
+            reply->bitrate = nla_get_u32( rinfo[ NL80211_RATE_INFO_BITRATE32 ] );
+        else if ( rinfo[ NL80211_RATE_INFO_BITRATE ] )
+            reply->bitrate = nla_get_u16( rinfo[ NL80211_RATE_INFO_BITRATE ] );
+    }
+    return NL_SKIP;
+}
+
+static int scanHandler( struct nl_msg * msg, void * arg )
+{
+    Nl80211Bss *reply = static_cast<Nl80211Bss *>(arg);
+    struct nlattr *tb[ NL80211_ATTR_MAX + 1 ];
+    struct nlattr *bss[ NL80211_BSS_MAX + 1 ];
+    if ( reply->found || !parseReply( msg, tb ) || !tb[ NL80211_ATTR_BSS ] ||
+         nla_parse_nested( bss, NL80211_BSS_MAX, tb[ NL80211_ATTR_BSS ], NULL ) < 0 )
+        return NL_SKIP;
+
+    // Only the BSS we are part of is interesting
+    if ( !bss[ NL80211_BSS_STATUS ] )
+        return NL_SKIP;
+    unsigned int status = nla_get_u32( bss[ NL80211_BSS_STATUS ] );
+    if ( status != NL80211_BSS_STATUS_ASSOCIATED && status != NL80211_BSS_STATUS_IBSS_JOINED )
+        return NL_SKIP;
+
+    reply->found = true;
+    if ( bss[ NL80211_BSS_CAPABILITY ] )
+        reply->privacy = nla_get_u16( bss[ NL80211_BSS_CAPABILITY ] ) & capabilityPrivacy;
+
+    if ( bss[ NL80211_BSS_INFORMATION_ELEMENTS ] )
+    {
+        const unsigned char *ie = static_cast<const unsigned char *>(nla_data( bss[ NL80211_BSS_INFORMATION_ELEMENTS ] ));
+        int len = nla_len( bss[ NL80211_BSS_INFORMATION_ELEMENTS ] );
+        while ( len >= 2 && len >= ie[ 1 ] + 2 )
+        {
+            // Element 0 is the SSID
+            if ( ie[ 0 ] == 0 )
+            {
+                reply->ssid = QString::fromUtf8( reinterpret_cast<const char *>(ie + 2), ie[ 1 ] );
+                break;
+            }
+            len -= ie[ 1 ] + 2;
+            ie += ie[ 1 ] + 2;
+        }
+    }
+    return NL_SKIP;
+}
+
+static int finishHandler( struct nl_msg *, void * arg )
+{
+    *static_cast<int *>(arg) = 0;
+    return NL_STOP;
+}
+
+static int errorHandler( struct sockaddr_nl *, struct nlmsgerr * err, void * arg )
+{
+    *static_cast<int *>(arg) = err->error ? err->error : -1;
+    return NL_STOP;
+}
+
+static QString modeName( int iftype )
+{
+    // Same names that libiw uses
+    switch ( iftype )
+    {
+        case NL80211_IFTYPE_ADHOC:
+            return "Ad-Hoc";
+        case NL80211_IFTYPE_STATION:
+        case NL80211_IFTYPE_P2P_CLIENT:
+            return "Managed";
+        case NL80211_IFTYPE_AP:
+        case NL80211_IFTYPE_AP_VLAN:
+        case NL80211_IFTYPE_P2P_GO:
+            return "Master";
+        case NL80211_IFTYPE_WDS:
+            return "Repeater";
+        case NL80211_IFTYPE_MONITOR:
+            return "Monitor";
+        case NL80211_IFTYPE_MESH_POINT:
+            return "Mesh";
+        default:
+            return "Auto";
+    }
+}
+
+static int freqToChannel( int freq )
+{
+    if ( freq == 2484 )
+        return 14;
+    if ( freq < 2484 )
+        return ( freq - 2407 ) / 5;
+    if ( freq >= 4910 && freq <= 4980 )
+        return ( freq - 4000 ) / 5;
+    if ( freq < 5950 )
+        return ( freq - 5000 ) / 5;
+    if ( freq <= 45000 )
+        return ( freq - 5950 ) / 5;
+    if ( freq >= 58320 && freq <= 70200 )
+        return ( freq - 56160 ) / 2160;
+    return 0;
+}
+
+NetlinkBackend_Nl80211::NetlinkBackend_Nl80211()
+    : QObject(),
+      cmdsock( NULL ),
+      evsock( NULL ),
+      familyId( -1 ),
+      notifier( NULL )
+{
+}
+
+NetlinkBackend_Nl80211::~NetlinkBackend_Nl80211()
+{
+    closeSocket();
+}
+
+bool NetlinkBackend_Nl80211::openSocket()
+{
+    cmdsock = nl_socket_alloc();
+    if ( !cmdsock )
+        return false;
+
+    if ( genl_connect( cmdsock ) < 0 ||
+         ( familyId = genl_ctrl_resolve( cmdsock, "nl80211" ) ) < 0 )
+    {
+        closeSocket();
+        return false;
+    }
+
+    // Events are nice to have, polling still works without them
+    int group = genl_ctrl_resolve_grp( cmdsock, "nl80211", NL80211_MULTICAST_GROUP_MLME );
+    evsock = nl_socket_alloc();
+    if ( group < 0 || !evsock ||
+         genl_connect( evsock ) < 0 ||
+         nl_socket_add_membership( evsock, group ) < 0 )
+    {
+        if ( evsock )
+            nl_socket_free( evsock );
+        evsock = NULL;
+        return true;
+    }
+
+    nl_socket_disable_seq_check( evsock );
+    nl_socket_set_nonblocking( evsock );
+    notifier = new QSocketNotifier( nl_socket_get_fd( evsock ), QSocketNotifier::Read, this );
+    connect( notifier, SIGNAL( activated( int ) ), this, SLOT( processEvents() ) );
+    return true;
+}
+
+void NetlinkBackend_Nl80211::closeSocket()
+{
+    delete notifier;
+    notifier = NULL;
+    if ( evsock )
+    {
+        nl_close( evsock );
+        nl_socket_free( evsock );
+        evsock = NULL;
+    }
+    if ( cmdsock )
+    {
+        nl_close( cmdsock );
+        nl_socket_free( cmdsock );
+        cmdsock = NULL;
+    }
+    familyId = -1;
+}
+
+bool NetlinkBackend_Nl80211::isOpen() const
+{
+    return familyId >= 0;
+}
+
+void NetlinkBackend_Nl80211::processEvents()
+{
+    // Connect, disconnect, roam and channel switches all come through
+    // here.  Any of them can change what we show.
+    nl_recvmsgs_default( evsock );
+    mBss.clear();
+    emit changed();
+}
+
+bool NetlinkBackend_Nl80211::query( int cmd, int flags, int ifindex, ReplyHandler handler, void *arg )
+{
+    struct nl_msg *msg = nlmsg_alloc();
+    if ( !msg )
+        return false;
+    struct nl_cb *cb = nl_cb_alloc( NL_CB_DEFAULT );
+    if ( !cb )
+    {
+        nlmsg_free( msg );
+        return false;
+    }
+
+    genlmsg_put( msg, NL_AUTO_PORT, NL_AUTO_SEQ, familyId, 0, flags, cmd, 0 );
+    if ( ifindex > 0 )
+        nla_put_u32( msg, NL80211_ATTR_IFINDEX, ifindex );
+
+    int err = 1;
+    nl_cb_set( cb, NL_CB_VALID, NL_CB_CUSTOM, handler, arg );
+    nl_cb_set( cb, NL_CB_FINISH, NL_CB_CUSTOM, finishHandler, &err );
+    nl_cb_set( cb, NL_CB_ACK, NL_CB_CUSTOM, finishHandler, &err );
+    nl_cb_err( cb, NL_CB_CUSTOM, errorHandler, &err );
+
+    if ( nl_send_auto_complete( cmdsock, msg ) < 0 )
+        err = -1;
+    while ( err > 0 )
+    {
+        if ( nl_recvmsgs( cmdsock, cb ) < 0 )
+            break;
+    }
+
+    nl_cb_put( cb );
+    nlmsg_free( msg );
+    return err == 0;
+}
+
+void NetlinkBackend_Nl80211::refresh()
+{
+    mInterfaces.clear();
+    if ( !isOpen() )
+        return;
+    query( NL80211_CMD_GET_INTERFACE, NLM_F_DUMP, 0, interfaceHandler, &mInterfaces );
+
+    // Forget the interfaces that went away
+    QHash<int, Nl80211Bss>::iterator i = mBss.begin();
+    while ( i != mBss.end() )
+    {
+        if ( mInterfaces.contains( i.key() ) )
+            ++i;
+        else
+            i = mBss.erase( i );
+    }
+}
+
+bool NetlinkBackend_Nl80211::update( int ifindex, BackendData *data )
+{
+    if ( !isOpen() || !mInterfaces.contains( ifindex ) )
+        return false;
+
+    const Nl80211Interface &iface = mInterfaces[ ifindex ];
+
+    data->isWireless = true;
+    data->mode = modeName( iface.iftype );
+    data->nickName.clear();
+    if ( iface.freq )
+    {
+        data->frequency = QString::number( iface.freq / 1000.0, 'g', 6 ) + " GHz";
+        data->channel = QString::number( freqToChannel( iface.freq ) );
+    }
+
+    StationReply station;
+    query( NL80211_CMD_GET_STATION, NLM_F_DUMP, ifindex, stationHandler, &station );
+    if ( station.valid )
+    {
+        data->accessPoint = station.mac;
+        if ( station.haveSignal )
+        {
+            // Map -100..-50 dBm to 0..100%
+            int quality = qBound( 0, 2 * ( station.signal + 100 ), 100 );
+            data->linkQuality = QString( "%1%" ).arg( quality );
+        }
+        if ( station.bitrate )
+            data->bitRate = QString::number( station.bitrate / 10.0 ) + " Mb/s";
+    }
+    else
+    {
+        data->accessPoint.clear();
+        data->linkQuality = "0";
+        data->bitRate.clear();
+    }
+
+    if ( data->accessPoint != data->prevAccessPoint )
+    {
+        /* Reset encryption status for new access point */
+        data->isEncrypted = false;
+        data->prevAccessPoint = data->accessPoint;
+    }
+
+    data->essid = iface.ssid;
+    if ( !data->accessPoint.isEmpty() )
+    {
+        // Older kernels don't report the SSID with the interface
+        Nl80211Bss &scan = mBss[ ifindex ];
+        if ( scan.accessPoint != data->accessPoint || !scan.found )
+        {
+            scan = Nl80211Bss();
+            scan.accessPoint = data->accessPoint;
+            query( NL80211_CMD_GET_SCAN, NLM_F_DUMP, ifindex, scanHandler, &scan );
+        }
+        if ( scan.found )
+        {
+            data->isEncrypted = scan.privacy;
+            if ( data->essid.isEmpty() )
+                data->essid = scan.ssid;
+        }
+    }
+    if ( data->essid.isEmpty() )
+        data->essid = "any";
+    return true;
+}
+
+#include "netlinkbackend_nl80211.moc"
@@ -0,0 +1,111 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef NETLINKBACKEND_NL80211_H
+#define NETLINKBACKEND_NL80211_H
+
+#include <QHash>
+#include <QObject>
+
+#include "data.h"
+
+struct nl_msg;
+struct nl_sock;
+class QSocketNotifier;
+
+struct Nl80211Interface
+{
+    Nl80211Interface() : iftype( 0 ), freq( 0 ) {}
+    int iftype;
+    QString ssid;
+    int freq;
+};
+
+struct Nl80211Bss
+{
+    Nl80211Bss() : found( false ), privacy( false ) {}
+    // The access point this was looked up for
+    QString accessPoint;
+    bool found;
+    bool privacy;
+    QString ssid;
+};
+
+/**
+ * Gets wireless information from the kernel's nl80211 interface.
+ *
+ * A single dump per round fetches every wireless interface (SSID, mode,
+ * frequency), so interfaces nl80211 doesn't list cost nothing.  Each
+ * wireless interface then needs one request for the station we are
+ * associated with (signal, bitrate).  The encryption status comes from
+ * the scan result of the BSS we are associated with.  That only changes
+ * with the access point, so it is kept until then.  Association, roaming
+ * and disconnect events arrive on the "mlme" multicast group and are
+ * announced with changed().
+ *
+ * @short Update wireless information via nl80211
+ */
+
+class NetlinkBackend_Nl80211 : public QObject
+{
+    Q_OBJECT
+public:
+    NetlinkBackend_Nl80211();
+    virtual ~NetlinkBackend_Nl80211();
+
+    /**
+     * Returns false if the kernel has no nl80211.
+     */
+    bool openSocket();
+    void closeSocket();
+    bool isOpen() const;
+    /**
+     * Look up the wireless interfaces.  Call this before a round of
+     * update().
+     */
+    void refresh();
+    /**
+     * Returns false if nl80211 doesn't know the interface, e.g. because
+     * it is not wireless or its driver only speaks Wireless Extensions.
+     */
+    bool update( int ifindex, BackendData *interface );
+
+signals:
+    /**
+     * An interface associated, roamed or lost its access point.
+     */
+    void changed();
+
+private slots:
+    void processEvents();
+
+private:
+    typedef int (*ReplyHandler)( struct nl_msg *, void * );
+    bool query( int cmd, int flags, int ifindex, ReplyHandler handler, void *arg );
+
+    nl_sock * cmdsock;
+    nl_sock * evsock;
+    int familyId;
+    QSocketNotifier * notifier;
+    // From the last refresh(), by ifindex
+    QHash<int, Nl80211Interface> mInterfaces;
+    QHash<int, Nl80211Bss> mBss;
+};
+
+#endif // NETLINKBACKEND_NL80211_H
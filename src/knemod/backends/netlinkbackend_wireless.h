@@ -29,7 +29,7 @@ class NetlinkBackend_Wireless
         NetlinkBackend_Wireless();
         void openSocket();
         void closeSocket();
-        void update(QString key, BackendData *interface );
+        void update( const QByteArray& ifName, BackendData *interface );
     private:
         int iwfd;
 };
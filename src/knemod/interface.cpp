@@ -47,6 +47,8 @@ Interface::Interface( const QString &ifname,
       mUptimeString( "00:00:00" ),
       mRxRate( 0 ),
       mTxRate( 0 ),
+      mLastSampleTime( 0 ),
+      mHavePlotterEntry( false ),
       mIcon( this ),
       mIfaceStatistics( 0 ),
       mStatusDialog( 0 ),
@@ -55,6 +57,7 @@ Interface::Interface( const QString &ifname,
       mBackendData( data )
 {
     mPlotterDialog = new InterfacePlotterDialog( mIfaceName );
+    mPlotterCursor.attach( backend->sampleRing( mIfaceName ) );
 
     connect( &mIcon, SIGNAL( statisticsSelected() ),
              this, SLOT( showStatisticsDialog() ) );
@@ -214,8 +217,19 @@ void Interface::processUpdate()
     int units = 1;
     if ( generalSettings->useBitrate )
         units = 8;
-    mRxRate = mBackendData->incomingBytes * units / generalSettings->pollInterval;
-    mTxRate = mBackendData->outgoingBytes * units / generalSettings->pollInterval;
+    // Samples are taken on their own schedule, so use the time that
+    // really passed between them.  If there is no new sample since the
+    // last update, keep showing the last rate.
+    double interval = 0.0;
+    if ( mBackendData->sampleTime != mLastSampleTime )
+    {
+        interval = generalSettings->pollInterval;
+        if ( mBackendData->prevSampleTime && mBackendData->sampleTime > mBackendData->prevSampleTime )
+            interval = ( mBackendData->sampleTime - mBackendData->prevSampleTime ) / 1000000.0;
+        mLastSampleTime = mBackendData->sampleTime;
+        mRxRate = mBackendData->incomingBytes * units / interval;
+        mTxRate = mBackendData->outgoingBytes * units / interval;
+    }
     mRxRateStr = formattedRate( mRxRate, generalSettings->useBitrate );
     mTxRateStr = formattedRate( mTxRate, generalSettings->useBitrate );
 
@@ -239,11 +253,10 @@ void Interface::processUpdate()
             if ( mPreviousIfaceState < KNemoIface::Connected )
                 mIfaceStatistics->checkValidEntry();
 
-            mIfaceStatistics->addRxBytes( mBackendData->incomingBytes );
-            mIfaceStatistics->addTxBytes( mBackendData->outgoingBytes );
+            mIfaceStatistics->addBytes( mBackendData->incomingBytes, mBackendData->outgoingBytes );
         }
 
-        updateTime();
+        updateTime( interval );
 
         if ( mPreviousIfaceState < KNemoIface::Connected )
         {
@@ -282,14 +295,54 @@ void Interface::processUpdate()
     if ( mPreviousIfaceState != mIfaceState )
         mIcon.updateTrayStatus();
 
-    if ( mPlotterDialog )
-        mPlotterDialog->updatePlotter( mRxRate, mTxRate );
+    updatePlotter();
 
     mIcon.updateToolTip();
     if ( mStatusDialog )
         mStatusDialog->updateDialog();
 }
 
+void Interface::updatePlotter()
+{
+    // A hidden plotter isn't updated.  Once it is shown again it catches
+    // up from the backend's sample history.
+    if ( !mPlotterDialog || !mPlotterDialog->isVisible() )
+        return;
+
+    int units = 1;
+    if ( generalSettings->useBitrate )
+        units = 8;
+
+    bool added = false;
+    RingEntry entry;
+    while ( mPlotterCursor.next( entry ) )
+    {
+        if ( mHavePlotterEntry && entry.time > mPlotterEntry.time )
+        {
+            double interval = ( entry.time - mPlotterEntry.time ) / 1000000.0;
+            // Same as BackendBase::incBytes(): narrow counters wrap, and
+            // after a reset all they count is new
+            quint64 rx = entry.rxBytes;
+            quint64 tx = entry.txBytes;
+            if ( ( rx >= mPlotterEntry.rxBytes || counterWrapped( rx, mPlotterEntry.rxBytes, entry.counterBits ) ) &&
+                 ( tx >= mPlotterEntry.txBytes || counterWrapped( tx, mPlotterEntry.txBytes, entry.counterBits ) ) )
+            {
+                rx = counterDelta( rx, mPlotterEntry.rxBytes, entry.counterBits );
+                tx = counterDelta( tx, mPlotterEntry.txBytes, entry.counterBits );
+            }
+            mPlotterDialog->updatePlotter( rx * units / interval, tx * units / interval );
+            added = true;
+        }
+        mPlotterEntry = entry;
+        mHavePlotterEntry = true;
+    }
+
+    // Nothing gets sampled while the interface is gone, but the plotter
+    // should keep scrolling.
+    if ( !added && mIfaceState == KNemoIface::Unavailable )
+        mPlotterDialog->updatePlotter( mRxRate, mTxRate );
+}
+
 void Interface::resetUptime()
 {
     mUptime = 0;
@@ -323,6 +376,7 @@ void Interface::showSignalPlotter( bool fromContextMenu )
 {
     // Toggle the signal plotter.
     activateOrHide( mPlotterDialog, fromContextMenu );
+    updatePlotter();
 }
 
 void Interface::showStatisticsDialog()
@@ -337,12 +391,13 @@ void Interface::showStatisticsDialog()
         }
         connect( mStatisticsDialog, SIGNAL( clearStatistics() ), mIfaceStatistics, SLOT( clearStatistics() ) );
     }
+    mIfaceStatistics->flushPending();
     mStatisticsDialog->show();
 }
 
-void Interface::updateTime()
+void Interface::updateTime( double interval )
 {
-    mRealSec += generalSettings->pollInterval;
+    mRealSec += interval;
     if ( mRealSec < 1.0 )
         return;
 
@@ -367,6 +422,8 @@ void Interface::startStatistics()
     mIfaceStatistics = new InterfaceStatistics( this );
     connect( mIfaceStatistics, SIGNAL( warnTraffic( QString, quint64, quint64 ) ),
              this, SLOT( warnTraffic( QString, quint64, quint64 ) ) );
+    connect( mIfaceStatistics, SIGNAL( storageError( QString ) ),
+             this, SLOT( statisticsError( QString ) ) );
     if ( mStatusDialog != 0 )
     {
         connect( mIfaceStatistics, SIGNAL( currentEntryChanged() ),
@@ -406,12 +463,21 @@ void Interface::warnTraffic( QString warnText, quint64 threshold, quint64 curren
     KNotification::event( "exceededTraffic", warnText );
 }
 
+void Interface::statisticsError( const QString &message )
+{
+    KNotification::event( "statisticsError",
+                          i18n( "The statistics of %1 could not be saved:\n%2", mIfaceName, message ) );
+}
+
 void Interface::toggleSignalPlotter( bool show )
 {
     if ( !mPlotterDialog )
         return;
     if ( show )
+    {
         mPlotterDialog->show();
+        updatePlotter();
+    }
     else
         mPlotterDialog->hide();
 }
@@ -24,6 +24,7 @@
 #include <time.h>
 #include "interfaceicon.h"
 #include "data.h"
+#include "backends/countersampler.h"
 
 class InterfacePlotterDialog;
 class InterfaceStatistics;
@@ -149,6 +150,10 @@ private slots:
      * Emit a notification when traffic exceeds a threshold
      */
     void warnTraffic( QString text, quint64 threshold, quint64 current );
+    /**
+     * Emit a notification when the statistics could not be saved
+     */
+    void statisticsError( const QString &message );
 
 private:
     /**
@@ -168,7 +173,8 @@ private:
      */
     void activateOrHide( QWidget* widget, bool onlyActivate = false );
 
-    void updateTime();
+    void updateTime( double interval );
+    void updatePlotter();
 
     void resetUptime();
 
@@ -180,6 +186,10 @@ private:
     QString mUptimeString;
     unsigned long mRxRate;
     unsigned long mTxRate;
+    quint64 mLastSampleTime;
+    RingCursor mPlotterCursor;
+    RingEntry mPlotterEntry;
+    bool mHavePlotterEntry;
     QString mRxRateStr;
     QString mTxRateStr;
     InterfaceIcon mIcon;
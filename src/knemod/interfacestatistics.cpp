@@ -30,26 +30,41 @@
 #include "global.h"
 #include "interface.h"
 #include "interfacestatistics.h"
+#include "statisticsbuilder.h"
 #include "statisticsmodel.h"
+#include "statisticsrebuilder.h"
+#include "statisticswriter.h"
 #include "syncstats/statsfactory.h"
 #include "storage/sqlstorage.h"
+#include "storage/statisticsjournal.h"
+#include "storage/storageworker.h"
 #include "storage/xmlstorage.h"
 
-static bool statsLessThan( const StatsRule& s1, const StatsRule& s2 )
-{
-    if ( s1.startDate < s2.startDate )
-        return true;
-    else
-        return false;
-}
+// The saves of all interfaces count up together, so no serial is used
+// twice, not even by an interface that comes back
+static quint64 saveSerial = 0;
 
 InterfaceStatistics::InterfaceStatistics( Interface* interface )
     : QObject(),
       mInterface( interface ),
       mSaveTimer( new QTimer() ),
-      mWarnTimer( new QTimer() ),
       mEntryTimer( new QTimer() ),
-      mTrafficChanged( false )
+      mFlushTimer( new QTimer() ),
+      mCompactTimer( new QTimer() ),
+      mPendingRx( 0 ),
+      mPendingTx( 0 ),
+      mPendingSeq( 0 ),
+      mBuilder( 0 ),
+      mRebuilder( 0 ),
+      mRebuildForce( false ),
+      mRebuildForceWeek( false ),
+      mRebuildProgress( 100 ),
+      mEntryGeneration( 0 ),
+      mRebuildGeneration( 0 ),
+      mWorker( 0 ),
+      mLastSaveSerial( 0 ),
+      mEvictPending( false ),
+      mJournal( 0 )
 {
     StatisticsModel * s = new StatisticsModel( KNemoStats::Hour, this );
     mModels.insert( KNemoStats::Hour, s );
@@ -72,12 +87,31 @@ InterfaceStatistics::InterfaceStatistics( Interface* interface )
     }
 
     connect( mSaveTimer, SIGNAL( timeout() ), this, SLOT( saveStatistics() ) );
-    connect( mWarnTimer, SIGNAL( timeout() ), this, SLOT( checkWarnings() ) );
     connect( mEntryTimer, SIGNAL( timeout() ), this, SLOT( checkValidEntry() ) );
+    mFlushTimer->setSingleShot( true );
+    mFlushTimer->setInterval( 1000 );
+    connect( mFlushTimer, SIGNAL( timeout() ), this, SLOT( flushPending() ) );
+    mCompactTimer->setSingleShot( true );
+    mCompactTimer->setInterval( 30000 );
+    connect( mCompactTimer, SIGNAL( timeout() ), this, SLOT( compactStatistics() ) );
 
-    KUrl dir( generalSettings->statisticsDir );
     sql = new SqlStorage( mInterface->ifaceName() );
+    foreach ( StatisticsModel *s, mModels )
+        s->setRowSource( sql );
+    // A shared db is saved for all interfaces at once
+    if ( sql->isShared() )
+        mWorker = StatisticsWriter::add( this );
+    else
+    {
+        mWorker = new StorageWorker( SqlStorage::InterfaceFile );
+        mWorker->start();
+    }
+    connect( mWorker, SIGNAL( error( QString, QString ) ), this, SLOT( writeFailed( QString, QString ) ) );
+    mBuilder = new StatisticsBuilder( mModels, mStorageData, mStatsRules );
+    mJournal = new StatisticsJournal( mInterface->ifaceName() );
     loadStats();
+    replayJournal();
+    mCompactTimer->start();
     syncWithExternal( mStorageData.lastSaved );
     configChanged();
 }
@@ -85,20 +119,120 @@ InterfaceStatistics::InterfaceStatistics( Interface* interface )
 InterfaceStatistics::~InterfaceStatistics()
 {
     mSaveTimer->stop();
-    mWarnTimer->stop();
     mEntryTimer->stop();
+    mFlushTimer->stop();
+    mCompactTimer->stop();
     delete mSaveTimer;
-    delete mWarnTimer;
     delete mEntryTimer;
+    delete mFlushTimer;
+    delete mCompactTimer;
+
+    // Rebuilds still running, including cancelled ones, are our children
+    foreach ( StatisticsRebuilder *r, findChildren<StatisticsRebuilder*>() )
+    {
+        r->cancel();
+        r->wait();
+    }
 
+    // Everything should be in the db before we go, but a db that hangs or
+    // keeps failing mustn't hold up the shutdown.  The journal has it all.
     saveStatistics();
+    mWorker->flush( StorageWorker::ShutdownTimeout );
+    if ( sql->isShared() )
+        StatisticsWriter::remove( this );
+    else
+        delete mWorker;
+    delete mBuilder;
     delete sql;
-    QSqlDatabase::removeDatabase( mInterface->ifaceName() );
+    delete mJournal;
+}
+
+StatisticsChangeSet InterfaceStatistics::takeChanges( bool fullSave )
+{
+    flushPending();
+    dropWrittenArchives();
+    if ( mEvictPending )
+        evictHistory();
+    StatisticsChangeSet changes = sql->changeSet( &mStorageData, &mModels, &mStatsRules, fullSave );
+    changes.serial = ++saveSerial;
+    mLastSaveSerial = changes.serial;
+    if ( changes.archiveFromId >= 0 )
+        mArchiveSaves << qMakePair( changes.serial, mModels.value( KNemoStats::HourArchive )->id() );
+    return changes;
+}
+
+void InterfaceStatistics::dropWrittenArchives()
+{
+    quint64 written = mWorker->writtenSerial( mInterface->ifaceName() );
+    int lastId = -1;
+    while ( !mArchiveSaves.isEmpty() && mArchiveSaves.first().first <= written )
+        lastId = mArchiveSaves.takeFirst().second;
+    if ( lastId < 0 )
+        return;
+
+    // Archived hours are never paged back in
+    StatisticsModel *hourArchives = mModels.value( KNemoStats::HourArchive );
+    hourArchives->evictRows( hourArchives->indexOfId( lastId ) + 1 );
+    hourArchives->setOlderRows( 0 );
 }
 
 void InterfaceStatistics::saveStatistics( bool fullSave )
 {
-    sql->saveStats( &mStorageData, &mModels, &mStatsRules, fullSave );
+    mWorker->enqueue( takeChanges( fullSave ) );
+    // A full save can leave a lot of free pages behind
+    if ( fullSave )
+        mCompactTimer->start();
+}
+
+void InterfaceStatistics::compactStatistics()
+{
+    // The worker does this a little at a time, whenever it has nothing
+    // to write
+    mWorker->compact( mInterface->ifaceName() );
+}
+
+void InterfaceStatistics::writeFailed( const QString &ifaceName, const QString &message )
+{
+    // A shared db tells every interface.  The worker keeps the changes
+    // and writes them once it can.
+    if ( ifaceName != mInterface->ifaceName() )
+        return;
+    emit storageError( message );
+}
+
+static void addTrafficBetween( const StatisticsModel *s, const QDateTime &start, const QDateTime &end,
+                               TrafficTotals *totals )
+{
+    for ( int i = 0; i < s->rowCount(); ++i )
+    {
+        QDateTime dt = s->dateTime( i );
+        if ( dt < start || dt >= end )
+            continue;
+        totals->rx += s->rxBytes( i );
+        totals->tx += s->txBytes( i );
+        totals->rxOffpeak += s->rxBytes( i, KNemoStats::OffpeakTraffic );
+        totals->txOffpeak += s->txBytes( i, KNemoStats::OffpeakTraffic );
+    }
+}
+
+TrafficTotals InterfaceStatistics::trafficBetween( const QDateTime &start, const QDateTime &end )
+{
+    TrafficTotals totals;
+
+    flushPending();
+    dropWrittenArchives();
+
+    // The archived hours still in memory may not have reached the db yet,
+    // so the db only answers for the time before them
+    StatisticsModel *hourArchives = mModels.value( KNemoStats::HourArchive );
+    QDateTime dbEnd = end;
+    for ( int i = 0; i < hourArchives->rowCount(); ++i )
+        dbEnd = qMin( dbEnd, hourArchives->dateTime( i ) );
+    sql->trafficBetween( start, dbEnd, &totals );
+
+    addTrafficBetween( hourArchives, start, end, &totals );
+    addTrafficBetween( mModels.value( KNemoStats::Hour ), start, end, &totals );
+    return totals;
 }
 
 bool InterfaceStatistics::loadStats()
@@ -112,13 +246,17 @@ bool InterfaceStatistics::loadStats()
     if ( sql->dbExists() )
     {
         loaded = sql->loadStats( &mStorageData, &mModels, &mStatsRules );
-        qSort( mStatsRules.begin(), mStatsRules.end(), statsLessThan );
+        mDataRules = mStatsRules;
+        StatisticsBuilder::sortStatsRules( mStatsRules );
     }
     else
     {
         XmlStorage xml;
         loaded = xml.loadStats( mInterface->ifaceName(), &mStorageData, &mModels );
         sql->createDb();
+        // Whatever is in the journal belongs to a db that is gone
+        mStorageData.journalSeq = mJournal->lastSeq();
+        mDataRules = mStatsRules;
         if ( loaded )
         {
             hoursToArchive( QDateTime::currentDateTime() );
@@ -143,10 +281,19 @@ bool InterfaceStatistics::loadStats()
 
 void InterfaceStatistics::resetWarnings( int modelType )
 {
-    for ( int i = 0; i < mInterface->settings().warnRules.count(); ++i )
+    QList<WarnRule> &warn = mInterface->settings().warnRules;
+    if ( mWarnSums.count() != warn.count() )
+    {
+        resetWarnSums();
+    }
+    for ( int i = 0; i < warn.count(); ++i )
     {
-        if ( modelType == mInterface->settings().warnRules[i].periodUnits )
-            mInterface->settings().warnRules[i].warnDone = false;
+        if ( modelType == warn[i].periodUnits )
+        {
+            warn[i].warnDone = false;
+            // The window moved on by one entry
+            mWarnSums[i] = warnWindowSum( warn[i] );
+        }
     }
 }
 
@@ -155,14 +302,15 @@ void InterfaceStatistics::hoursToArchive( const QDateTime &dateTime )
     bool removedRow = false;
     StatisticsModel* hours = mModels.value( KNemoStats::Hour );
     StatisticsModel* hourArchives = mModels.value( KNemoStats::HourArchive );
+    // Hours archived earlier may still be waiting to be written
+    int firstNewId = mStorageData.nextHourId;
 
     // Only 24 hours
     while ( hours->rowCount() )
     {
         if ( hours->dateTime( 0 ) <= dateTime.addDays( -1 ) )
         {
-            QList<QStandardItem*> row = hours->takeRow( 0 );
-            hourArchives->appendRow( row );
+            hourArchives->appendEntry( hours->takeEntry( 0 ) );
             hourArchives->setId( mStorageData.nextHourId );
             mStorageData.nextHourId++;
             removedRow = true;
@@ -177,12 +325,13 @@ void InterfaceStatistics::hoursToArchive( const QDateTime &dateTime )
             hours->setId( i, i );
         }
         mStorageData.saveFromId.insert( hours->periodType(), 0 );
-        mStorageData.saveFromId.insert( hourArchives->periodType(), hourArchives->id( 0 ) );
+        mStorageData.saveFromId.insert( hourArchives->periodType(), firstNewId );
     }
 }
 
 void InterfaceStatistics::genNewHour( const QDateTime &dateTime )
 {
+    logRebuildStep( KNemoStats::Hour, dateTime );
     hoursToArchive( dateTime );
 
     StatisticsModel* hours = mModels.value( KNemoStats::Hour );
@@ -190,11 +339,11 @@ void InterfaceStatistics::genNewHour( const QDateTime &dateTime )
     if ( hours->dateTime() == dateTime )
         return;
 
-    int ruleIndex = ruleForDate( dateTime.date() );
+    int ruleIndex = mBuilder->ruleForDate( dateTime.date() );
 
     hours->createEntry( dateTime );
 
-    if ( ruleIndex >= 0  && isOffpeak( mStatsRules[ruleIndex], dateTime ) )
+    if ( ruleIndex >= 0  && mBuilder->isOffpeak( mStatsRules[ruleIndex], dateTime ) )
     {
         hours->addTrafficType( KNemoStats::OffpeakTraffic );
     }
@@ -204,141 +353,20 @@ void InterfaceStatistics::genNewHour( const QDateTime &dateTime )
 
 bool InterfaceStatistics::genNewCalendarType( const QDate &date, const KNemoStats::PeriodUnits stype )
 {
-    if ( stype < KNemoStats::Day || stype > KNemoStats::Year )
+    logRebuildStep( stype, QDateTime( date ) );
+    if ( !mBuilder->genNewCalendarType( date, stype ) )
         return false;
 
-    StatisticsModel * model = mModels.value( stype );
-    if ( model->rowCount() &&
-         model->date().addDays( model->days() ) > date )
-            return false;
-
-    QDate newDate;
-    int dayOf;
-    int weekStartDay = mStorageData.calendar->weekStartDay();
-
-    switch ( stype )
-    {
-        case KNemoStats::Day:
-            newDate = date;
-            break;
-        case KNemoStats::Week:
-            dayOf = mStorageData.calendar->dayOfWeek( date );
-            if ( dayOf >= weekStartDay )
-                newDate = date.addDays( weekStartDay - dayOf );
-            else
-                newDate = date.addDays( weekStartDay - mStorageData.calendar->daysInWeek( date ) - dayOf );
-            break;
-        case KNemoStats::Month:
-            dayOf = mStorageData.calendar->day( date );
-            newDate = date.addDays( 1 - dayOf );
-            break;
-        case KNemoStats::Year:
-            dayOf = mStorageData.calendar->dayOfYear( date );
-            newDate = date.addDays( 1 - dayOf );
-            break;
-        default:
-            return false;
-    }
-
-    mModels.value( stype )->createEntry( QDateTime( newDate, QTime() ) );
     resetWarnings( stype );
-
     return true;
 }
 
-// Return true if at least one daily statistic entry is in a span of days
-bool InterfaceStatistics::daysInSpan( const QDate& date, int days )
-{
-    StatisticsModel *model = mModels.value( KNemoStats::Day );
-    if ( !model->rowCount() )
-        return false;
-
-    QDate nextRuleStart = date.addDays( days );
-    for ( int i = model->rowCount() - 1; i >= 0; --i )
-    {
-        // No others will be valid after this; stop early
-        if ( model->date( i ) < date )
-            return false;
-        if ( model->date( i ) < nextRuleStart && model->date( i ) >= date )
-            return true;
-    }
-    return false;
-}
-
-QDate InterfaceStatistics::nextBillPeriodStart( const StatsRule &rules, const QDate &date )
-{
-    QDate nextDate;
-    QDate refDay;
-    int modelType = rules.periodUnits;
-    switch ( modelType )
-    {
-        case KNemoStats::Day:
-            nextDate = date.addDays( rules.periodCount );
-            break;
-        case KNemoStats::Week:
-            nextDate = date;
-            for ( int i = 0; i < rules.periodCount; ++i )
-                nextDate = nextDate.addDays( mStorageData.calendar->daysInWeek( nextDate ) );
-            break;
-        default:// KNemoStats::Month:
-            nextDate = mStorageData.calendar->addMonths( date, rules.periodCount );
-            // Example: one month starting Jan 31 = Jan 31 -> Mar 1
-            // This seems the most common way to handle late start dates
-            if ( mStorageData.calendar->day( nextDate ) < mStorageData.calendar->day( date ) )
-                nextDate = nextDate.addDays( 1 );
-            break;
-    }
-    return nextDate;
-}
-
 void InterfaceStatistics::genNewBillPeriod( const QDate &date )
 {
-    int ruleIndex = ruleForDate( date );
-    if ( ruleIndex < 0 )
+    logRebuildStep( KNemoStats::BillPeriod, QDateTime( date ) );
+    if ( !mBuilder->genNewBillPeriod( date ) )
         return;
 
-    StatisticsModel * billing = mModels.value( KNemoStats::BillPeriod );
-    QDate nextRuleStart;
-
-    if ( mStatsRules.count() > ruleIndex+1 )
-        nextRuleStart = mStatsRules.at( ruleIndex+1 ).startDate;
-
-    // Harder to find whether we should skip generating a new billing entry
-    if ( nextRuleStart.isValid() && billing->rowCount() && billing->date().addDays( billing->days() ) >= nextRuleStart )
-        return;
-
-    int days;
-
-    // Given a calendar day and a billing period start date, find a
-    // billing period that the day belongs in.
-    QDate newDate;
-    QDate nextStartDate;
-    if ( !billing->rowCount() ||
-         billing->date() < mStatsRules.at( ruleIndex ).startDate )
-    {
-        nextStartDate = mStatsRules.at( ruleIndex ).startDate;
-    }
-    else
-    {
-        nextStartDate = billing->date();
-    }
-
-    do
-    {
-        newDate = nextStartDate;
-        nextStartDate = nextBillPeriodStart( mStatsRules.at( ruleIndex ), newDate );
-        days = newDate.daysTo( nextStartDate );
-    } while ( nextStartDate <= date || !daysInSpan( newDate, days ) );
-
-    // Truncate a billing period if necessary
-    if ( nextRuleStart.isValid() && nextRuleStart < nextStartDate )
-        days = newDate.daysTo( nextRuleStart );
-
-    if ( billing->rowCount() && newDate == billing->date() )
-        return;
-
-    billing->createEntry( QDateTime( newDate, QTime() ), billing->rowCount(), days );
-
     resetWarnings( KNemoStats::BillPeriod );
 }
 
@@ -348,7 +376,8 @@ void InterfaceStatistics::genNewBillPeriod( const QDate &date )
 void InterfaceStatistics::configChanged()
 {
     mSaveTimer->stop();
-    mWarnTimer->stop();
+    // A rebuild must start from exact totals
+    flushPending();
 
     KLocale::CalendarSystem origCalendarSystem = KLocale::QDateCalendar;
     if ( mStorageData.calendar )
@@ -366,25 +395,24 @@ void InterfaceStatistics::configChanged()
         {
             StatisticsModel *hours = mModels.value( KNemoStats::Hour );
             StatisticsModel *days = mModels.value( KNemoStats::Day );
-            for ( int i = 0; i < days->rowCount(); ++i )
-            {
-                days->updateDateText( i );
-            }
-            for ( int i = 0; i < hours->rowCount(); ++i )
-            {
-                hours->updateDateText( i );
-            }
+            days->updateDateText();
+            hours->updateDateText();
         }
     }
 
     checkRebuild( origCalendarSystem );
 
-    if ( generalSettings->saveInterval > 0 )
+    if ( sql->isShared() )
+        StatisticsWriter::setSaveInterval( generalSettings->saveInterval );
+    else if ( generalSettings->saveInterval > 0 )
     {
         mSaveTimer->setInterval( generalSettings->saveInterval * 1000 );
         mSaveTimer->start();
     }
 
+    // Only the rules can ask for more rows, so this is the one place that
+    // loads them.  evictHistory() keeps them after that.
+    loadWarnRows();
     foreach ( StatisticsModel * s, mModels )
     {
         resetWarnings( s->periodType() );
@@ -392,18 +420,8 @@ void InterfaceStatistics::configChanged()
 
     checkValidEntry();
 
-    mWarnTimer->setInterval( 2000 );
-    mWarnTimer->start();
-}
-
-int InterfaceStatistics::ruleForDate( const QDate &date )
-{
-    for( int i = mStatsRules.count() - 1; i >= 0; --i )
-    {
-        if ( date >= mStatsRules[i].startDate )
-            return i;
-    }
-    return -1;
+    resetWarnSums();
+    checkWarnings();
 }
 
 void InterfaceStatistics::syncWithExternal( uint updated )
@@ -487,68 +505,42 @@ void InterfaceStatistics::syncWithExternal( uint updated )
             genNewCalendarType( curDateTime.date(), KNemoStats::Year );
             genNewBillPeriod( curDateTime.date() );
 
-            foreach ( StatisticsModel * s, mModels )
-            {
-                if ( s->periodType() == KNemoStats::HourArchive )
-                    continue;
-                foreach ( KNemoStats::TrafficType t, hours->trafficTypes() )
-                {
-                    s->addRxBytes( lag.rxBytes, t );
-                    s->addTxBytes( lag.txBytes, t );
-                }
-            }
+            addTraffic( lag.rxBytes, lag.txBytes );
         }
     }
     delete v;
+    ++mEntryGeneration;
 }
 
-bool InterfaceStatistics::isOffpeak( const StatsRule &rules, const QDateTime &curDT )
+void InterfaceStatistics::replayJournal()
 {
-    if ( !rules.logOffpeak )
-        return false;
-
-    bool isOffpeak = false;
-    QTime curHour = QTime( curDT.time().hour(), 0 );
-
-    // This block just tests weekly hours
-    if ( rules.offpeakStartTime < rules.offpeakEndTime &&
-         curHour >= rules.offpeakStartTime && curHour < rules.offpeakEndTime )
-    {
-        isOffpeak = true;
-    }
-    else if ( rules.offpeakStartTime > rules.offpeakEndTime &&
-         ( curHour >= rules.offpeakStartTime || curHour < rules.offpeakEndTime ) )
-    {
-        isOffpeak = true;
-    }
+    mJournal->setMinSeq( mStorageData.journalSeq );
+    QList<JournalRecord> records = mJournal->recordsAfter( mStorageData.journalSeq );
+    if ( records.isEmpty() )
+        return;
 
-    if ( rules.weekendIsOffpeak )
+    StatisticsModel *hours = mModels.value( KNemoStats::Hour );
+    foreach ( const JournalRecord &r, records )
     {
-        int dow = mStorageData.calendar->dayOfWeek( curDT.date() );
-        if ( rules.weekendDayStart <= rules.weekendDayEnd && rules.weekendDayStart <= dow )
+        QDateTime dateTime = QDateTime::fromTime_t( r.time );
+        QDateTime hour( dateTime.date(), QTime( dateTime.time().hour(), 0 ) );
+        // A clock that went back leaves the traffic in the newest entries
+        if ( !hours->rowCount() || hours->dateTime() < hour )
         {
-            QDateTime dayBegin = curDT.addDays( dow - rules.weekendDayStart );
-            dayBegin = QDateTime( dayBegin.date(), rules.weekendTimeStart );
-            QDateTime end = curDT.addDays( rules.weekendDayEnd - dow );
-            end = QDateTime( end.date(), rules.weekendTimeEnd );
-
-            if ( dayBegin <= curDT && curDT < end )
-                isOffpeak = true;
+            genNewHour( hour );
+            genNewCalendarType( hour.date(), KNemoStats::Day );
+            genNewCalendarType( hour.date(), KNemoStats::Week );
+            genNewCalendarType( hour.date(), KNemoStats::Month );
+            genNewCalendarType( hour.date(), KNemoStats::Year );
+            genNewBillPeriod( hour.date() );
         }
-        else if ( rules.weekendDayStart > rules.weekendDayEnd &&
-                ( dow >= rules.weekendDayStart || dow <= rules.weekendDayEnd ) )
-        {
-            QDateTime dayBegin = curDT.addDays( rules.weekendDayStart - dow );
-            dayBegin = QDateTime( dayBegin.date(), rules.weekendTimeStart );
-            QDateTime end = curDT.addDays( mStorageData.calendar->daysInWeek( curDT.date() ) - dow + rules.weekendDayEnd );
-            end = QDateTime( end.date(), rules.weekendTimeEnd );
 
-            if ( dayBegin <= curDT && curDT < end )
-                isOffpeak = true;
-        }
+        addTraffic( r.rx, r.tx );
+        // External sources only need to fill in what came after this
+        mStorageData.lastSaved = qMax( mStorageData.lastSaved, static_cast<uint>(r.time) );
     }
-
-    return isOffpeak;
+    mStorageData.journalSeq = records.last().seq;
+    ++mEntryGeneration;
 }
 
 
@@ -556,405 +548,191 @@ bool InterfaceStatistics::isOffpeak( const StatsRule &rules, const QDateTime &cu
  * Rebuilding Statistics              *
  **************************************/
 
-int InterfaceStatistics::rebuildHours( StatisticsModel *s, const StatsRule &rules, const QDate &start, const QDate &nextRuleStart )
+static bool sameRules( QList<StatsRule> a, QList<StatsRule> b )
 {
-    if ( !s->rowCount() )
-        return 0;
-
-    int i = s->rowCount();
-    while ( i > 0 && s->date( i - 1 ) >= start )
-    {
-        i--;
-        if ( nextRuleStart.isValid() && s->date( i ) >= nextRuleStart )
-            continue;
-
-        s->resetTrafficTypes( i );
-        if ( isOffpeak( rules, s->dateTime( i ) ) )
-        {
-            s->setTraffic( i, s->rxBytes( i ), s->txBytes( i ), KNemoStats::OffpeakTraffic );
-            s->addTrafficType( KNemoStats::OffpeakTraffic, i );
-        }
-    }
-    if ( mStorageData.saveFromId.value( s->periodType() ) > s->id( i ) )
-    {
-        mStorageData.saveFromId.insert( s->periodType(), s->id( i ) );
-    }
-
-    return i;
-}
-
-int InterfaceStatistics::rebuildDay( int dayIndex, int hourIndex, StatisticsModel *hours )
-{
-    QMap<KNemoStats::TrafficType, QPair<quint64, quint64> > dayTraffic;
-    StatisticsModel *days = mModels.value( KNemoStats::Day );
-    while ( hourIndex >= 0 && hours->date( hourIndex ) > days->date( dayIndex ).addDays( 1 ) )
-    {
-        --hourIndex;
-    }
-    while ( hourIndex >= 0 && hours->date( hourIndex ) == days->date( dayIndex ) )
-    {
-        foreach ( KNemoStats::TrafficType t, hours->trafficTypes( hourIndex ) )
-        {
-            if ( t == KNemoStats::AllTraffic )
-                continue;
-            quint64 rx = hours->rxBytes( hourIndex, t ) + dayTraffic.value( t ).first;
-            quint64 tx = hours->txBytes( hourIndex, t ) + dayTraffic.value( t ).second;
-            dayTraffic.insert( t, QPair<quint64, quint64>( rx, tx ) );
-        }
-        --hourIndex;
-    }
-    foreach (KNemoStats::TrafficType t, dayTraffic.keys() )
+    if ( a.count() != b.count() )
+        return false;
+    for ( int i = 0; i < a.count(); ++i )
     {
-        days->setTraffic( dayIndex, dayTraffic.value( t ).first, dayTraffic.value( t ).second, t );
-        days->addTrafficType( t, dayIndex );
+        if ( !( a[i] == b[i] ) )
+            return false;
     }
-    return hourIndex;
+    return true;
 }
 
-// A rebuild of hours and days never changes the number of entries
-// We just change what bytes count as off-peak
-void InterfaceStatistics::rebuildBaseUnits( const StatsRule &rules, const QDate &start, const QDate &nextRuleStart )
+void InterfaceStatistics::checkRebuild( const KLocale::CalendarSystem oldCalendar, bool force )
 {
-    int hIndex = 0;
-    int haIndex = 0;
-
-    StatisticsModel *hours = mModels.value( KNemoStats::Hour );
-    StatisticsModel *hourArchives = mModels.value( KNemoStats::HourArchive );
-    StatisticsModel *days = mModels.value( KNemoStats::Day );
-    sql->loadHourArchives( hourArchives, start, nextRuleStart );
-    if ( hourArchives->rowCount() )
-        mStorageData.saveFromId.insert( hourArchives->periodType(), hourArchives->id( 0 ) );
-
-    rebuildHours( hourArchives, rules, start, nextRuleStart );
-    rebuildHours( hours, rules, start, nextRuleStart );
-
-    if ( hours->rowCount() )
-        hIndex = hours->rowCount() - 1;
-    if ( hourArchives->rowCount() )
-        haIndex = hourArchives->rowCount() - 1;
-
-    if ( !days->rowCount() )
-        return;
+    bool forceWeek = false;
 
-    int dayIndex = days->rowCount();
-    while ( dayIndex > 0 && days->date( dayIndex - 1 ) >= start )
+    if ( oldCalendar != mInterface->settings().calendarSystem )
     {
-        dayIndex--;
-        if ( nextRuleStart.isValid() && days->date( dayIndex ) >= nextRuleStart )
-            continue;
-
-        days->resetTrafficTypes( dayIndex );
-        if ( rules.logOffpeak )
-        {
-            haIndex = rebuildDay( dayIndex, haIndex, hourArchives );
-            hIndex = rebuildDay( dayIndex, hIndex, hours );
-        }
+        StatisticsModel *hours = mModels.value( KNemoStats::Hour );
+        StatisticsModel *days = mModels.value( KNemoStats::Day );
+        days->updateDateText();
+        hours->updateDateText();
+        force = true;
     }
-    if ( mStorageData.saveFromId.value( days->periodType() ) > days->id( dayIndex ) )
+    if ( mModels.value( KNemoStats::Week )->rowCount() )
     {
-        mStorageData.saveFromId.insert( days->periodType(), days->id( dayIndex ) );
+        QDate testDate = mModels.value( KNemoStats::Week )->date( 0 );
+        if ( mStorageData.calendar->dayOfWeek( testDate ) != mStorageData.calendar->weekStartDay() )
+            forceWeek = true;
     }
-}
 
-/**
- * Given a model with statistics of a certain unit (year, month, week, etc.)
- * and a requested rebuild date, how far back to we actually need to go
- * to accuratly rebuild statistics from the daily stats.
- */
-QDate InterfaceStatistics::prepareRebuild( StatisticsModel* statistics, const QDate &startDate )
-{
-    QDate newStartDate = startDate;
-    if ( statistics->periodType() <= KNemoStats::Day ||
-         statistics->periodType() > KNemoStats::Year )
-        return newStartDate;
+    // New entries follow the new rules right away
+    mStatsRules = mInterface->settings().statsRules;
+    if ( mStatsRules.count() )
+        mBuilder->prependStatsRule( mStatsRules );
 
-    for ( int i = 0; i < statistics->rowCount(); ++i )
+    // A rebuild still in flight is working towards rules that are out of
+    // date now.  What it was forced to do still needs doing, though.
+    if ( mRebuilder )
     {
-        int days = statistics->days( i );
-        QDate nextPeriodStart = statistics->date( i ).addDays( days );
-
-        if ( statistics->periodType() == KNemoStats::BillPeriod )
-        {
-            // Have to check if a billing period's truncation changed
-            int ruleIndex = ruleForDate( statistics->date( i ) );
-            if ( ruleIndex < 0 )
-                break;
-            QDate nextFullPeriodStart = nextBillPeriodStart( mStatsRules.at( ruleIndex ), statistics->date( i ) );
-            if ( nextFullPeriodStart > nextPeriodStart )
-            {
-                if ( mStatsRules.count() == ruleIndex+1 ||
-                     mStatsRules.at( ruleIndex + 1 ).startDate != nextPeriodStart )
-                {
-                    // Truncation changed
-                    // This will make sure the entry gets rebuilt
-                    nextPeriodStart = nextFullPeriodStart;
-                }
-            }
-        }
-
-        if ( nextPeriodStart > startDate )
-        {
-            if ( statistics->date( i ) < startDate )
-            {
-                newStartDate = statistics->date( i );
-            }
-            if ( statistics->rowCount() && mStorageData.saveFromId.value( statistics->periodType() ) > statistics->id( i ) )
-            {
-                mStorageData.saveFromId.insert( statistics->periodType(), statistics->id( i ) );
-            }
-            statistics->removeRows( i, statistics->rowCount() - i );
-            break;
-        }
+        disconnect( mRebuilder, 0, this, 0 );
+        mRebuilder->cancel();
+        if ( mRebuilder->isFinished() )
+            mRebuilder->deleteLater();
+        else
+            connect( mRebuilder, SIGNAL( finished() ), mRebuilder, SLOT( deleteLater() ) );
+        mRebuilder = 0;
     }
+    mRebuildForce = mRebuildForce || force;
+    mRebuildForceWeek = mRebuildForceWeek || forceWeek;
 
-    return newStartDate;
+    startRebuild();
 }
 
-void InterfaceStatistics::amendStats( int i, const StatisticsModel *source, StatisticsModel* dest )
+void InterfaceStatistics::startRebuild()
 {
-    foreach ( KNemoStats::TrafficType t, source->trafficTypes( i ) )
-    {
-        dest->addRxBytes( source->rxBytes( i, t ), t );
-        dest->addTxBytes( source->txBytes( i, t ), t );
-        dest->addTrafficType( t );
-    }
-}
-
-void InterfaceStatistics::rebuildCalendarPeriods( const QDate &requestedStart, bool weekOnly )
-{
-    QDate weekStart;
-    QDate monthStart;
-    QDate walkbackDate;
-
-    QList<QDate> s;
-
-    weekStart = prepareRebuild( mModels.value( KNemoStats::Week), requestedStart );
-    s.append( weekStart );
-    if ( !weekOnly )
-    {
-        monthStart = prepareRebuild( mModels.value( KNemoStats::Month), requestedStart );
-        s.append( monthStart );
-    }
-
-    // Now find how far back we'll need to go
-    qSort( s );
-    walkbackDate = s.first();
-
-    StatisticsModel *days = mModels.value( KNemoStats::Day );
-    for ( int i = 0; i < days->rowCount(); ++i )
+    QList<StatsRule> oldRules = mDataRules;
+    QList<StatsRule> newRules = mInterface->settings().statsRules;
+    mBuilder->prependStatsRule( oldRules );
+    mBuilder->prependStatsRule( newRules );
+    if ( !mRebuildForce && !mRebuildForceWeek && sameRules( oldRules, newRules ) )
     {
-        QDate day = days->date( i );
-        if ( day < walkbackDate )
-            continue;
-
-        if ( day >= weekStart )
-        {
-            genNewCalendarType( day, KNemoStats::Week );
-            amendStats( i, mModels.value( KNemoStats::Day ), mModels.value( KNemoStats::Week ) );
-        }
-
-        if ( !weekOnly && day >= monthStart )
-        {
-            genNewCalendarType( day, KNemoStats::Month );
-            amendStats( i, mModels.value( KNemoStats::Day ), mModels.value( KNemoStats::Month ) );
-        }
-    }
-
-    if ( weekOnly )
+        mDataRules = mInterface->settings().statsRules;
+        emit rebuildProgressChanged( 100 );
         return;
-
-    // Build years from months...save time
-    QDate yearStart = prepareRebuild( mModels.value( KNemoStats::Year ), requestedStart );
-    StatisticsModel *months = mModels.value( KNemoStats::Month );
-    for ( int i = 0; i < months->rowCount(); ++i )
-    {
-        QDate day = months->date( i );
-        if ( day < yearStart )
-            continue;
-        genNewCalendarType( day, KNemoStats::Year );
-        amendStats( i, mModels.value( KNemoStats::Month ), mModels.value( KNemoStats::Year ) );
     }
-}
 
-void InterfaceStatistics::rebuildBillPeriods( const QDate &requestedStart )
-{
-    QDate walkbackDate;
-    StatisticsModel *days = mModels.value( KNemoStats::Day );
-    StatisticsModel *billPeriods = mModels.value( KNemoStats::BillPeriod );
-
-    if ( billPeriods->rowCount() )
-        walkbackDate = prepareRebuild( mModels.value( KNemoStats::BillPeriod), requestedStart );
-    else
-        walkbackDate = days->date( 0 );
-
-    for ( int i = 0; i < days->rowCount(); ++i )
-    {
-        QDate day = days->date( i );
+    // The snapshot has to include everything counted so far
+    flushPending();
+    mRebuildSteps.clear();
+    mRebuildGeneration = mEntryGeneration;
+    // The rebuild reads the archived hours from the db.  It waits in its
+    // own thread for this save, which takes along the ones still missing.
+    saveStatistics();
 
-        if ( day >= walkbackDate )
-        {
-            genNewBillPeriod( day );
-            amendStats( i, mModels.value( KNemoStats::Day ), mModels.value( KNemoStats::BillPeriod ) );
-        }
-    }
+    mRebuilder = new StatisticsRebuilder( mInterface->ifaceName(), mModels, mStorageData, mDataRules,
+                                          mInterface->settings().statsRules,
+                                          mRebuildForce, mRebuildForceWeek, mWorker, saveSerial, this );
+    connect( mRebuilder, SIGNAL( progress( int ) ), SLOT( updateRebuildProgress( int ) ) );
+    connect( mRebuilder, SIGNAL( finished() ), SLOT( rebuildFinished() ) );
+    mRebuildProgress = 0;
+    emit rebuildProgressChanged( 0 );
+    mRebuilder->start( QThread::LowPriority );
 }
 
-void InterfaceStatistics::prependStatsRule( QList<StatsRule> &rules )
+void InterfaceStatistics::updateRebuildProgress( int percent )
 {
-    qSort( rules.begin(), rules.end(), statsLessThan );
-    StatisticsModel * days = mModels.value( KNemoStats::Day );
-    if ( rules.count() == 0 ||
-         ( days->rowCount() > 0 && rules[0].startDate > days->date( 0 ) )
-       )
-    {
-        QDate date;
-        if ( days->rowCount() )
-            date = days->date( 0 );
-        else
-            date = QDate::currentDate();
-        StatsRule s;
-        s.startDate = date.addDays( 1 - mStorageData.calendar->day( date ) );
-        rules.prepend( s );
-    }
+    // Ignore anything a cancelled rebuild queued up before it was cancelled
+    if ( sender() != mRebuilder )
+        return;
+    mRebuildProgress = percent;
+    emit rebuildProgressChanged( percent );
 }
 
-void InterfaceStatistics::checkRebuild( const KLocale::CalendarSystem oldCalendar, bool force )
+void InterfaceStatistics::rebuildFinished()
 {
-    QList<StatsRule> newRules = mInterface->settings().statsRules;
-    bool forceWeek = false;
-
-    if ( oldCalendar != mInterface->settings().calendarSystem )
-    {
-        StatisticsModel *hours = mModels.value( KNemoStats::Hour );
-        StatisticsModel *days = mModels.value( KNemoStats::Day );
-        for ( int i = 0; i < days->rowCount(); ++i )
-        {
-            days->updateDateText( i );
-        }
-        for ( int i = 0; i < hours->rowCount(); ++i )
-        {
-            hours->updateDateText( i );
-        }
-        force = true;
-    }
-    if ( mModels.value( KNemoStats::Week )->rowCount() )
-    {
-        QDate testDate = mModels.value( KNemoStats::Week )->date( 0 );
-        if ( mStorageData.calendar->dayOfWeek( testDate ) != mStorageData.calendar->weekStartDay() )
-            forceWeek = true;
-    }
+    StatisticsRebuilder *rebuilder = mRebuilder;
+    if ( !rebuilder || sender() != rebuilder )
+        return;
+    mRebuilder = 0;
+    rebuilder->deleteLater();
+    if ( rebuilder->isCancelled() )
+        return;
 
-    bool doBilling = newRules.count();
-    int oldRuleCount = mStatsRules.count();
-    QDate bpBeginDate;
-    if ( !doBilling )
+    // The statistics were cleared or synced since the snapshot was taken,
+    // so the results can't be merged.  Start again from what we have now.
+    if ( mRebuildGeneration != mEntryGeneration )
     {
-        mModels.value( KNemoStats::BillPeriod )->clearRows();
-        mStorageData.saveFromId.insert( KNemoStats::BillPeriod, 0 );
+        startRebuild();
+        return;
     }
 
-    // This is just a dummy for calculation
-    prependStatsRule( newRules );
-    prependStatsRule( mStatsRules );
-
-    if ( !oldRuleCount && mStatsRules[0] == newRules[0] && newRules.count() > mStatsRules.count() )
-        bpBeginDate = mModels.value( KNemoStats::Day )->date( 0 );
-
-    int j = 0;
-    QDate recalcPos;
-    for ( int i = 0; i < newRules.count(); ++i )
+    flushPending();
+    foreach ( StatisticsModel *s, mModels )
     {
-
-        bool rulesMatch = ( newRules[i] == mStatsRules[j] );
-
-        QDate nextRuleStart;
-        if ( !rulesMatch )
-        {
-            if ( newRules.count() > i + 1 )
-                nextRuleStart = newRules[i+1].startDate;
-            if ( !recalcPos.isValid() )
-                recalcPos = newRules[i].startDate;
-            rebuildBaseUnits( newRules[i], newRules[i].startDate, nextRuleStart );
-        }
+        int type = s->periodType();
+        s->setStore( rebuilder->store( type ) );
+        s->setOlderRows( rebuilder->olderRows( type ) );
+        int saveFromId = qMin( mStorageData.saveFromId.value( type ),
+                               rebuilder->storageData().saveFromId.value( type ) );
+        mStorageData.saveFromId.insert( type, saveFromId );
+    }
+
+    // Add what came after the snapshot to the results, in the order it
+    // happened.  Hours archived again get the same ids as before.
+    mStorageData.nextHourId = rebuilder->storageData().nextHourId;
+    QList<RebuildStep> steps = mRebuildSteps;
+    mRebuildSteps.clear();
+    foreach ( const RebuildStep &step, steps )
+    {
+        if ( step.periodType < 0 )
+            addTraffic( step.rx, step.tx );
+        else if ( step.periodType == KNemoStats::Hour )
+            genNewHour( step.dateTime );
+        else if ( step.periodType == KNemoStats::BillPeriod )
+            genNewBillPeriod( step.dateTime.date() );
         else
-        {
-            // rules match, now scan forward to see if we need to extend new rule
-            if ( newRules.count() > i + 1 )
-            {
-                int first = -1;
-                int k;
-                // Here we want to skip over any intermediary old rules that will
-                // get taken care of when we recalculate this section.
-                for ( k = 0; k < mStatsRules.count(); ++k )
-                {
-                    if ( mStatsRules[k].startDate > newRules[i].startDate &&
-                         mStatsRules[k].startDate < newRules[i+1].startDate )
-                    {
-                        if ( first < 0 )
-                            first = k;
-                        j = k;
-                        if ( !recalcPos.isValid() )
-                            recalcPos = mStatsRules[j].startDate;
-                    }
-                }
-                if ( first >= 0 )
-                {
-                    rebuildBaseUnits( newRules[i], mStatsRules[first].startDate, newRules[i+1].startDate );
-                }
-            }
-            // We're out of new rules but there's more old ones
-            // so rebuild from next old rule's date using final new rule.
-            else if ( mStatsRules.count() > j + 1 )
-            {
-
-                if ( !recalcPos.isValid() )
-                    recalcPos = mStatsRules[j+1].startDate;
-                rebuildBaseUnits( newRules[i], recalcPos, nextRuleStart );
-            }
-            if ( mStatsRules.count() > j + 1 )
-                ++j;
-        }
+            genNewCalendarType( step.dateTime.date(), static_cast<KNemoStats::PeriodUnits>(step.periodType) );
     }
+    // New entries take on the traffic types of the hour
+    if ( steps.count() )
+        checkValidEntry();
 
-    /*
-    now do the rest
-    */
-    mStatsRules = newRules;
-    if ( force )
-        recalcPos = mModels.value( KNemoStats::Day )->date( 0 );
-
-    if ( recalcPos.isValid() )
-    {
-        rebuildCalendarPeriods( recalcPos );
+    mDataRules = rebuilder->newRules();
+    mRebuildForce = false;
+    mRebuildForceWeek = false;
 
-        if ( doBilling )
-        {
-            rebuildBillPeriods( recalcPos );
-        }
-    }
-    else if ( forceWeek )
-    {
-        rebuildCalendarPeriods( mModels.value( KNemoStats::Day )->date( 0 ), true );
-    }
-
-    mStatsRules = mInterface->settings().statsRules;
-    if ( mStatsRules.count() )
-        prependStatsRule( mStatsRules );
-
-    if ( recalcPos.isValid() )
+    if ( rebuilder->rebuilt() )
     {
         saveStatistics( true );
     }
 
-    mTrafficChanged = true;
+    // The rebuild had to load all of the history
+    dropWrittenArchives();
+    evictHistory();
+    resetWarnSums();
+    emit rebuildProgressChanged( 100 );
     emit currentEntryChanged();
 }
 
+void InterfaceStatistics::logRebuildStep( int periodType, const QDateTime &dateTime, quint64 rx, quint64 tx )
+{
+    if ( !mRebuilder )
+        return;
+
+    RebuildStep step;
+    step.periodType = periodType;
+    step.dateTime = dateTime;
+    step.rx = rx;
+    step.tx = tx;
+    mRebuildSteps << step;
+}
+
+int InterfaceStatistics::rebuildProgress() const
+{
+    return mRebuilder ? mRebuildProgress : 100;
+}
+
 // END REBUILDING STATISTICS
 
 
 void InterfaceStatistics::checkValidEntry()
 {
+    // Pending traffic belongs to the entries that are current right now
+    flushPending();
     mEntryTimer->stop();
     QDateTime curDateTime = QDateTime::currentDateTime();
     QDate curDate = curDateTime.date();
@@ -975,8 +753,7 @@ void InterfaceStatistics::checkValidEntry()
         genNewBillPeriod( curDate );
 
         // The fancy short date may need updating
-        for ( int i = 0; i < hours->rowCount(); ++i )
-            hours->updateDateText( i );
+        hours->updateDateText();
     }
 
     foreach ( StatisticsModel * s, mModels )
@@ -996,68 +773,110 @@ void InterfaceStatistics::checkValidEntry()
     mEntryTimer->start();
 }
 
-void InterfaceStatistics::checkWarnings()
+static quint64 warnBytes( const WarnRule &rule, quint64 rx, quint64 tx )
 {
-    if ( !mTrafficChanged )
-        return;
-    mTrafficChanged = false;
+    switch ( rule.trafficDirection )
+    {
+        case KNemoStats::TrafficIn:
+            return rx;
+        case KNemoStats::TrafficOut:
+            return tx;
+        default:
+            return rx + tx;
+    }
+}
 
-    QList<WarnRule> warn = mInterface->settings().warnRules;
-    for ( int wi=0; wi < warn.count(); ++wi )
+quint64 InterfaceStatistics::warnWindowSum( const WarnRule &rule )
+{
+    // loadWarnRows() put the whole window in memory
+    StatisticsModel *model = mModels.value( rule.periodUnits );
+    if ( !model )
+        return 0;
+
+    quint64 total = 0;
+    int lowerIndex = qMax( 0, model->rowCount() - static_cast<int>(rule.periodCount) );
+    for ( int i = model->rowCount() - 1; i >= lowerIndex; --i )
+    {
+        quint64 all = warnBytes( rule, model->rxBytes( i ), model->txBytes( i ) );
+        quint64 offpeak = warnBytes( rule, model->rxBytes( i, KNemoStats::OffpeakTraffic ),
+                                     model->txBytes( i, KNemoStats::OffpeakTraffic ) );
+        if ( rule.trafficType == KNemoStats::PeakOffpeak )
+            total += all;
+        else if ( rule.trafficType == KNemoStats::Offpeak )
+            total += offpeak;
+        else
+            total += all - offpeak;
+    }
+    return total;
+}
+
+void InterfaceStatistics::loadWarnRows()
+{
+    const QList<WarnRule> &warn = mInterface->settings().warnRules;
+    foreach ( const WarnRule &rule, warn )
     {
-        if ( warn[wi].warnDone || !warn[wi].threshold > 0.0 )
+        StatisticsModel *model = mModels.value( rule.periodUnits );
+        if ( !model )
             continue;
+        int missing = static_cast<int>(rule.periodCount) - model->rowCount();
+        if ( missing > 0 && model->olderRows() > 0 )
+            sql->loadOlderRows( model, missing );
+    }
+}
 
-        quint64 total = 0;
-        StatisticsModel *model = 0;
+void InterfaceStatistics::resetWarnSums()
+{
+    const QList<WarnRule> &warn = mInterface->settings().warnRules;
+    mWarnSums.resize( warn.count() );
+    for ( int i = 0; i < warn.count(); ++i )
+        mWarnSums[i] = warnWindowSum( warn[i] );
+}
 
-        model = mModels.value( warn[wi].periodUnits );
-        if ( !model )
-            return;
+void InterfaceStatistics::evictHistory()
+{
+    // Saved rows may still be on their way to the db
+    mEvictPending = mWorker->writtenSerial( mInterface->ifaceName() ) < mLastSaveSerial;
+    if ( mEvictPending )
+        return;
 
-        int lowerIndex = model->rowCount() - warn[wi].periodCount;
+    const QList<WarnRule> &warn = mInterface->settings().warnRules;
+    foreach ( StatisticsModel *s, mModels )
+    {
+        // Hours are few, and archived ones don't stay in memory anyway
+        if ( s->periodType() == KNemoStats::Hour || s->periodType() == KNemoStats::HourArchive )
+            continue;
 
-        for ( int i = model->rowCount() - 1; i >= 0; --i )
+        int keep = StatisticsModel::PageRows;
+        foreach ( const WarnRule &rule, warn )
         {
-            if ( i >= lowerIndex )
-            {
-                switch ( warn[wi].trafficDirection )
-                {
-                    case KNemoStats::TrafficIn:
-                        if ( warn[wi].trafficType == KNemoStats::PeakOffpeak )
-                            total += model->rxBytes( i );
-                        else if ( warn[wi].trafficType == KNemoStats::Offpeak )
-                            total += model->rxBytes( i, KNemoStats::OffpeakTraffic );
-                        else
-                            total += model->rxBytes( i ) - model->rxBytes( i, KNemoStats::OffpeakTraffic );
-                        break;
-                    case KNemoStats::TrafficOut:
-                        if ( warn[wi].trafficType == KNemoStats::PeakOffpeak )
-                            total += model->txBytes( i );
-                        else if ( warn[wi].trafficType == KNemoStats::Offpeak )
-                            total += model->txBytes( i, KNemoStats::OffpeakTraffic );
-                        else
-                            total += model->txBytes( i ) - model->txBytes( i, KNemoStats::OffpeakTraffic );
-                        break;
-                    default:
-                        if ( warn[wi].trafficType == KNemoStats::PeakOffpeak )
-                            total += model->totalBytes( i );
-                        else if ( warn[wi].trafficType == KNemoStats::Offpeak )
-                            total += model->totalBytes( i, KNemoStats::OffpeakTraffic );
-                        else
-                            total += model->totalBytes( i ) - model->totalBytes( i, KNemoStats::OffpeakTraffic );
-                }
-            }
-            else
-                break;
+            if ( rule.periodUnits == s->periodType() )
+                keep = qMax( keep, static_cast<int>(rule.periodCount) );
         }
 
+        // Rows from saveFromId on still need saving
+        int unsaved = s->indexOfId( mStorageData.saveFromId.value( s->periodType() ) );
+        if ( unsaved > 0 )
+            s->evictRows( qMin( s->rowCount() - keep, unsaved ) );
+    }
+}
+
+void InterfaceStatistics::checkWarnings()
+{
+    QList<WarnRule> &warn = mInterface->settings().warnRules;
+    if ( mWarnSums.count() != warn.count() )
+        resetWarnSums();
+
+    for ( int wi=0; wi < warn.count(); ++wi )
+    {
+        if ( warn[wi].warnDone || !( warn[wi].threshold > 0.0 ) )
+            continue;
+
         int warnMult = pow( 1024, warn[wi].trafficUnits );
         quint64 thresholdBytes = warn[wi].threshold * warnMult;
-        if ( total > thresholdBytes )
+        if ( mWarnSums[wi] > thresholdBytes )
         {
-            emit warnTraffic( warn[wi].customText, thresholdBytes, total );
-            mInterface->settings().warnRules[wi].warnDone = true;
+            warn[wi].warnDone = true;
+            emit warnTraffic( warn[wi].customText, thresholdBytes, mWarnSums[wi] );
         }
     }
 }
@@ -1069,54 +888,96 @@ void InterfaceStatistics::checkWarnings()
  ******************************/
 void InterfaceStatistics::clearStatistics()
 {
+    mFlushTimer->stop();
+    mPendingRx = 0;
+    mPendingTx = 0;
+    // The journaled traffic goes along with everything else
+    mStorageData.journalSeq = mJournal->lastSeq();
     foreach( StatisticsModel * s, mModels )
         s->clearRows();
+    mArchiveSaves.clear();
     mStorageData.nextHourId = 0;
     foreach ( StatisticsModel *s, mModels )
     {
         mStorageData.saveFromId.insert( s->periodType(), 0 );
     }
-    sql->clearStats( &mStorageData );
+    StatisticsChangeSet changes = takeChanges();
+    changes.clear = true;
+    mWorker->enqueue( changes );
+    mCompactTimer->start();
+    ++mEntryGeneration;
     checkValidEntry();
-    mTrafficChanged = true;
+    resetWarnSums();
     emit currentEntryChanged();
 }
 
-void InterfaceStatistics::addRxBytes( unsigned long bytes )
+StatisticsModel* InterfaceStatistics::getStatistics( enum KNemoStats::PeriodUnits t )
+{
+    flushPending();
+    return mModels.value( t );
+}
+
+void InterfaceStatistics::addBytes( quint64 rx, quint64 tx )
 {
-    if ( bytes == 0 )
+    if ( rx == 0 && tx == 0 )
         return;
 
+    // Every poll is journaled; only adding it to the models is batched
+    mPendingSeq = mJournal->append( QDateTime::currentDateTime().toTime_t(), rx, tx );
+    mPendingRx += rx;
+    mPendingTx += tx;
+    if ( !mFlushTimer->isActive() )
+        mFlushTimer->start();
+}
+
+void InterfaceStatistics::addTraffic( quint64 rx, quint64 tx )
+{
+    QList<KNemoStats::TrafficType> types = mModels.value( KNemoStats::Hour )->trafficTypes();
     foreach( StatisticsModel * s, mModels )
     {
         if ( s->periodType() == KNemoStats::HourArchive )
             continue;
-        foreach ( KNemoStats::TrafficType t, mModels.value( KNemoStats::Hour )->trafficTypes() )
+        foreach ( KNemoStats::TrafficType t, types )
         {
-            s->addRxBytes( bytes, t );
+            s->addRxBytes( rx, t );
+            s->addTxBytes( tx, t );
         }
     }
-
-    mTrafficChanged = true;
-    emit currentEntryChanged();
 }
 
-void InterfaceStatistics::addTxBytes( unsigned long bytes )
+void InterfaceStatistics::flushPending()
 {
-    if ( bytes == 0 )
+    mFlushTimer->stop();
+    if ( !mPendingRx && !mPendingTx )
         return;
 
-    foreach( StatisticsModel * s, mModels )
+    quint64 rx = mPendingRx;
+    quint64 tx = mPendingTx;
+    mPendingRx = 0;
+    mPendingTx = 0;
+    mStorageData.journalSeq = mPendingSeq;
+    addTraffic( rx, tx );
+    logRebuildStep( -1, QDateTime(), rx, tx );
+
+    // The bytes all went to the newest entry, which is inside every window
+    const QList<WarnRule> &warn = mInterface->settings().warnRules;
+    if ( mWarnSums.count() != warn.count() )
+        resetWarnSums();
+    else
     {
-        if ( s->periodType() == KNemoStats::HourArchive )
-            continue;
-        foreach ( KNemoStats::TrafficType t, mModels.value( KNemoStats::Hour )->trafficTypes() )
+        bool offpeak = mModels.value( KNemoStats::Hour )->trafficTypes().contains( KNemoStats::OffpeakTraffic );
+        for ( int i = 0; i < warn.count(); ++i )
         {
-            s->addTxBytes( bytes, t );
+            StatisticsModel *model = mModels.value( warn[i].periodUnits );
+            if ( !model || !model->rowCount() || !warn[i].periodCount )
+                continue;
+            if ( warn[i].trafficType == KNemoStats::PeakOffpeak ||
+                 ( warn[i].trafficType == KNemoStats::Offpeak ) == offpeak )
+                mWarnSums[i] += warnBytes( warn[i], rx, tx );
         }
     }
+    checkWarnings();
 
-    mTrafficChanged = true;
     emit currentEntryChanged();
 }
 
@@ -21,12 +21,19 @@
 #ifndef INTERFACESTATISTICS_H
 #define INTERFACESTATISTICS_H
 
+#include <QDateTime>
+#include <QPair>
+
 #include "storage/storagedata.h"
 
 class QTimer;
 class Interface;
 class StatisticsModel;
+class StatisticsBuilder;
+class StatisticsRebuilder;
 class SqlStorage;
+class StorageWorker;
+class StatisticsJournal;
 
 /**
  * This class is able to collect transfered data for an interface,
@@ -39,6 +46,7 @@ class SqlStorage;
 class InterfaceStatistics : public QObject
 {
     Q_OBJECT
+    friend class StatisticsWriter;
 public:
     InterfaceStatistics( Interface* interface );
     virtual ~InterfaceStatistics();
@@ -50,18 +58,31 @@ public:
     void configChanged();
 
     /**
-     * Return a pointer to the StatisticsModel tracking a period unit
+     * Return a pointer to the StatisticsModel tracking a period unit.  Any
+     * pending traffic is added to the models first.
+     */
+    StatisticsModel* getStatistics( enum KNemoStats::PeriodUnits t );
+
+    /**
+     * Add the traffic of one poll to each of the models.  It goes into the
+     * journal right away, and is added to the models at most about once a
+     * second.
      */
-    StatisticsModel* getStatistics( enum KNemoStats::PeriodUnits t ) { return mModels.value( t ); }
+    void addBytes( quint64 rx, quint64 tx );
 
     /**
-     * Add received bytes to each of the models
+     * Return the traffic of the hours that start in [start, end).  Archived
+     * hours are looked up in the range index of the database, so the cost
+     * doesn't grow with the length of the range.  Hours not written yet
+     * are added from memory, so this never waits for a save.
      */
-    void addRxBytes( unsigned long bytes );
+    TrafficTotals trafficBetween( const QDateTime &start, const QDateTime &end );
 
-    /** Add transmitted bytes to each of the models
+    /**
+     * Percentage done of a rebuild running in the background, or 100 if
+     * there is none.
      */
-    void addTxBytes( unsigned long bytes );
+    int rebuildProgress() const;
 
     /**
      * Return a pointer to the active calendar
@@ -80,51 +101,135 @@ signals:
      */
     void warnTraffic( QString warnText, quint64 threshold, quint64 current );
 
+    /**
+     * Emitted as a rebuild after a config change goes along.  It reaches
+     * 100 when the results are in.
+     */
+    void rebuildProgressChanged( int percent );
+
+    /**
+     * Emitted when saving the statistics failed
+     */
+    void storageError( const QString &message );
+
 public slots:
     void clearStatistics();
     void checkValidEntry();
+    /**
+     * Add pending traffic to the models now
+     */
+    void flushPending();
+    /**
+     * Drop the older rows that views paged in.  Unsaved rows and the rows
+     * traffic warnings need stay in memory.  Nothing is dropped before the
+     * last save is in the db; the next save tries again.
+     */
+    void evictHistory();
 
 private slots:
     void saveStatistics( bool fullSave = false );
-    void checkWarnings();
+    void compactStatistics();
+    void writeFailed( const QString &ifaceName, const QString &message );
+    void updateRebuildProgress( int percent );
+    void rebuildFinished();
 
 private:
     bool loadStats();
+    /**
+     * What changed since the last save, for the storage worker to write
+     */
+    StatisticsChangeSet takeChanges( bool fullSave = false );
+    /**
+     * Forget the archived hours the worker has written
+     */
+    void dropWrittenArchives();
 
+    void checkWarnings();
     void resetWarnings( int periodUnits );
+    /**
+     * Load the rows the windows of the warning rules cover
+     */
+    void loadWarnRows();
+    quint64 warnWindowSum( const WarnRule &rule );
+    void resetWarnSums();
     void hoursToArchive( const QDateTime &dateTime );
-    bool daysInSpan( const QDate& entry, int span );
-    QDate nextBillPeriodStart( const StatsRule &rule, const QDate& );
 
+    /**
+     * Add traffic to the current entries
+     */
+    void addTraffic( quint64 rx, quint64 tx );
     void genNewHour( const QDateTime &dateTime );
     bool genNewCalendarType( const QDate &, const enum KNemoStats::PeriodUnits );
     void genNewBillPeriod( const QDate & );
 
-    int ruleForDate( const QDate &date );
+    /**
+     * Put back the traffic that was journaled after the last save
+     */
+    void replayJournal();
     void syncWithExternal( uint updated );
-    bool isOffpeak( const StatsRule & rule, const QDateTime &dt );
-    QDate prepareRebuild( StatisticsModel* statistics, const QDate &recalcDate );
-    void amendStats( int index, const StatisticsModel *source, StatisticsModel *dest );
-
-    int rebuildHours( StatisticsModel *s, const StatsRule &rules, const QDate &start, const QDate &end );
-    int rebuildDay( int dayIndex, int hourIndex, StatisticsModel *s );
-    void rebuildBaseUnits( const StatsRule & rule, const QDate & start, const QDate & end );
-    void rebuildCalendarPeriods( const QDate &requestedStart, bool weekOnly = false );
-    void rebuildBillPeriods( const QDate &requestedStart );
 
-    void prependStatsRule( QList<StatsRule> &rules );
     void checkRebuild( const KLocale::CalendarSystem oldCalendar, bool force = false );
+    void startRebuild();
+    /**
+     * Remember a change to the models while a rebuild runs
+     */
+    void logRebuildStep( int periodType, const QDateTime &dateTime, quint64 rx = 0, quint64 tx = 0 );
+
+    struct RebuildStep
+    {
+        // A new entry of this type at dateTime, or -1 for traffic
+        int periodType;
+        QDateTime dateTime;
+        quint64 rx;
+        quint64 tx;
+    };
 
     Interface* mInterface;
     QTimer* mSaveTimer;
-    QTimer* mWarnTimer;
     QTimer* mEntryTimer;
-    bool mTrafficChanged;
+    QTimer* mFlushTimer;
+    QTimer* mCompactTimer;
+    // Traffic not yet added to the models.  It always belongs to the
+    // current entries, because we flush before creating new ones.
+    quint64 mPendingRx;
+    quint64 mPendingTx;
+    // The newest journal record, which the pending traffic ends with
+    quint64 mPendingSeq;
     int mWeekStartDay;
     StorageData mStorageData;
     QHash<int, StatisticsModel*> mModels;
     QList<StatsRule> mStatsRules;
+    // Traffic in the window of each warning rule, kept in step with
+    // settings().warnRules
+    QVector<quint64> mWarnSums;
+    StatisticsBuilder *mBuilder;
+
+    // The rules the models were last built with.  mStatsRules already
+    // holds the new ones while a rebuild runs.
+    QList<StatsRule> mDataRules;
+    StatisticsRebuilder *mRebuilder;
+    bool mRebuildForce;
+    bool mRebuildForceWeek;
+    int mRebuildProgress;
+    // Traffic and entries added since the rebuild took its snapshot.
+    // They are added to the results again.
+    QList<RebuildStep> mRebuildSteps;
+    // Bumped by changes that can't be added again that way, so a rebuild
+    // can tell whether its snapshot is still in line with the models
+    unsigned int mEntryGeneration;
+    unsigned int mRebuildGeneration;
     SqlStorage *sql;
+    // Ours, unless the db is shared
+    StorageWorker *mWorker;
+    // The saves that took archived hours along, with the last id they
+    // took.  Those hours stay in memory until the save is in the db.
+    QList< QPair<quint64, int> > mArchiveSaves;
+    // Rows only leave memory once they are in the db, so they can always
+    // be paged back in from there
+    quint64 mLastSaveSerial;
+    bool mEvictPending;
+    // Every flush goes here, so a crash only loses what wasn't flushed
+    StatisticsJournal *mJournal;
 };
 
 #endif // INTERFACESTATISTICS_H
@@ -18,7 +18,13 @@
    Boston, MA 02110-1301, USA.
 */
 
+#include <QDateTimeEdit>
+#include <QGridLayout>
+#include <QLabel>
+#include <QProgressBar>
+#include <QScrollBar>
 #include <QStandardItemModel>
+#include <QTimer>
 
 #include <kio/global.h>
 #include <KMessageBox>
@@ -52,6 +58,13 @@ InterfaceStatisticsDialog::InterfaceStatisticsDialog( Interface* interface, QWid
     mBillingView->verticalHeader()->setVisible( false );
     bl->addWidget( mBillingView );
 
+    setupRangeTab();
+
+    mRebuildProgress = new QProgressBar( mainWidget() );
+    mRebuildProgress->setRange( 0, 100 );
+    mRebuildProgress->setFormat( i18n( "Rebuilding statistics: %p%" ) );
+    ui.verticalLayout_4->addWidget( mRebuildProgress );
+
     mStateKeys.insert( ui.tableHourly, conf_hourState );
     mStateKeys.insert( ui.tableDaily, conf_dayState );
     mStateKeys.insert( ui.tableWeekly, conf_weekState );
@@ -73,6 +86,8 @@ InterfaceStatisticsDialog::InterfaceStatisticsDialog( Interface* interface, QWid
     setupTable( &interfaceGroup, mBillingView,    stat->getStatistics( KNemoStats::BillPeriod ) );
 
     connect( this, SIGNAL( resetClicked() ), SLOT( confirmReset() ) );
+    connect( stat, SIGNAL( rebuildProgressChanged( int ) ), SLOT( setRebuildProgress( int ) ) );
+    setRebuildProgress( stat->rebuildProgress() );
 
     if ( interfaceGroup.hasKey( conf_statisticsPos ) )
     {
@@ -139,12 +154,74 @@ void InterfaceStatisticsDialog::configChanged()
     ui.tableYearly->haveOffpeak( logOffpeak );
     mBillingView->haveOffpeak( logOffpeak );
 
-    if ( billingTab && ui.tabWidget->count() < 6 )
+    foreach ( QWidget *w, mRangeOffpeak )
+        w->setVisible( logOffpeak );
+
+    int billingIndex = ui.tabWidget->indexOf( mBillingWidget );
+    if ( billingTab && billingIndex < 0 )
     {
         ui.tabWidget->insertTab( 4, mBillingWidget, i18n( "Billing Periods" ) );
     }
-    else if ( !billingTab && ui.tabWidget->count() > 5 )
-       ui.tabWidget->removeTab( 4 );
+    else if ( !billingTab && billingIndex >= 0 )
+       ui.tabWidget->removeTab( billingIndex );
+}
+
+void InterfaceStatisticsDialog::setupRangeTab()
+{
+    mRangeWidget = new QWidget();
+    QGridLayout *grid = new QGridLayout( mRangeWidget );
+
+    // Default to the last 7 days, on hour boundaries
+    QDateTime now = QDateTime::currentDateTime();
+    now = QDateTime( now.date(), QTime( now.time().hour(), 0 ) ).addSecs( 3600 );
+
+    mRangeStart = new QDateTimeEdit( now.addDays( -7 ), mRangeWidget );
+    mRangeStart->setCalendarPopup( true );
+    mRangeEnd = new QDateTimeEdit( now, mRangeWidget );
+    mRangeEnd->setCalendarPopup( true );
+    grid->addWidget( new QLabel( i18n( "From:" ), mRangeWidget ), 0, 0 );
+    grid->addWidget( mRangeStart, 0, 1 );
+    grid->addWidget( new QLabel( i18n( "To:" ), mRangeWidget ), 1, 0 );
+    grid->addWidget( mRangeEnd, 1, 1 );
+
+    mRangeRx = new QLabel( mRangeWidget );
+    mRangeTx = new QLabel( mRangeWidget );
+    mRangeTotal = new QLabel( mRangeWidget );
+    grid->addWidget( new QLabel( i18n( "Received:" ), mRangeWidget ), 2, 0 );
+    grid->addWidget( mRangeRx, 2, 1 );
+    grid->addWidget( new QLabel( i18n( "Sent:" ), mRangeWidget ), 3, 0 );
+    grid->addWidget( mRangeTx, 3, 1 );
+    grid->addWidget( new QLabel( i18n( "Total:" ), mRangeWidget ), 4, 0 );
+    grid->addWidget( mRangeTotal, 4, 1 );
+
+    mRangeOffpeakRx = new QLabel( mRangeWidget );
+    mRangeOffpeakTx = new QLabel( mRangeWidget );
+    mRangeOffpeakTotal = new QLabel( mRangeWidget );
+    QLabel *label = new QLabel( i18n( "Off-peak received:" ), mRangeWidget );
+    grid->addWidget( label, 5, 0 );
+    grid->addWidget( mRangeOffpeakRx, 5, 1 );
+    mRangeOffpeak << label << mRangeOffpeakRx;
+    label = new QLabel( i18n( "Off-peak sent:" ), mRangeWidget );
+    grid->addWidget( label, 6, 0 );
+    grid->addWidget( mRangeOffpeakTx, 6, 1 );
+    mRangeOffpeak << label << mRangeOffpeakTx;
+    label = new QLabel( i18n( "Off-peak total:" ), mRangeWidget );
+    grid->addWidget( label, 7, 0 );
+    grid->addWidget( mRangeOffpeakTotal, 7, 1 );
+    mRangeOffpeak << label << mRangeOffpeakTotal;
+
+    grid->setColumnStretch( 2, 1 );
+    grid->setRowStretch( 8, 1 );
+
+    ui.tabWidget->addTab( mRangeWidget, i18n( "Range" ) );
+
+    mRangeTimer = new QTimer( this );
+    mRangeTimer->setSingleShot( true );
+    mRangeTimer->setInterval( 300 );
+    connect( mRangeTimer, SIGNAL( timeout() ), SLOT( updateRange() ) );
+    connect( mRangeStart, SIGNAL( dateTimeChanged( const QDateTime& ) ), mRangeTimer, SLOT( start() ) );
+    connect( mRangeEnd, SIGNAL( dateTimeChanged( const QDateTime& ) ), mRangeTimer, SLOT( start() ) );
+    connect( ui.tabWidget, SIGNAL( currentChanged( int ) ), mRangeTimer, SLOT( start() ) );
 }
 
 void InterfaceStatisticsDialog::setupTable( KConfigGroup* group, QTableView *view, StatisticsModel *model )
@@ -158,8 +235,9 @@ void InterfaceStatisticsDialog::setupTable( KConfigGroup* group, QTableView *vie
     QModelIndex sourceIndex = proxy->sourceModel()->index( proxy->rowCount() - 1, 0 );
     view->selectionModel()->setCurrentIndex( proxy->mapFromSource( sourceIndex ), QItemSelectionModel::NoUpdate );
 
-    connect( model, SIGNAL( itemChanged( QStandardItem * ) ), view->viewport(), SLOT( update() ) );
+    connect( model, SIGNAL( dataChanged( const QModelIndex&, const QModelIndex& ) ), view->viewport(), SLOT( update() ) );
     connect( proxy, SIGNAL( rowsInserted( const QModelIndex&, int, int ) ), this, SLOT( setCurrentSel() ) );
+    connect( view->verticalScrollBar(), SIGNAL( valueChanged( int ) ), this, SLOT( fetchOlderRows( int ) ) );
 
     QByteArray state = group->readEntry( mStateKeys.value( view ), QByteArray() );
     if ( state.isNull() )
@@ -189,6 +267,10 @@ bool InterfaceStatisticsDialog::event( QEvent *e )
         // will become ridiculously wide if we set this earlier.
         ui.tableHourly->horizontalHeader()->setStretchLastSection( true );
     }
+    if ( e->type() == QEvent::Hide )
+    {
+        mInterface->ifaceStatistics()->evictHistory();
+    }
 
     return KDialog::event( e );
 }
@@ -208,5 +290,46 @@ void InterfaceStatisticsDialog::setCurrentSel()
     tv->selectionModel()->setCurrentIndex( proxy->mapFromSource( sourceIndex ), QItemSelectionModel::NoUpdate );
 }
 
+void InterfaceStatisticsDialog::fetchOlderRows( int value )
+{
+    // Views fetch more rows when scrolled to the bottom, but sorted by
+    // ascending date the older rows belong at the top.
+    foreach ( QTableView *view, mStateKeys.keys() )
+    {
+        QScrollBar *bar = view->verticalScrollBar();
+        if ( bar != sender() )
+            continue;
+        QHeaderView *header = view->horizontalHeader();
+        if ( header->sortIndicatorSection() == 0 &&
+             header->sortIndicatorOrder() == Qt::AscendingOrder &&
+             value - bar->minimum() < bar->pageStep() &&
+             view->model()->canFetchMore( QModelIndex() ) )
+            view->model()->fetchMore( QModelIndex() );
+    }
+}
+
+void InterfaceStatisticsDialog::setRebuildProgress( int percent )
+{
+    mRebuildProgress->setValue( percent );
+    mRebuildProgress->setVisible( percent < 100 );
+    if ( percent >= 100 )
+        mRangeTimer->start();
+}
+
+void InterfaceStatisticsDialog::updateRange()
+{
+    // Only bother the database when the tab is in view
+    if ( ui.tabWidget->currentWidget() != mRangeWidget )
+        return;
+
+    TrafficTotals t = mInterface->ifaceStatistics()->trafficBetween( mRangeStart->dateTime(), mRangeEnd->dateTime() );
+    mRangeRx->setText( KIO::convertSize( t.rx ) );
+    mRangeTx->setText( KIO::convertSize( t.tx ) );
+    mRangeTotal->setText( KIO::convertSize( t.rx + t.tx ) );
+    mRangeOffpeakRx->setText( KIO::convertSize( t.rxOffpeak ) );
+    mRangeOffpeakTx->setText( KIO::convertSize( t.txOffpeak ) );
+    mRangeOffpeakTotal->setText( KIO::convertSize( t.rxOffpeak + t.txOffpeak ) );
+}
+
 
 #include "interfacestatisticsdialog.moc"
@@ -26,6 +26,10 @@
 
 class StatisticsModel;
 class Interface;
+class QDateTimeEdit;
+class QLabel;
+class QProgressBar;
+class QTimer;
 
 
 /**
@@ -63,6 +67,7 @@ protected:
     bool event( QEvent *e );
 
 private:
+    void setupRangeTab();
     void setupTable( KConfigGroup* group, QTableView * view, StatisticsModel* model );
 
     Ui::InterfaceStatisticsDlg ui;
@@ -70,12 +75,28 @@ private:
     bool mSetPos;
     QWidget *mBillingWidget;
     StatisticsView *mBillingView;
+    QWidget *mRangeWidget;
+    QDateTimeEdit *mRangeStart;
+    QDateTimeEdit *mRangeEnd;
+    QLabel *mRangeRx;
+    QLabel *mRangeTx;
+    QLabel *mRangeTotal;
+    QList<QWidget*> mRangeOffpeak;
+    QLabel *mRangeOffpeakRx;
+    QLabel *mRangeOffpeakTx;
+    QLabel *mRangeOffpeakTotal;
+    // Spinning through dates only asks for the totals once it settles
+    QTimer *mRangeTimer;
+    QProgressBar *mRebuildProgress;
     KSharedConfigPtr mConfig;
     Interface* mInterface;
     QHash<QTableView*, QString> mStateKeys;
 
 private slots:
     void setCurrentSel();
+    void fetchOlderRows( int value );
+    void updateRange();
+    void setRebuildProgress( int percent );
 };
 
 #endif // INTERFACESTATISTICSDIALOG_H
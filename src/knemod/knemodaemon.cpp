@@ -86,11 +86,18 @@ void KNemoDaemon::readConfig()
     // General
     GeneralSettings g;
     KConfigGroup generalGroup( config, confg_general );
-    generalSettings->pollInterval = clamp<double>(generalGroup.readEntry( conf_pollInterval, g.pollInterval ), 0.1, 2.0 );
+    generalSettings->pollInterval = clamp<double>(generalGroup.readEntry( conf_pollInterval, g.pollInterval ), pollIntervals[0], 2.0 );
     generalSettings->pollInterval = validatePoll( generalSettings->pollInterval );
+    generalSettings->addressInterval = clamp<double>(generalGroup.readEntry( conf_addressInterval, g.addressInterval ), 0.0, 300.0 );
+    generalSettings->routeInterval = clamp<double>(generalGroup.readEntry( conf_routeInterval, g.routeInterval ), 0.0, 300.0 );
+    generalSettings->wirelessInterval = clamp<double>(generalGroup.readEntry( conf_wirelessInterval, g.wirelessInterval ), 0.0, 300.0 );
+    backend->setTierIntervals( generalSettings->addressInterval * 1000,
+                               generalSettings->routeInterval * 1000,
+                               generalSettings->wirelessInterval * 1000 );
     generalSettings->useBitrate = generalGroup.readEntry( conf_useBitrate, g.useBitrate );
     generalSettings->saveInterval = clamp<int>(generalGroup.readEntry( conf_saveInterval, g.saveInterval ), 0, 300 );
     generalSettings->statisticsDir = generalGroup.readEntry( conf_statisticsDir, g.statisticsDir );
+    generalSettings->sharedStatistics = generalGroup.readEntry( conf_sharedStatistics, g.sharedStatistics );
     generalSettings->toolTipContent = generalGroup.readEntry( conf_toolTipContent, g.toolTipContent );
     // If we already have an Interfaces key--even if its empty--then we
     // shouldn't try to set up a default interface
@@ -174,6 +181,7 @@ void KNemoDaemon::readConfig()
         }
     }
 
+    backend->setSampleInterval( generalSettings->pollInterval * 1000000 );
     mPollTimer->start( generalSettings->pollInterval * 1000 );
 }
 
@@ -0,0 +1,684 @@
+/* This file is part of KNemo
+   Copyright (C) 2005, 2006 Percy Leonhardt <percy@eris23.de>
+   Copyright (C) 2009, 2010 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <KCalendarSystem>
+
+#include "statisticsbuilder.h"
+#include "statisticsmodel.h"
+#include "storage/sqlstorage.h"
+
+static bool statsLessThan( const StatsRule& s1, const StatsRule& s2 )
+{
+    if ( s1.startDate < s2.startDate )
+        return true;
+    else
+        return false;
+}
+
+void StatisticsBuilder::sortStatsRules( QList<StatsRule> &rules )
+{
+    qSort( rules.begin(), rules.end(), statsLessThan );
+}
+
+StatisticsBuilder::StatisticsBuilder( QHash<int, StatisticsModel*> &models, StorageData &storageData,
+                                      QList<StatsRule> &statsRules, SqlStorage *sql )
+    : mModels( models ),
+      mStorageData( storageData ),
+      mStatsRules( statsRules ),
+      sql( sql ),
+      mDowCalendar( 0 ),
+      mDow( 0 ),
+      mProgress( -1 )
+{
+}
+
+StatisticsBuilder::~StatisticsBuilder()
+{
+}
+
+bool StatisticsBuilder::rebuildProgress( int )
+{
+    return true;
+}
+
+bool StatisticsBuilder::step( int phase, int done, int total )
+{
+    int percent = ( phase * 100 + ( total > 0 ? done * 100 / total : 0 ) ) / PhaseCount;
+    if ( percent == mProgress )
+        return true;
+    mProgress = percent;
+    return rebuildProgress( percent );
+}
+
+/**********************************
+ * Stats Entry Generators         *
+ **********************************/
+
+bool StatisticsBuilder::genNewCalendarType( const QDate &date, const KNemoStats::PeriodUnits stype )
+{
+    if ( stype < KNemoStats::Day || stype > KNemoStats::Year )
+        return false;
+
+    StatisticsModel * model = mModels.value( stype );
+    if ( model->rowCount() &&
+         model->date().addDays( model->days() ) > date )
+            return false;
+
+    QDate newDate;
+    int dayOf;
+    int weekStartDay = mStorageData.calendar->weekStartDay();
+
+    switch ( stype )
+    {
+        case KNemoStats::Day:
+            newDate = date;
+            break;
+        case KNemoStats::Week:
+            dayOf = mStorageData.calendar->dayOfWeek( date );
+            if ( dayOf >= weekStartDay )
+                newDate = date.addDays( weekStartDay - dayOf );
+            else
+                newDate = date.addDays( weekStartDay - mStorageData.calendar->daysInWeek( date ) - dayOf );
+            break;
+        case KNemoStats::Month:
+            dayOf = mStorageData.calendar->day( date );
+            newDate = date.addDays( 1 - dayOf );
+            break;
+        case KNemoStats::Year:
+            dayOf = mStorageData.calendar->dayOfYear( date );
+            newDate = date.addDays( 1 - dayOf );
+            break;
+        default:
+            return false;
+    }
+
+    mModels.value( stype )->createEntry( QDateTime( newDate, QTime() ) );
+
+    return true;
+}
+
+// Return true if at least one daily statistic entry is in a span of days
+bool StatisticsBuilder::daysInSpan( const QDate& date, int days )
+{
+    StatisticsModel *model = mModels.value( KNemoStats::Day );
+    if ( !model->rowCount() )
+        return false;
+
+    QDate nextRuleStart = date.addDays( days );
+    for ( int i = model->rowCount() - 1; i >= 0; --i )
+    {
+        // No others will be valid after this; stop early
+        if ( model->date( i ) < date )
+            return false;
+        if ( model->date( i ) < nextRuleStart && model->date( i ) >= date )
+            return true;
+    }
+    return false;
+}
+
+QDate StatisticsBuilder::nextBillPeriodStart( const StatsRule &rules, const QDate &date )
+{
+    QDate nextDate;
+    QDate refDay;
+    int modelType = rules.periodUnits;
+    switch ( modelType )
+    {
+        case KNemoStats::Day:
+            nextDate = date.addDays( rules.periodCount );
+            break;
+        case KNemoStats::Week:
+            nextDate = date;
+            for ( int i = 0; i < rules.periodCount; ++i )
+                nextDate = nextDate.addDays( mStorageData.calendar->daysInWeek( nextDate ) );
+            break;
+        default:// KNemoStats::Month:
+            nextDate = mStorageData.calendar->addMonths( date, rules.periodCount );
+            // Example: one month starting Jan 31 = Jan 31 -> Mar 1
+            // This seems the most common way to handle late start dates
+            if ( mStorageData.calendar->day( nextDate ) < mStorageData.calendar->day( date ) )
+                nextDate = nextDate.addDays( 1 );
+            break;
+    }
+    return nextDate;
+}
+
+bool StatisticsBuilder::genNewBillPeriod( const QDate &date )
+{
+    int ruleIndex = ruleForDate( date );
+    if ( ruleIndex < 0 )
+        return false;
+
+    StatisticsModel * billing = mModels.value( KNemoStats::BillPeriod );
+    QDate nextRuleStart;
+
+    if ( mStatsRules.count() > ruleIndex+1 )
+        nextRuleStart = mStatsRules.at( ruleIndex+1 ).startDate;
+
+    // Harder to find whether we should skip generating a new billing entry
+    if ( nextRuleStart.isValid() && billing->rowCount() && billing->date().addDays( billing->days() ) >= nextRuleStart )
+        return false;
+
+    int days;
+
+    // Given a calendar day and a billing period start date, find a
+    // billing period that the day belongs in.
+    QDate newDate;
+    QDate nextStartDate;
+    if ( !billing->rowCount() ||
+         billing->date() < mStatsRules.at( ruleIndex ).startDate )
+    {
+        nextStartDate = mStatsRules.at( ruleIndex ).startDate;
+    }
+    else
+    {
+        nextStartDate = billing->date();
+    }
+
+    do
+    {
+        newDate = nextStartDate;
+        nextStartDate = nextBillPeriodStart( mStatsRules.at( ruleIndex ), newDate );
+        days = newDate.daysTo( nextStartDate );
+    } while ( nextStartDate <= date || !daysInSpan( newDate, days ) );
+
+    // Truncate a billing period if necessary
+    if ( nextRuleStart.isValid() && nextRuleStart < nextStartDate )
+        days = newDate.daysTo( nextRuleStart );
+
+    if ( billing->rowCount() && newDate == billing->date() )
+        return false;
+
+    billing->createEntry( QDateTime( newDate, QTime() ), -1, days );
+    return true;
+}
+
+int StatisticsBuilder::ruleForDate( const QDate &date )
+{
+    for( int i = mStatsRules.count() - 1; i >= 0; --i )
+    {
+        if ( date >= mStatsRules[i].startDate )
+            return i;
+    }
+    return -1;
+}
+
+static bool sameOffpeak( const StatsRule &a, const StatsRule &b )
+{
+    return a.offpeakStartTime == b.offpeakStartTime &&
+           a.offpeakEndTime == b.offpeakEndTime &&
+           a.weekendIsOffpeak == b.weekendIsOffpeak &&
+           a.weekendDayStart == b.weekendDayStart &&
+           a.weekendDayEnd == b.weekendDayEnd &&
+           a.weekendTimeStart == b.weekendTimeStart &&
+           a.weekendTimeEnd == b.weekendTimeEnd;
+}
+
+// Compile the off-peak hours of a rule into one bit per hour of the week,
+// starting with hour 0 of day 1.  The last map is kept, and rebuilds and
+// new hours nearly always ask for the same rule again.
+const QBitArray &StatisticsBuilder::offpeakMap( const StatsRule &rules )
+{
+    if ( !mOffpeakMap.isEmpty() && sameOffpeak( rules, mOffpeakRule ) )
+        return mOffpeakMap;
+
+    mOffpeakRule = rules;
+    mOffpeakMap.fill( false, 7 * 24 );
+
+    // Weekend bounds in seconds since the start of the week
+    int weekendStart = ( rules.weekendDayStart - 1 ) * 86400 + QTime( 0, 0 ).secsTo( rules.weekendTimeStart );
+    int weekendEnd = ( rules.weekendDayEnd - 1 ) * 86400 + QTime( 0, 0 ).secsTo( rules.weekendTimeEnd );
+
+    for ( int slot = 0; slot < mOffpeakMap.size(); ++slot )
+    {
+        QTime curHour = QTime( slot % 24, 0 );
+        bool isOffpeak = false;
+
+        // This block just tests weekly hours
+        if ( rules.offpeakStartTime < rules.offpeakEndTime &&
+             curHour >= rules.offpeakStartTime && curHour < rules.offpeakEndTime )
+        {
+            isOffpeak = true;
+        }
+        else if ( rules.offpeakStartTime > rules.offpeakEndTime &&
+             ( curHour >= rules.offpeakStartTime || curHour < rules.offpeakEndTime ) )
+        {
+            isOffpeak = true;
+        }
+
+        if ( rules.weekendIsOffpeak )
+        {
+            int cur = slot * 3600;
+            if ( rules.weekendDayStart <= rules.weekendDayEnd &&
+                 weekendStart <= cur && cur < weekendEnd )
+            {
+                isOffpeak = true;
+            }
+            // The weekend wraps around the end of the week
+            else if ( rules.weekendDayStart > rules.weekendDayEnd &&
+                      ( cur >= weekendStart || cur < weekendEnd ) )
+            {
+                isOffpeak = true;
+            }
+        }
+
+        mOffpeakMap.setBit( slot, isOffpeak );
+    }
+    return mOffpeakMap;
+}
+
+int StatisticsBuilder::dayOfWeek( const QDate &date )
+{
+    if ( date != mDowDate || mStorageData.calendar != mDowCalendar )
+    {
+        mDowDate = date;
+        mDowCalendar = mStorageData.calendar;
+        mDow = mStorageData.calendar->dayOfWeek( date );
+    }
+    return mDow;
+}
+
+bool StatisticsBuilder::isOffpeak( const StatsRule &rules, const QDateTime &curDT )
+{
+    if ( !rules.logOffpeak )
+        return false;
+
+    int slot = ( dayOfWeek( curDT.date() ) - 1 ) * 24 + curDT.time().hour();
+    const QBitArray &map = offpeakMap( rules );
+    return slot >= 0 && slot < map.size() && map.testBit( slot );
+}
+
+
+/**************************************
+ * Rebuilding Statistics              *
+ **************************************/
+
+int StatisticsBuilder::rebuildHours( StatisticsModel *s, const StatsRule &rules, const QDate &start, const QDate &nextRuleStart )
+{
+    if ( !s->rowCount() )
+        return 0;
+
+    int i = s->rowCount();
+    while ( i > 0 && s->date( i - 1 ) >= start )
+    {
+        i--;
+        if ( nextRuleStart.isValid() && s->date( i ) >= nextRuleStart )
+            continue;
+
+        s->resetTrafficTypes( i );
+        if ( isOffpeak( rules, s->dateTime( i ) ) )
+        {
+            s->setTraffic( i, s->rxBytes( i ), s->txBytes( i ), KNemoStats::OffpeakTraffic );
+            s->addTrafficType( KNemoStats::OffpeakTraffic, i );
+        }
+    }
+    if ( mStorageData.saveFromId.value( s->periodType() ) > s->id( i ) )
+    {
+        mStorageData.saveFromId.insert( s->periodType(), s->id( i ) );
+    }
+
+    return i;
+}
+
+int StatisticsBuilder::rebuildDay( int dayIndex, int hourIndex, StatisticsModel *hours )
+{
+    QMap<KNemoStats::TrafficType, QPair<quint64, quint64> > dayTraffic;
+    StatisticsModel *days = mModels.value( KNemoStats::Day );
+    while ( hourIndex >= 0 && hours->date( hourIndex ) > days->date( dayIndex ).addDays( 1 ) )
+    {
+        --hourIndex;
+    }
+    while ( hourIndex >= 0 && hours->date( hourIndex ) == days->date( dayIndex ) )
+    {
+        foreach ( KNemoStats::TrafficType t, hours->trafficTypes( hourIndex ) )
+        {
+            if ( t == KNemoStats::AllTraffic )
+                continue;
+            quint64 rx = hours->rxBytes( hourIndex, t ) + dayTraffic.value( t ).first;
+            quint64 tx = hours->txBytes( hourIndex, t ) + dayTraffic.value( t ).second;
+            dayTraffic.insert( t, QPair<quint64, quint64>( rx, tx ) );
+        }
+        --hourIndex;
+    }
+    foreach (KNemoStats::TrafficType t, dayTraffic.keys() )
+    {
+        days->setTraffic( dayIndex, dayTraffic.value( t ).first, dayTraffic.value( t ).second, t );
+        days->addTrafficType( t, dayIndex );
+    }
+    return hourIndex;
+}
+
+// A rebuild of hours and days never changes the number of entries
+// We just change what bytes count as off-peak
+void StatisticsBuilder::rebuildBaseUnits( const StatsRule &rules, const QDate &start, const QDate &nextRuleStart )
+{
+    int hIndex = 0;
+    int haIndex = 0;
+
+    StatisticsModel *hours = mModels.value( KNemoStats::Hour );
+    StatisticsModel *hourArchives = mModels.value( KNemoStats::HourArchive );
+    StatisticsModel *days = mModels.value( KNemoStats::Day );
+    sql->loadHourArchives( hourArchives, start, nextRuleStart );
+    if ( hourArchives->rowCount() )
+        mStorageData.saveFromId.insert( hourArchives->periodType(), hourArchives->id( 0 ) );
+
+    rebuildHours( hourArchives, rules, start, nextRuleStart );
+    rebuildHours( hours, rules, start, nextRuleStart );
+
+    if ( hours->rowCount() )
+        hIndex = hours->rowCount() - 1;
+    if ( hourArchives->rowCount() )
+        haIndex = hourArchives->rowCount() - 1;
+
+    if ( !days->rowCount() )
+        return;
+
+    int dayIndex = days->rowCount();
+    while ( dayIndex > 0 && days->date( dayIndex - 1 ) >= start )
+    {
+        dayIndex--;
+        if ( nextRuleStart.isValid() && days->date( dayIndex ) >= nextRuleStart )
+            continue;
+
+        days->resetTrafficTypes( dayIndex );
+        if ( rules.logOffpeak )
+        {
+            haIndex = rebuildDay( dayIndex, haIndex, hourArchives );
+            hIndex = rebuildDay( dayIndex, hIndex, hours );
+        }
+    }
+    if ( mStorageData.saveFromId.value( days->periodType() ) > days->id( dayIndex ) )
+    {
+        mStorageData.saveFromId.insert( days->periodType(), days->id( dayIndex ) );
+    }
+}
+
+/**
+ * Given a model with statistics of a certain unit (year, month, week, etc.)
+ * and a requested rebuild date, how far back to we actually need to go
+ * to accuratly rebuild statistics from the daily stats.
+ */
+QDate StatisticsBuilder::prepareRebuild( StatisticsModel* statistics, const QDate &startDate )
+{
+    QDate newStartDate = startDate;
+    if ( statistics->periodType() <= KNemoStats::Day ||
+         statistics->periodType() > KNemoStats::Year )
+        return newStartDate;
+
+    for ( int i = 0; i < statistics->rowCount(); ++i )
+    {
+        int days = statistics->days( i );
+        QDate nextPeriodStart = statistics->date( i ).addDays( days );
+
+        if ( statistics->periodType() == KNemoStats::BillPeriod )
+        {
+            // Have to check if a billing period's truncation changed
+            int ruleIndex = ruleForDate( statistics->date( i ) );
+            if ( ruleIndex < 0 )
+                break;
+            QDate nextFullPeriodStart = nextBillPeriodStart( mStatsRules.at( ruleIndex ), statistics->date( i ) );
+            if ( nextFullPeriodStart > nextPeriodStart )
+            {
+                if ( mStatsRules.count() == ruleIndex+1 ||
+                     mStatsRules.at( ruleIndex + 1 ).startDate != nextPeriodStart )
+                {
+                    // Truncation changed
+                    // This will make sure the entry gets rebuilt
+                    nextPeriodStart = nextFullPeriodStart;
+                }
+            }
+        }
+
+        if ( nextPeriodStart > startDate )
+        {
+            if ( statistics->date( i ) < startDate )
+            {
+                newStartDate = statistics->date( i );
+            }
+            if ( statistics->rowCount() && mStorageData.saveFromId.value( statistics->periodType() ) > statistics->id( i ) )
+            {
+                mStorageData.saveFromId.insert( statistics->periodType(), statistics->id( i ) );
+            }
+            statistics->removeRows( i, statistics->rowCount() - i );
+            break;
+        }
+    }
+
+    return newStartDate;
+}
+
+void StatisticsBuilder::amendStats( int i, const StatisticsModel *source, StatisticsModel* dest )
+{
+    foreach ( KNemoStats::TrafficType t, source->trafficTypes( i ) )
+    {
+        dest->addRxBytes( source->rxBytes( i, t ), t );
+        dest->addTxBytes( source->txBytes( i, t ), t );
+        dest->addTrafficType( t );
+    }
+}
+
+bool StatisticsBuilder::rebuildCalendarPeriods( const QDate &requestedStart, bool weekOnly )
+{
+    QDate weekStart;
+    QDate monthStart;
+    QDate walkbackDate;
+
+    QList<QDate> s;
+
+    weekStart = prepareRebuild( mModels.value( KNemoStats::Week), requestedStart );
+    s.append( weekStart );
+    if ( !weekOnly )
+    {
+        monthStart = prepareRebuild( mModels.value( KNemoStats::Month), requestedStart );
+        s.append( monthStart );
+    }
+
+    // Now find how far back we'll need to go
+    qSort( s );
+    walkbackDate = s.first();
+
+    StatisticsModel *days = mModels.value( KNemoStats::Day );
+    for ( int i = 0; i < days->rowCount(); ++i )
+    {
+        if ( !step( CalendarPhase, i, days->rowCount() ) )
+            return false;
+
+        QDate day = days->date( i );
+        if ( day < walkbackDate )
+            continue;
+
+        if ( day >= weekStart )
+        {
+            genNewCalendarType( day, KNemoStats::Week );
+            amendStats( i, mModels.value( KNemoStats::Day ), mModels.value( KNemoStats::Week ) );
+        }
+
+        if ( !weekOnly && day >= monthStart )
+        {
+            genNewCalendarType( day, KNemoStats::Month );
+            amendStats( i, mModels.value( KNemoStats::Day ), mModels.value( KNemoStats::Month ) );
+        }
+    }
+
+    if ( weekOnly )
+        return true;
+
+    // Build years from months...save time
+    QDate yearStart = prepareRebuild( mModels.value( KNemoStats::Year ), requestedStart );
+    StatisticsModel *months = mModels.value( KNemoStats::Month );
+    for ( int i = 0; i < months->rowCount(); ++i )
+    {
+        QDate day = months->date( i );
+        if ( day < yearStart )
+            continue;
+        genNewCalendarType( day, KNemoStats::Year );
+        amendStats( i, mModels.value( KNemoStats::Month ), mModels.value( KNemoStats::Year ) );
+    }
+    return true;
+}
+
+bool StatisticsBuilder::rebuildBillPeriods( const QDate &requestedStart )
+{
+    QDate walkbackDate;
+    StatisticsModel *days = mModels.value( KNemoStats::Day );
+    StatisticsModel *billPeriods = mModels.value( KNemoStats::BillPeriod );
+
+    if ( billPeriods->rowCount() )
+        walkbackDate = prepareRebuild( mModels.value( KNemoStats::BillPeriod), requestedStart );
+    else
+        walkbackDate = days->date( 0 );
+
+    for ( int i = 0; i < days->rowCount(); ++i )
+    {
+        if ( !step( BillingPhase, i, days->rowCount() ) )
+            return false;
+
+        QDate day = days->date( i );
+
+        if ( day >= walkbackDate )
+        {
+            genNewBillPeriod( day );
+            amendStats( i, mModels.value( KNemoStats::Day ), mModels.value( KNemoStats::BillPeriod ) );
+        }
+    }
+    return true;
+}
+
+void StatisticsBuilder::prependStatsRule( QList<StatsRule> &rules )
+{
+    sortStatsRules( rules );
+    StatisticsModel * days = mModels.value( KNemoStats::Day );
+    if ( rules.count() == 0 ||
+         ( days->rowCount() > 0 && rules[0].startDate > days->firstDate() )
+       )
+    {
+        QDate date;
+        if ( days->rowCount() )
+            date = days->firstDate();
+        else
+            date = QDate::currentDate();
+        StatsRule s;
+        s.startDate = date.addDays( 1 - mStorageData.calendar->day( date ) );
+        rules.prepend( s );
+    }
+}
+
+bool StatisticsBuilder::rebuild( QList<StatsRule> newRules, bool force, bool forceWeek, bool *rebuilt )
+{
+    *rebuilt = false;
+    mProgress = -1;
+
+    bool doBilling = newRules.count();
+    int oldRuleCount = mStatsRules.count();
+    QDate bpBeginDate;
+    if ( !doBilling )
+    {
+        mModels.value( KNemoStats::BillPeriod )->clearRows();
+        mStorageData.saveFromId.insert( KNemoStats::BillPeriod, 0 );
+    }
+
+    // This is just a dummy for calculation
+    prependStatsRule( newRules );
+    prependStatsRule( mStatsRules );
+
+    if ( !oldRuleCount && mStatsRules[0] == newRules[0] && newRules.count() > mStatsRules.count() )
+        bpBeginDate = mModels.value( KNemoStats::Day )->date( 0 );
+
+    int j = 0;
+    QDate recalcPos;
+    for ( int i = 0; i < newRules.count(); ++i )
+    {
+        if ( !step( BaseUnitPhase, i, newRules.count() ) )
+            return false;
+
+        bool rulesMatch = ( newRules[i] == mStatsRules[j] );
+
+        QDate nextRuleStart;
+        if ( !rulesMatch )
+        {
+            if ( newRules.count() > i + 1 )
+                nextRuleStart = newRules[i+1].startDate;
+            if ( !recalcPos.isValid() )
+                recalcPos = newRules[i].startDate;
+            rebuildBaseUnits( newRules[i], newRules[i].startDate, nextRuleStart );
+        }
+        else
+        {
+            // rules match, now scan forward to see if we need to extend new rule
+            if ( newRules.count() > i + 1 )
+            {
+                int first = -1;
+                int k;
+                // Here we want to skip over any intermediary old rules that will
+                // get taken care of when we recalculate this section.
+                for ( k = 0; k < mStatsRules.count(); ++k )
+                {
+                    if ( mStatsRules[k].startDate > newRules[i].startDate &&
+                         mStatsRules[k].startDate < newRules[i+1].startDate )
+                    {
+                        if ( first < 0 )
+                            first = k;
+                        j = k;
+                        if ( !recalcPos.isValid() )
+                            recalcPos = mStatsRules[j].startDate;
+                    }
+                }
+                if ( first >= 0 )
+                {
+                    rebuildBaseUnits( newRules[i], mStatsRules[first].startDate, newRules[i+1].startDate );
+                }
+            }
+            // We're out of new rules but there's more old ones
+            // so rebuild from next old rule's date using final new rule.
+            else if ( mStatsRules.count() > j + 1 )
+            {
+
+                if ( !recalcPos.isValid() )
+                    recalcPos = mStatsRules[j+1].startDate;
+                rebuildBaseUnits( newRules[i], recalcPos, nextRuleStart );
+            }
+            if ( mStatsRules.count() > j + 1 )
+                ++j;
+        }
+    }
+
+    /*
+    now do the rest
+    */
+    mStatsRules = newRules;
+    if ( force )
+        recalcPos = mModels.value( KNemoStats::Day )->date( 0 );
+
+    if ( recalcPos.isValid() )
+    {
+        if ( !rebuildCalendarPeriods( recalcPos ) )
+            return false;
+
+        if ( doBilling && !rebuildBillPeriods( recalcPos ) )
+            return false;
+    }
+    else if ( forceWeek )
+    {
+        if ( !rebuildCalendarPeriods( mModels.value( KNemoStats::Day )->date( 0 ), true ) )
+            return false;
+    }
+
+    *rebuilt = recalcPos.isValid();
+    return true;
+}
@@ -0,0 +1,116 @@
+/* This file is part of KNemo
+   Copyright (C) 2005, 2006 Percy Leonhardt <percy@eris23.de>
+   Copyright (C) 2009, 2010 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef STATISTICSBUILDER_H
+#define STATISTICSBUILDER_H
+
+#include <QBitArray>
+#include <QHash>
+
+#include "data.h"
+#include "storage/storagedata.h"
+
+class StatisticsModel;
+class SqlStorage;
+
+/**
+ * Creates statistics entries and rebuilds statistics when the rules or the
+ * calendar change.  It works on whatever set of models it is given, so the
+ * same code serves the live models and the snapshot a StatisticsRebuilder
+ * works on in the background.
+ *
+ * @short Entry generation and rebuilding of statistics
+ */
+
+class StatisticsBuilder
+{
+public:
+    StatisticsBuilder( QHash<int, StatisticsModel*> &models, StorageData &storageData,
+                       QList<StatsRule> &statsRules, SqlStorage *sql = 0 );
+    virtual ~StatisticsBuilder();
+
+    static void sortStatsRules( QList<StatsRule> &rules );
+
+    /**
+     * These return true if they created a new entry.
+     */
+    bool genNewCalendarType( const QDate &, const enum KNemoStats::PeriodUnits );
+    bool genNewBillPeriod( const QDate & );
+
+    int ruleForDate( const QDate &date );
+    bool isOffpeak( const StatsRule & rule, const QDateTime &dt );
+    void prependStatsRule( QList<StatsRule> &rules );
+
+    /**
+     * Rebuild what changes when going from the current rules to newRules.
+     * Only the date ranges that the change affects get rebuilt.  Sets
+     * rebuilt if any entries were changed.  Returns false if the rebuild
+     * was cancelled, in which case the models are left half done.
+     */
+    bool rebuild( QList<StatsRule> newRules, bool force, bool forceWeek, bool *rebuilt );
+
+protected:
+    /**
+     * Called whenever the rebuild progress changes.  Return false to cancel
+     * the rebuild.
+     */
+    virtual bool rebuildProgress( int percent );
+
+private:
+    enum RebuildPhase
+    {
+        BaseUnitPhase = 0,
+        CalendarPhase,
+        BillingPhase,
+        PhaseCount
+    };
+    bool step( int phase, int done, int total );
+
+    bool daysInSpan( const QDate& entry, int span );
+    QDate nextBillPeriodStart( const StatsRule &rule, const QDate& );
+
+    const QBitArray &offpeakMap( const StatsRule &rule );
+    int dayOfWeek( const QDate &date );
+
+    QDate prepareRebuild( StatisticsModel* statistics, const QDate &recalcDate );
+    void amendStats( int index, const StatisticsModel *source, StatisticsModel *dest );
+
+    int rebuildHours( StatisticsModel *s, const StatsRule &rules, const QDate &start, const QDate &end );
+    int rebuildDay( int dayIndex, int hourIndex, StatisticsModel *s );
+    void rebuildBaseUnits( const StatsRule & rule, const QDate & start, const QDate & end );
+    bool rebuildCalendarPeriods( const QDate &requestedStart, bool weekOnly = false );
+    bool rebuildBillPeriods( const QDate &requestedStart );
+
+    QHash<int, StatisticsModel*> &mModels;
+    StorageData &mStorageData;
+    QList<StatsRule> &mStatsRules;
+    SqlStorage *sql;
+
+    // One bit per hour of the week, compiled from mOffpeakRule
+    StatsRule mOffpeakRule;
+    QBitArray mOffpeakMap;
+    // The last day of the week looked up; hours come in runs of 24 a day
+    QDate mDowDate;
+    KCalendarSystem *mDowCalendar;
+    int mDow;
+    int mProgress;
+};
+
+#endif // STATISTICSBUILDER_H
@@ -19,49 +19,301 @@
 
 #include "statisticsmodel.h"
 #include "global.h"
+#include "storage/sqlstorage.h"
 #include <QStringList>
+#include <QtAlgorithms>
 #include <KLocale>
 #include <kio/global.h>
 
+// Orders row numbers by a precomputed sort key
+struct RowLessThan
+{
+    RowLessThan( const QVector<qint64> &keys, Qt::SortOrder order )
+        : mKeys( keys ), mOrder( order ) {}
+
+    bool operator()( int a, int b ) const
+    {
+        if ( mOrder == Qt::AscendingOrder )
+            return mKeys.at( a ) < mKeys.at( b );
+        return mKeys.at( b ) < mKeys.at( a );
+    }
+
+    const QVector<qint64> &mKeys;
+    Qt::SortOrder mOrder;
+};
+
 StatisticsModel::StatisticsModel( enum KNemoStats::PeriodUnits t, QObject *parent ) :
-    QStandardItemModel( parent ),
+    QAbstractTableModel( parent ),
     mPeriodType( t ),
-    mCalendar( 0 )
+    mCalendar( 0 ),
+    mRowSource( 0 ),
+    mOlderRows( 0 )
 {
-    QStringList headerList;
-    headerList << i18n( "Date" ) << i18n( "Sent" ) << i18n( "Received" ) << i18n( "Total" );
-    setHorizontalHeaderLabels( headerList );
-    setSortRole( DataRole );
+    mHeaderLabels << i18n( "Date" ) << i18n( "Sent" ) << i18n( "Received" ) << i18n( "Total" );
 }
 
 StatisticsModel::~StatisticsModel()
 {
 }
 
+int StatisticsModel::rowCount( const QModelIndex &parent ) const
+{
+    if ( parent.isValid() )
+        return 0;
+    return mStore.count();
+}
+
+int StatisticsModel::columnCount( const QModelIndex &parent ) const
+{
+    if ( parent.isValid() )
+        return 0;
+    return mHeaderLabels.count();
+}
+
+QVariant StatisticsModel::data( const QModelIndex &index, int role ) const
+{
+    if ( !index.isValid() || index.row() >= mStore.count() )
+        return QVariant();
+
+    int row = index.row();
+    if ( index.column() == Date )
+    {
+        switch ( role )
+        {
+            case Qt::DisplayRole:
+                return dateText( row );
+            case DataRole:
+                return mStore.dateTime( row );
+            case IdRole:
+                return mStore.id( row );
+            case SpanRole:
+                return mStore.span( row );
+            case TrafficTypeRole:
+                return mStore.trafficTypes( row );
+            default:
+                return QVariant();
+        }
+    }
+
+    if ( role == Qt::DisplayRole )
+        return KIO::convertSize( bytes( index.column(), KNemoStats::AllTraffic, row ) );
+    if ( role >= DataRole && role < DataRole + StatisticsStore::TrafficTypeCount )
+        return bytes( index.column(), role - DataRole, row );
+    return QVariant();
+}
+
+QVariant StatisticsModel::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+    if ( orientation == Qt::Horizontal && role == Qt::DisplayRole &&
+         section >= 0 && section < mHeaderLabels.count() )
+        return mHeaderLabels.at( section );
+    return QAbstractTableModel::headerData( section, orientation, role );
+}
+
+bool StatisticsModel::removeRows( int row, int count, const QModelIndex &parent )
+{
+    if ( parent.isValid() || row < 0 || count <= 0 || row + count > mStore.count() )
+        return false;
+
+    beginRemoveRows( QModelIndex(), row, row + count - 1 );
+    for ( int i = row; i < row + count; ++i )
+        forgetSaved( i );
+    mStore.remove( row, count );
+    endRemoveRows();
+    return true;
+}
+
+void StatisticsModel::sort( int column, Qt::SortOrder order )
+{
+    if ( column < 0 || column >= columnCount() )
+        return;
+
+    int count = mStore.count();
+    QVector<qint64> keys( count );
+    QVector<int> rows( count );
+    for ( int i = 0; i < count; ++i )
+    {
+        keys[ i ] = column == Date ? mStore.timeKey( i ) : bytes( column, KNemoStats::AllTraffic, i );
+        rows[ i ] = i;
+    }
+    qStableSort( rows.begin(), rows.end(), RowLessThan( keys, order ) );
+
+    emit layoutAboutToBeChanged();
+    mStore.permute( rows );
+
+    QVector<int> newRow( count );
+    for ( int i = 0; i < count; ++i )
+        newRow[ rows.at( i ) ] = i;
+    QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    foreach ( const QModelIndex &i, from )
+        to << index( newRow.at( i.row() ), i.column() );
+    changePersistentIndexList( from, to );
+    emit layoutChanged();
+}
+
+bool StatisticsModel::canFetchMore( const QModelIndex &parent ) const
+{
+    if ( parent.isValid() )
+        return false;
+    return mRowSource && mOlderRows > 0;
+}
+
+void StatisticsModel::fetchMore( const QModelIndex &parent )
+{
+    if ( canFetchMore( parent ) )
+        mRowSource->loadOlderRows( this, PageRows );
+}
+
+void StatisticsModel::clearRows()
+{
+    beginResetModel();
+    mStore.clear();
+    mOlderRows = 0;
+    mDeletedIds.clear();
+    endResetModel();
+}
+
+QDate StatisticsModel::firstDate() const
+{
+    if ( mOlderRows > 0 )
+        return mFirstDate;
+    return date( 0 );
+}
+
+void StatisticsModel::prependEntries( const StatisticsStore &older )
+{
+    if ( !older.count() )
+        return;
+
+    beginInsertRows( QModelIndex(), 0, older.count() - 1 );
+    mStore.prepend( older );
+    endInsertRows();
+}
+
+void StatisticsModel::evictRows( int count )
+{
+    if ( count <= 0 )
+        return;
+    if ( mOlderRows == 0 )
+        mFirstDate = date( 0 );
+    if ( count > rowCount() )
+        count = rowCount();
+
+    beginRemoveRows( QModelIndex(), 0, count - 1 );
+    mStore.remove( 0, count );
+    mOlderRows += count;
+    endRemoveRows();
+}
+
+void StatisticsModel::setStore( const StatisticsStore &store )
+{
+    beginResetModel();
+    mStore = store;
+    endResetModel();
+}
+
+StatisticsEntry StatisticsModel::takeEntry( int row )
+{
+    beginRemoveRows( QModelIndex(), row, row );
+    StatisticsEntry entry = mStore.entry( row );
+    forgetSaved( row );
+    mStore.remove( row );
+    endRemoveRows();
+    return entry;
+}
+
+void StatisticsModel::appendEntry( const StatisticsEntry &entry )
+{
+    beginInsertRows( QModelIndex(), mStore.count(), mStore.count() );
+    mStore.append( entry );
+    mStore.setDirty( mStore.count() - 1, typeBits( mStore.count() - 1 ) );
+    endInsertRows();
+}
+
+int StatisticsModel::typeBits( int row ) const
+{
+    int bits = 1 << KNemoStats::AllTraffic;
+    for ( int t = KNemoStats::AllTraffic + 1; t < StatisticsStore::TrafficTypeCount; ++t )
+    {
+        if ( mStore.trafficTypes( row ) & t )
+            bits |= 1 << t;
+    }
+    return bits;
+}
+
+void StatisticsModel::markDirty( int row, int bits )
+{
+    mStore.setDirty( row, mStore.dirty( row ) | bits );
+}
+
+void StatisticsModel::forgetSaved( int row )
+{
+    if ( mStore.saved( row ) )
+        mDeletedIds << mStore.id( row );
+    mStore.setSaved( row, 0 );
+    mStore.setDirty( row, typeBits( row ) );
+}
+
+int StatisticsModel::dirtyTypes( int row ) const
+{
+    return mStore.dirty( row );
+}
+
+int StatisticsModel::savedTypes( int row ) const
+{
+    return mStore.saved( row );
+}
+
+void StatisticsModel::setSaved( int row )
+{
+    mStore.setSaved( row, typeBits( row ) );
+    mStore.setDirty( row, 0 );
+}
+
+QList<int> StatisticsModel::takeDeletedIds()
+{
+    QList<int> ids = mDeletedIds;
+    mDeletedIds.clear();
+    return ids;
+}
+
 void StatisticsModel::addBytes( enum StatsColumn column, KNemoStats::TrafficType trafficType, quint64 bytes, int row )
 {
-    if ( !bytes || !rowCount() )
+    if ( !bytes || !rowCount() || trafficType >= StatisticsStore::TrafficTypeCount )
         return;
     if ( row < 0 )
         row = rowCount() - 1;
+    if ( row >= rowCount() )
+        return;
 
-    int role = DataRole + trafficType;
-
-    quint64 b = item( row, column )->data( role ).toULongLong() + bytes;
-    item( row, column )->setData( b, role );
-    if ( trafficType == KNemoStats::AllTraffic )
-        updateText( item( row, column ) );
+    if ( column == RxBytes )
+        mStore.addRx( row, trafficType, bytes );
+    else
+        mStore.addTx( row, trafficType, bytes );
+    markDirty( row, 1 << trafficType );
+    emit dataChanged( index( row, column ), index( row, TotalBytes ) );
 }
 
-quint64 StatisticsModel::bytes( enum StatsColumn column, int role, int row ) const
+quint64 StatisticsModel::bytes( int column, int trafficType, int row ) const
 {
     if ( row < 0 )
         row = rowCount() - 1;
 
-    if ( rowCount() && rowCount() > row )
-        return item( row, column )->data( role ).toULongLong();
-    else
+    if ( !rowCount() || rowCount() <= row || trafficType >= StatisticsStore::TrafficTypeCount )
         return 0;
+
+    switch ( column )
+    {
+        case TxBytes:
+            return mStore.tx( row, trafficType );
+        case RxBytes:
+            return mStore.rx( row, trafficType );
+        case TotalBytes:
+            return mStore.rx( row, trafficType ) + mStore.tx( row, trafficType );
+        default:
+            return 0;
+    }
 }
 
 QString StatisticsModel::text( StatsColumn column, int row ) const
@@ -70,47 +322,40 @@ QString StatisticsModel::text( StatsColumn column, int row ) const
         row = rowCount() - 1;
 
     if ( rowCount() && rowCount() > row )
-        return item( row, column )->data( Qt::DisplayRole ).toString();
+        return KIO::convertSize( bytes( column, KNemoStats::AllTraffic, row ) );
     else
         return QString();
 }
 
-void StatisticsModel::updateText( QStandardItem * i )
-{
-    quint64 all = i->data( DataRole ).toULongLong();
-    i->setData( KIO::convertSize( all ), Qt::DisplayRole );
-}
-
 int StatisticsModel::createEntry( const QDateTime &dateTime, int entryId, int days )
 {
-    QList<QStandardItem*> entry;
-    QStandardItem * dateItem = new QStandardItem();
-    QStandardItem * txItem = new QStandardItem();
-    QStandardItem * rxItem = new QStandardItem();
-    QStandardItem * totalItem = new QStandardItem();
-
-    dateItem->setData( dateTime, DataRole );
     if ( entryId < 0 )
     {
-        entryId = rowCount();
-    }
-    dateItem->setData( entryId, IdRole );
-    if ( days > 0 )
-    {
-        dateItem->setData( days, SpanRole );
+        entryId = mOlderRows + rowCount();
     }
-    entry << dateItem << txItem << rxItem << totalItem;
-    appendRow( entry );
-    setTraffic( rowCount() - 1, 0, 0 );
-    updateDateText( rowCount() - 1 );
+    beginInsertRows( QModelIndex(), rowCount(), rowCount() );
+    mStore.append( dateTime, entryId, days > 0 ? days : 0 );
+    mStore.setDirty( mStore.count() - 1, typeBits( mStore.count() - 1 ) );
+    endInsertRows();
     return entryId;
 }
 
 void StatisticsModel::updateDateText( int row )
 {
-    if ( row < 0 || !rowCount() || !mCalendar )
+    if ( !rowCount() || row >= rowCount() )
         return;
 
+    if ( row < 0 )
+        emit dataChanged( index( 0, Date ), index( rowCount() - 1, Date ) );
+    else
+        emit dataChanged( index( row, Date ), index( row, Date ) );
+}
+
+QString StatisticsModel::dateText( int row ) const
+{
+    if ( !mCalendar )
+        return QString();
+
     QString dateStr;
     QDateTime dt = dateTime( row );
     int dy = days( row );
@@ -151,7 +396,7 @@ void StatisticsModel::updateDateText( int row )
         default:
             dateStr = mCalendar->formatDate( dt.date(), KLocale::ShortDate );
     }
-    item( row, Date )->setData( dateStr, Qt::DisplayRole );
+    return dateStr;
 }
 
 void StatisticsModel::setId( int id, int row )
@@ -160,8 +405,12 @@ void StatisticsModel::setId( int id, int row )
         return;
     if ( row < 0 )
         row = rowCount() - 1;
+    if ( mStore.id( row ) == id )
+        return;
 
-    item( row, Date )->setData(id, IdRole );
+    // The row moves in the db, so the old one has to go
+    forgetSaved( row );
+    mStore.setId( row, id );
 }
 
 int StatisticsModel::id( int row ) const
@@ -172,7 +421,7 @@ int StatisticsModel::id( int row ) const
     if ( !rowCount() || rowCount() <= row )
         return -1;
 
-    return item( row, Date )->data( IdRole ).toInt();
+    return mStore.id( row );
 }
 
 QDateTime StatisticsModel::dateTime( int row ) const
@@ -181,7 +430,7 @@ QDateTime StatisticsModel::dateTime( int row ) const
         row = rowCount() - 1;
 
     if ( rowCount() && rowCount() > row )
-        return item( row, Date )->data( DataRole ).toDateTime();
+        return mStore.dateTime( row );
     else
         return QDateTime();
 }
@@ -200,7 +449,7 @@ int StatisticsModel::days( int row ) const
     {
         if ( mPeriodType != KNemoStats::BillPeriod )
         {
-            QDate dateTime = item( row, Date )->data( DataRole ).toDateTime().date();
+            QDate dateTime = mStore.dateTime( row ).date();
             switch ( mPeriodType )
             {
                 case KNemoStats::Day:
@@ -221,7 +470,7 @@ int StatisticsModel::days( int row ) const
         }
         else
         {
-            return item( row, Date )->data( SpanRole ).toInt();
+            return mStore.span( row );
         }
     }
     else
@@ -234,8 +483,8 @@ void StatisticsModel::addTrafficType( int trafficType, int row )
         row = rowCount() - 1;
     if ( rowCount() && rowCount() > row )
     {
-        int types = item( row, Date )->data( TrafficTypeRole ).toInt();
-        item( row, Date )->setData( types | trafficType, TrafficTypeRole );
+        mStore.setTrafficTypes( row, mStore.trafficTypes( row ) | trafficType );
+        markDirty( row, 1 << trafficType );
     }
 }
 
@@ -244,7 +493,11 @@ void StatisticsModel::resetTrafficTypes( int row )
     if ( row < 0 )
         row = rowCount() - 1;
     if ( rowCount() && rowCount() > row )
-        item( row, Date )->setData( KNemoStats::AllTraffic, TrafficTypeRole );
+    {
+        // Dropped types may have rows in the db to delete
+        markDirty( row, typeBits( row ) );
+        mStore.setTrafficTypes( row, KNemoStats::AllTraffic );
+    }
 }
 
 QList<KNemoStats::TrafficType> StatisticsModel::trafficTypes( int row ) const
@@ -255,7 +508,7 @@ QList<KNemoStats::TrafficType> StatisticsModel::trafficTypes( int row ) const
     typeList << KNemoStats::AllTraffic;
     if ( rowCount() && rowCount() > row )
     {
-       int types = item( row, Date )->data( TrafficTypeRole ).toInt();
+       int types = mStore.trafficTypes( row );
        if ( types & KNemoStats::OffpeakTraffic )
            typeList << KNemoStats::OffpeakTraffic;
     }
@@ -264,17 +517,17 @@ QList<KNemoStats::TrafficType> StatisticsModel::trafficTypes( int row ) const
 
 quint64 StatisticsModel::rxBytes( int row, KNemoStats::TrafficType trafficType ) const
 {
-    return bytes( RxBytes, DataRole+trafficType, row );
+    return bytes( RxBytes, trafficType, row );
 }
 
 quint64 StatisticsModel::txBytes( int row, KNemoStats::TrafficType trafficType ) const
 {
-    return bytes( TxBytes, DataRole+trafficType, row );
+    return bytes( TxBytes, trafficType, row );
 }
 
 quint64 StatisticsModel::totalBytes( int row, KNemoStats::TrafficType trafficType ) const
 {
-    return bytes( TotalBytes, DataRole+trafficType, row );
+    return bytes( TotalBytes, trafficType, row );
 }
 
 QString StatisticsModel::txText( int row ) const
@@ -295,41 +548,26 @@ QString StatisticsModel::totalText( int row ) const
 void StatisticsModel::addRxBytes( quint64 bytes, KNemoStats::TrafficType trafficType, int row )
 {
     addBytes( RxBytes, trafficType, bytes, row );
-    addBytes( TotalBytes, trafficType, bytes, row );
 }
 
 void StatisticsModel::addTxBytes( quint64 bytes, KNemoStats::TrafficType trafficType, int row )
 {
     addBytes( TxBytes, trafficType, bytes, row );
-    addBytes( TotalBytes, trafficType, bytes, row );
 }
 
 int StatisticsModel::indexOfId( int id ) const
 {
-    int index = 0;
-    while ( index < rowCount() )
-    {
-        if ( item( index, Date )->data( IdRole ).toInt() == id )
-            return index;
-        index++;
-    }
-    return -1;
+    return mStore.indexOfId( id );
 }
 
 void StatisticsModel::setTraffic( int row, quint64 rx, quint64 tx, KNemoStats::TrafficType trafficType )
 {
-    if ( row < 0 || row >= rowCount() )
+    if ( row < 0 || row >= rowCount() || trafficType >= StatisticsStore::TrafficTypeCount )
         return;
 
-    item( row, RxBytes )->setData( rx, DataRole + trafficType );
-    item( row, TxBytes )->setData( tx, DataRole + trafficType );
-    item( row, TotalBytes )->setData( rx+tx, DataRole + trafficType );
-    if ( trafficType == KNemoStats::AllTraffic )
-    {
-        updateText( item( row, RxBytes ) );
-        updateText( item( row, TxBytes ) );
-        updateText( item( row, TotalBytes ) );
-    }
+    mStore.setTraffic( row, trafficType, rx, tx );
+    markDirty( row, 1 << trafficType );
+    emit dataChanged( index( row, TxBytes ), index( row, TotalBytes ) );
 }
 
 #include "statisticsmodel.moc"
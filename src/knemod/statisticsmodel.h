@@ -20,12 +20,23 @@
 #ifndef STATISTICSMODEL_H
 #define STATISTICSMODEL_H
 
+#include <QAbstractTableModel>
 #include <QDate>
-#include <QStandardItemModel>
+#include <QStringList>
 #include <KCalendarSystem>
 #include "data.h"
+#include "statisticsstore.h"
 
-class StatisticsModel : public QStandardItemModel
+class SqlStorage;
+
+/**
+ * Table model of one statistics period.  The entries live in a
+ * StatisticsStore; display text is only formatted when a view asks for it.
+ *
+ * The model may hold only the newest rows of a period.  Older ones stay in
+ * the db until a view scrolls to them, a page at a time.
+ */
+class StatisticsModel : public QAbstractTableModel
 {
     Q_OBJECT
 public:
@@ -40,16 +51,71 @@ public:
         DataRole
     };
 
+    // Rows fetched at a time, and the fewest rows kept in memory
+    enum { PageRows = 64 };
+
+    virtual int rowCount( const QModelIndex &parent = QModelIndex() ) const;
+    virtual int columnCount( const QModelIndex &parent = QModelIndex() ) const;
+    virtual QVariant data( const QModelIndex &index, int role = Qt::DisplayRole ) const;
+    virtual QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const;
+    virtual bool removeRows( int row, int count, const QModelIndex &parent = QModelIndex() );
+    /**
+     * Sort the rows by the DataRole of column.
+     */
+    virtual void sort( int column, Qt::SortOrder order = Qt::AscendingOrder );
+    virtual bool canFetchMore( const QModelIndex &parent ) const;
+    virtual void fetchMore( const QModelIndex &parent );
+
     /**
      * Clear rows
      */
-    void clearRows() { removeRows( 0, rowCount() ); }
+    void clearRows();
+
+    /**
+     * Remove a row and return its contents, e.g. to move it to another model.
+     */
+    StatisticsEntry takeEntry( int row );
+    void appendEntry( const StatisticsEntry &entry );
+
+    /**
+     * The entries of the model.  Copies are cheap, so this is how a snapshot
+     * is taken.  setStore() replaces all entries at once.
+     */
+    const StatisticsStore &store() const { return mStore; }
+    void setStore( const StatisticsStore &store );
+
+    /**
+     * Where fetchMore() gets the rows that aren't loaded yet.
+     */
+    void setRowSource( SqlStorage *source ) { mRowSource = source; }
 
     /**
-     * Update the text in the date cell.  Handy after a rebuild or if a fancy
-     * short date changes.
+     * The number of rows before the first row that are still in the db.
      */
-    void updateDateText( int row );
+    int olderRows() const { return mOlderRows; }
+    void setOlderRows( int count ) { mOlderRows = count; }
+
+    /**
+     * The date of the first entry, even if it isn't loaded.
+     */
+    QDate firstDate() const;
+    void setFirstDate( const QDate &date ) { mFirstDate = date; }
+
+    /**
+     * Insert older entries before the first row.
+     */
+    void prependEntries( const StatisticsStore &older );
+
+    /**
+     * Drop the count oldest rows from memory.  They must have been saved.
+     */
+    void evictRows( int count );
+
+    /**
+     * Tell views to redraw the date cell.  Handy after a rebuild or if a
+     * fancy short date changes.  If row < 0 it will redraw all of them.
+     */
+    void updateDateText( int row = -1 );
 
     /**
      * Return the type of statistics that this model is tracking
@@ -64,7 +130,7 @@ public:
 
     /**
      * Creates a stats entry for the model.  If id < 0 it will create an id
-     * that matches rowCount().  If days > 0 it will set a period of length
+     * that matches olderRows() + rowCount().  If days > 0 it will set a period of length
      * 'days'.  The latter is relevant only for custom billing periods.
      */
 
@@ -119,8 +185,9 @@ public:
 
     /**
      * Return the index of the given id.  An invalid id will return -1.
+     * This is O(log n) while ids ascend with the rows.
      */
-    int indexOfId( int row ) const;
+    int indexOfId( int id ) const;
 
     /**
      * These return the rx, tx, total bytes for the entry in row 'row'.  If row
@@ -150,6 +217,24 @@ public:
     void addRxBytes( quint64 bytes, KNemoStats::TrafficType trafficType = KNemoStats::AllTraffic, int row = -1 );
     void addTxBytes( quint64 bytes, KNemoStats::TrafficType trafficType = KNemoStats::AllTraffic, int row = -1 );
 
+    /**
+     * The traffic types of a row that changed since it was last saved, and
+     * the ones that have a row in the db, as bits of ( 1 << trafficType ).
+     */
+    int dirtyTypes( int row ) const;
+    int savedTypes( int row ) const;
+
+    /**
+     * Record that a row was written to the db as it is now.
+     */
+    void setSaved( int row );
+
+    /**
+     * Ids whose rows in the db were removed or renumbered here since the
+     * last call.
+     */
+    QList<int> takeDeletedIds();
+
 private:
     enum StatsColumn
     {
@@ -160,12 +245,21 @@ private:
     };
 
     void addBytes( enum StatsColumn column, KNemoStats::TrafficType trafficType, quint64 bytes, int row = -1 );
-    quint64 bytes( enum StatsColumn column, int role, int row ) const;
+    quint64 bytes( int column, int trafficType, int row ) const;
     QString text( enum StatsColumn column, int row ) const;
-    void updateText( QStandardItem * i );
+    QString dateText( int row ) const;
+    int typeBits( int row ) const;
+    void markDirty( int row, int bits );
+    void forgetSaved( int row );
 
     enum KNemoStats::PeriodUnits mPeriodType;
     const KCalendarSystem * mCalendar;
+    StatisticsStore mStore;
+    SqlStorage * mRowSource;
+    int mOlderRows;
+    QDate mFirstDate;
+    QList<int> mDeletedIds;
+    QStringList mHeaderLabels;
 };
 
 #endif
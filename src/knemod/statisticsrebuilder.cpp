@@ -0,0 +1,143 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "statisticsbuilder.h"
+#include "statisticsmodel.h"
+#include "statisticsrebuilder.h"
+#include "storage/sqlstorage.h"
+#include "storage/storageworker.h"
+
+class RebuildBuilder : public StatisticsBuilder
+{
+public:
+    RebuildBuilder( StatisticsRebuilder *rebuilder, QHash<int, StatisticsModel*> &models,
+                    StorageData &storageData, QList<StatsRule> &statsRules, SqlStorage *sql )
+        : StatisticsBuilder( models, storageData, statsRules, sql ),
+          mRebuilder( rebuilder )
+    {
+    }
+
+protected:
+    virtual bool rebuildProgress( int percent )
+    {
+        return mRebuilder->reportProgress( percent );
+    }
+
+private:
+    StatisticsRebuilder *mRebuilder;
+};
+
+// Connections can't be shared between threads, and an older rebuild may
+// still be winding down when a new one starts.
+static QAtomicInt connectionSerial;
+
+StatisticsRebuilder::StatisticsRebuilder( const QString &ifaceName, const QHash<int, StatisticsModel*> &models,
+                                          const StorageData &storageData, const QList<StatsRule> &oldRules,
+                                          const QList<StatsRule> &newRules, bool force, bool forceWeek,
+                                          StorageWorker *worker, quint64 barrier, QObject *parent )
+    : QThread( parent ),
+      mIfaceName( ifaceName ),
+      mStorageData( storageData ),
+      mOldRules( oldRules ),
+      mNewRules( newRules ),
+      mForce( force ),
+      mForceWeek( forceWeek ),
+      mWorker( worker ),
+      mBarrier( barrier ),
+      mRebuilt( false ),
+      mCancelled( 0 )
+{
+    // The stores are implicitly shared, so this doesn't copy any rows yet
+    foreach ( StatisticsModel *s, models )
+    {
+        mStores.insert( s->periodType(), s->store() );
+        mOlderRows.insert( s->periodType(), s->olderRows() );
+    }
+}
+
+StatisticsRebuilder::~StatisticsRebuilder()
+{
+}
+
+void StatisticsRebuilder::cancel()
+{
+    mCancelled.fetchAndStoreOrdered( 1 );
+}
+
+bool StatisticsRebuilder::isCancelled() const
+{
+    return mCancelled != 0;
+}
+
+bool StatisticsRebuilder::reportProgress( int percent )
+{
+    emit progress( percent );
+    return !isCancelled();
+}
+
+void StatisticsRebuilder::run()
+{
+    // Once the barrier is written the db has every archived hour of the
+    // snapshot.  If writes fail they stay in the snapshot instead.
+    bool archived = false;
+    while ( !isCancelled() )
+    {
+        archived = mWorker->waitWritten( mIfaceName, mBarrier, 250 );
+        if ( archived || mWorker->isFailing() )
+            break;
+    }
+    if ( isCancelled() )
+        return;
+
+    QString connectionName = QString( "%1_rebuild_%2" ).arg( mIfaceName ).arg( connectionSerial.fetchAndAddOrdered( 1 ) );
+    // The connection goes away with sql
+    SqlStorage sql( mIfaceName, connectionName );
+
+    // Created here, so they belong to this thread
+    QHash<int, StatisticsModel*> models;
+    foreach ( int type, mStores.keys() )
+    {
+        StatisticsModel *s = new StatisticsModel( type );
+        s->setCalendar( mStorageData.calendar );
+        s->setStore( mStores.value( type ) );
+        s->setOlderRows( mOlderRows.value( type ) );
+        if ( type == KNemoStats::HourArchive && archived )
+        {
+            s->evictRows( s->rowCount() );
+            s->setOlderRows( 0 );
+        }
+        // A rebuild walks the whole history, not just what is in memory
+        if ( s->olderRows() > 0 )
+            sql.loadOlderRows( s, -1 );
+        models.insert( type, s );
+    }
+
+    RebuildBuilder builder( this, models, mStorageData, mOldRules, &sql );
+    if ( !builder.rebuild( mNewRules, mForce, mForceWeek, &mRebuilt ) )
+        cancel();
+
+    foreach ( StatisticsModel *s, models )
+    {
+        mStores.insert( s->periodType(), s->store() );
+        mOlderRows.insert( s->periodType(), s->olderRows() );
+    }
+    qDeleteAll( models );
+}
+
+#include "statisticsrebuilder.moc"
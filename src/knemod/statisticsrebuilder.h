@@ -0,0 +1,98 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef STATISTICSREBUILDER_H
+#define STATISTICSREBUILDER_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QThread>
+
+#include "data.h"
+#include "statisticsstore.h"
+#include "storage/storagedata.h"
+
+class StatisticsModel;
+class StorageWorker;
+
+/**
+ * Rebuilds statistics in a thread of its own.  It works on a snapshot of
+ * the models taken when it is created, so the live models keep counting
+ * while it runs.  Once it has finished the owner swaps the results in.
+ *
+ * Only the stores cross threads.  The models the rebuild works on are
+ * created and deleted in run().
+ *
+ * The archived hours are read back from the db, so run() first waits for
+ * the worker to write the save with the serial given as barrier.
+ *
+ * @short Background rebuild of statistics
+ */
+
+class StatisticsRebuilder : public QThread
+{
+    Q_OBJECT
+public:
+    StatisticsRebuilder( const QString &ifaceName, const QHash<int, StatisticsModel*> &models,
+                         const StorageData &storageData, const QList<StatsRule> &oldRules,
+                         const QList<StatsRule> &newRules, bool force, bool forceWeek,
+                         StorageWorker *worker, quint64 barrier, QObject *parent = 0 );
+    virtual ~StatisticsRebuilder();
+
+    /**
+     * Ask a running rebuild to stop as soon as possible.
+     */
+    void cancel();
+    bool isCancelled() const;
+
+    /**
+     * These are only meaningful after the thread finished uncancelled.
+     * rebuilt() tells whether any entries changed.
+     */
+    bool rebuilt() const { return mRebuilt; }
+    StatisticsStore store( int periodType ) const { return mStores.value( periodType ); }
+    int olderRows( int periodType ) const { return mOlderRows.value( periodType ); }
+    const StorageData &storageData() const { return mStorageData; }
+    const QList<StatsRule> &newRules() const { return mNewRules; }
+
+signals:
+    void progress( int percent );
+
+protected:
+    virtual void run();
+
+private:
+    bool reportProgress( int percent );
+
+    QString mIfaceName;
+    // The snapshot going in, and the results coming out
+    QHash<int, StatisticsStore> mStores;
+    QHash<int, int> mOlderRows;
+    StorageData mStorageData;
+    QList<StatsRule> mOldRules;
+    QList<StatsRule> mNewRules;
+    bool mForce;
+    bool mForceWeek;
+    StorageWorker *mWorker;
+    quint64 mBarrier;
+    bool mRebuilt;
+    QAtomicInt mCancelled;
+};
+
+#endif // STATISTICSREBUILDER_H
@@ -0,0 +1,219 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QtAlgorithms>
+
+#include "statisticsstore.h"
+
+StatisticsEntry::StatisticsEntry()
+    : julianDay( 0 ),
+      seconds( 0 ),
+      id( 0 ),
+      span( 0 ),
+      trafficTypes( KNemoStats::AllTraffic )
+{
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        rx[ i ] = 0;
+        tx[ i ] = 0;
+    }
+}
+
+StatisticsStore::StatisticsStore()
+    : mIdOrder( IdsAscending )
+{
+}
+
+void StatisticsStore::clear()
+{
+    mIdOrder = IdsAscending;
+    mJulianDays.clear();
+    mSeconds.clear();
+    mIds.clear();
+    mSpans.clear();
+    mTrafficTypes.clear();
+    mDirty.clear();
+    mSaved.clear();
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        mRx[ i ].clear();
+        mTx[ i ].clear();
+    }
+}
+
+void StatisticsStore::append( const QDateTime &dateTime, int id, int span )
+{
+    StatisticsEntry entry;
+    entry.julianDay = dateTime.date().toJulianDay();
+    entry.seconds = QTime( 0, 0 ).secsTo( dateTime.time() );
+    entry.id = id;
+    entry.span = span;
+    append( entry );
+}
+
+void StatisticsStore::append( const StatisticsEntry &entry )
+{
+    if ( mIdOrder == IdsAscending && !mIds.isEmpty() && mIds.last() >= entry.id )
+        mIdOrder = IdsUnordered;
+    mJulianDays.append( entry.julianDay );
+    mSeconds.append( entry.seconds );
+    mIds.append( entry.id );
+    mSpans.append( entry.span );
+    mTrafficTypes.append( entry.trafficTypes );
+    mDirty.append( 0 );
+    mSaved.append( 0 );
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        mRx[ i ].append( entry.rx[ i ] );
+        mTx[ i ].append( entry.tx[ i ] );
+    }
+}
+
+template <class T> void StatisticsStore::prependColumn( QVector<T> &column, const QVector<T> &older )
+{
+    column = older + column;
+}
+
+void StatisticsStore::prepend( const StatisticsStore &older )
+{
+    if ( !older.count() )
+        return;
+    if ( mIdOrder == IdsAscending &&
+         ( !older.idsAscending() || ( count() && older.mIds.last() >= mIds.first() ) ) )
+        mIdOrder = IdsUnordered;
+    prependColumn( mJulianDays, older.mJulianDays );
+    prependColumn( mSeconds, older.mSeconds );
+    prependColumn( mIds, older.mIds );
+    prependColumn( mSpans, older.mSpans );
+    prependColumn( mTrafficTypes, older.mTrafficTypes );
+    prependColumn( mDirty, older.mDirty );
+    prependColumn( mSaved, older.mSaved );
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        prependColumn( mRx[ i ], older.mRx[ i ] );
+        prependColumn( mTx[ i ], older.mTx[ i ] );
+    }
+}
+
+StatisticsEntry StatisticsStore::entry( int row ) const
+{
+    StatisticsEntry entry;
+    entry.julianDay = mJulianDays.at( row );
+    entry.seconds = mSeconds.at( row );
+    entry.id = mIds.at( row );
+    entry.span = mSpans.at( row );
+    entry.trafficTypes = mTrafficTypes.at( row );
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        entry.rx[ i ] = mRx[ i ].at( row );
+        entry.tx[ i ] = mTx[ i ].at( row );
+    }
+    return entry;
+}
+
+void StatisticsStore::remove( int row, int count )
+{
+    // Removing rows can't break an ascending order, but it might fix an
+    // unordered one.
+    if ( mIdOrder == IdsUnordered )
+        mIdOrder = IdOrderUnknown;
+    mJulianDays.remove( row, count );
+    mSeconds.remove( row, count );
+    mIds.remove( row, count );
+    mSpans.remove( row, count );
+    mTrafficTypes.remove( row, count );
+    mDirty.remove( row, count );
+    mSaved.remove( row, count );
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        mRx[ i ].remove( row, count );
+        mTx[ i ].remove( row, count );
+    }
+}
+
+template <class T> void StatisticsStore::permuteColumn( QVector<T> &column, const QVector<int> &order )
+{
+    QVector<T> sorted( column.count() );
+    for ( int i = 0; i < order.count(); ++i )
+        sorted[ i ] = column.at( order.at( i ) );
+    column = sorted;
+}
+
+void StatisticsStore::permute( const QVector<int> &order )
+{
+    mIdOrder = IdOrderUnknown;
+    permuteColumn( mJulianDays, order );
+    permuteColumn( mSeconds, order );
+    permuteColumn( mIds, order );
+    permuteColumn( mSpans, order );
+    permuteColumn( mTrafficTypes, order );
+    permuteColumn( mDirty, order );
+    permuteColumn( mSaved, order );
+    for ( int i = 0; i < TrafficTypeCount; ++i )
+    {
+        permuteColumn( mRx[ i ], order );
+        permuteColumn( mTx[ i ], order );
+    }
+}
+
+void StatisticsStore::setId( int row, int id )
+{
+    mIds[ row ] = id;
+    // Renumbering the last row is common, so check that cheaply
+    if ( mIdOrder == IdsAscending && row == mIds.count() - 1 )
+    {
+        if ( row > 0 && mIds.at( row - 1 ) >= id )
+            mIdOrder = IdsUnordered;
+    }
+    else
+        mIdOrder = IdOrderUnknown;
+}
+
+bool StatisticsStore::idsAscending() const
+{
+    if ( mIdOrder == IdOrderUnknown )
+    {
+        mIdOrder = IdsAscending;
+        for ( int i = 1; i < mIds.count(); ++i )
+        {
+            if ( mIds.at( i - 1 ) >= mIds.at( i ) )
+            {
+                mIdOrder = IdsUnordered;
+                break;
+            }
+        }
+    }
+    return mIdOrder == IdsAscending;
+}
+
+int StatisticsStore::indexOfId( int id ) const
+{
+    if ( idsAscending() )
+    {
+        QVector<int>::const_iterator i = qBinaryFind( mIds.constBegin(), mIds.constEnd(), id );
+        return i == mIds.constEnd() ? -1 : i - mIds.constBegin();
+    }
+    return mIds.indexOf( id );
+}
+
+QDateTime StatisticsStore::dateTime( int row ) const
+{
+    return QDateTime( QDate::fromJulianDay( mJulianDays.at( row ) ),
+                      QTime( 0, 0 ).addSecs( mSeconds.at( row ) ) );
+}
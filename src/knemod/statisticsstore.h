@@ -0,0 +1,140 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef STATISTICSSTORE_H
+#define STATISTICSSTORE_H
+
+#include <QDateTime>
+#include <QVector>
+#include "data.h"
+
+/**
+ * A single statistics entry, used to move rows between stores.
+ */
+struct StatisticsEntry
+{
+    enum { TrafficTypeCount = KNemoStats::OffpeakTraffic + 1 };
+
+    StatisticsEntry();
+
+    int julianDay;
+    int seconds;
+    int id;
+    int span;
+    int trafficTypes;
+    quint64 rx[ TrafficTypeCount ];
+    quint64 tx[ TrafficTypeCount ];
+};
+
+/**
+ * Keeps the entries of one statistics period as parallel arrays, one per
+ * field, instead of one object per cell.  The start of an entry is kept as
+ * a julian day plus seconds since midnight in local time.  Totals are not
+ * stored, they are always rx + tx.
+ */
+class StatisticsStore
+{
+public:
+    enum { TrafficTypeCount = StatisticsEntry::TrafficTypeCount };
+
+    StatisticsStore();
+
+    int count() const { return mIds.count(); }
+    void clear();
+
+    void append( const QDateTime &dateTime, int id, int span );
+    void append( const StatisticsEntry &entry );
+    /**
+     * Insert the rows of older before the first row.
+     */
+    void prepend( const StatisticsStore &older );
+    StatisticsEntry entry( int row ) const;
+    void remove( int row, int count = 1 );
+
+    /**
+     * Reorder the rows so that new row i is old row order[i].
+     */
+    void permute( const QVector<int> &order );
+
+    QDateTime dateTime( int row ) const;
+    /**
+     * Seconds since julian day 0, for cheap comparisons.
+     */
+    qint64 timeKey( int row ) const
+    {
+        return static_cast<qint64>(mJulianDays.at( row )) * 86400 + mSeconds.at( row );
+    }
+
+    int id( int row ) const { return mIds.at( row ); }
+    void setId( int row, int id );
+    /**
+     * Return the row of an id, or -1.  This is a binary search as long as
+     * the ids ascend, which they normally do.
+     */
+    int indexOfId( int id ) const;
+    int span( int row ) const { return mSpans.at( row ); }
+    int trafficTypes( int row ) const { return mTrafficTypes.at( row ); }
+    void setTrafficTypes( int row, int types ) { mTrafficTypes[ row ] = types; }
+
+    /**
+     * Save state of a row, as bits of ( 1 << trafficType ).  Dirty traffic
+     * changed since the last save; saved traffic has a row in the db.  New
+     * rows start out as neither.
+     */
+    int dirty( int row ) const { return mDirty.at( row ); }
+    void setDirty( int row, int bits ) { mDirty[ row ] = bits; }
+    int saved( int row ) const { return mSaved.at( row ); }
+    void setSaved( int row, int bits ) { mSaved[ row ] = bits; }
+
+    quint64 rx( int row, int trafficType ) const { return mRx[ trafficType ].at( row ); }
+    quint64 tx( int row, int trafficType ) const { return mTx[ trafficType ].at( row ); }
+    void addRx( int row, int trafficType, quint64 bytes ) { mRx[ trafficType ][ row ] += bytes; }
+    void addTx( int row, int trafficType, quint64 bytes ) { mTx[ trafficType ][ row ] += bytes; }
+    void setTraffic( int row, int trafficType, quint64 rx, quint64 tx )
+    {
+        mRx[ trafficType ][ row ] = rx;
+        mTx[ trafficType ][ row ] = tx;
+    }
+
+private:
+    template <class T> static void prependColumn( QVector<T> &column, const QVector<T> &older );
+    template <class T> static void permuteColumn( QVector<T> &column, const QVector<int> &order );
+    bool idsAscending() const;
+
+    QVector<int> mJulianDays;
+    QVector<int> mSeconds;
+    QVector<int> mIds;
+    QVector<int> mSpans;
+    QVector<int> mTrafficTypes;
+    QVector<int> mDirty;
+    QVector<int> mSaved;
+    QVector<quint64> mRx[ TrafficTypeCount ];
+    QVector<quint64> mTx[ TrafficTypeCount ];
+
+    enum IdOrder
+    {
+        IdOrderUnknown = 0,
+        IdsAscending,
+        IdsUnordered
+    };
+    // Checked lazily after changes that could break the order
+    mutable IdOrder mIdOrder;
+};
+
+#endif
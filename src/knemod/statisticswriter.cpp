@@ -0,0 +1,89 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QTimer>
+
+#include "global.h"
+#include "interfacestatistics.h"
+#include "statisticswriter.h"
+#include "storage/storageworker.h"
+
+// Exists while any interface saves to the shared db
+static StatisticsWriter *writer = 0;
+
+StatisticsWriter::StatisticsWriter()
+    : QObject(),
+      mTimer( new QTimer( this ) ),
+      mWorker( new StorageWorker( SqlStorage::SharedFile ) )
+{
+    connect( mTimer, SIGNAL( timeout() ), this, SLOT( flush() ) );
+    mWorker->start();
+}
+
+StatisticsWriter::~StatisticsWriter()
+{
+    // Writes what is still queued first
+    delete mWorker;
+}
+
+StorageWorker *StatisticsWriter::add( InterfaceStatistics *statistics )
+{
+    if ( !writer )
+    {
+        writer = new StatisticsWriter();
+        setSaveInterval( generalSettings->saveInterval );
+    }
+    if ( !writer->mStatistics.contains( statistics ) )
+        writer->mStatistics.append( statistics );
+    return writer->mWorker;
+}
+
+void StatisticsWriter::remove( InterfaceStatistics *statistics )
+{
+    if ( !writer )
+        return;
+    writer->mStatistics.removeAll( statistics );
+    if ( writer->mStatistics.isEmpty() )
+    {
+        delete writer;
+        writer = 0;
+    }
+}
+
+void StatisticsWriter::setSaveInterval( int seconds )
+{
+    if ( !writer )
+        return;
+    writer->mTimer->stop();
+    if ( seconds > 0 )
+    {
+        writer->mTimer->setInterval( seconds * 1000 );
+        writer->mTimer->start();
+    }
+}
+
+void StatisticsWriter::flush()
+{
+    QList<StatisticsChangeSet> batch;
+    foreach ( InterfaceStatistics *statistics, mStatistics )
+        batch << statistics->takeChanges();
+    mWorker->enqueue( batch );
+}
+
+#include "statisticswriter.moc"
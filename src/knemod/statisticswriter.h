@@ -0,0 +1,65 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef STATISTICSWRITER_H
+#define STATISTICSWRITER_H
+
+#include <QList>
+#include <QObject>
+
+class QTimer;
+class InterfaceStatistics;
+class StorageWorker;
+
+/**
+ * With a shared statistics db, this saves the statistics of all interfaces
+ * on one timer instead of each interface on its own.  A flush is a single
+ * transaction, so the db syncs once per flush however many interfaces
+ * there are.  It is written by one StorageWorker for all interfaces.
+ *
+ * @short Coalesced saving of statistics in a shared db
+ */
+
+class StatisticsWriter : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * Returns the worker that writes the shared db.
+     */
+    static StorageWorker *add( InterfaceStatistics *statistics );
+    static void remove( InterfaceStatistics *statistics );
+    /**
+     * Save every seconds seconds, or only on demand if it is 0.
+     */
+    static void setSaveInterval( int seconds );
+
+private slots:
+    void flush();
+
+private:
+    StatisticsWriter();
+    virtual ~StatisticsWriter();
+
+    QTimer *mTimer;
+    StorageWorker *mWorker;
+    QList<InterfaceStatistics*> mStatistics;
+};
+
+#endif // STATISTICSWRITER_H
@@ -20,4 +20,6 @@
 // This must match number and order of KNemoStats::PeriodUnits
 static const QStringList periods = (QStringList() << "hour" << "day" << "week" << "month" << "bill_period" << "year" << "hour_archive");
 static const char statistics_prefix[] = "statistics_";
+// Holds the statistics of all interfaces when they share one db
+static const char shared_statistics_file[] = "statistics.db";
 
@@ -21,49 +21,196 @@
 #include "statisticsmodel.h"
 #include "sqlstorage.h"
 #include "commonstorage.h"
+#include "storageworker.h"
 
 #include <QFile>
+#include <QMutex>
 #include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlRecord>
 #include <KMessageBox>
 
 static const QString time_format( "hh:mm:ss" );
 
-static const int current_db_version = 2;
+static const int current_db_version = 3;
 
-SqlStorage::SqlStorage( QString ifaceName )
+// The main connection to a shared db is used by every interface
+static const QString shared_connection( "knemo_statistics" );
+// How many SqlStorages use each connection.  Rebuilds and writers open
+// theirs from other threads.
+static QMutex connectionMutex;
+static QHash<QString, int> connectionUsers;
+
+// Julian day of 1970-01-01
+static const qint64 unix_epoch_day = 2440588;
+
+// Entry times are stored as seconds since the epoch on the local wall
+// clock, which is what the ISO strings of older versions held.  Leaving
+// the UTC offset out keeps entries from shifting when DST starts or ends.
+static qint64 toDbTime( const QDateTime &dateTime )
+{
+    return ( dateTime.date().toJulianDay() - unix_epoch_day ) * 86400 +
+           QTime( 0, 0 ).secsTo( dateTime.time() );
+}
+
+static QDateTime fromDbTime( qint64 secs )
+{
+    qint64 days = secs / 86400;
+    int rem = secs % 86400;
+    if ( rem < 0 )
+    {
+        rem += 86400;
+        --days;
+    }
+    return QDateTime( QDate::fromJulianDay( unix_epoch_day + days ), QTime( 0, 0 ).addSecs( rem ) );
+}
+
+// A null reads as 0, which is what an untracked off-peak column means
+static QVariant offpeakValue( const StatisticsModel *s, int row, quint64 bytes )
+{
+    if ( s->trafficTypes( row ).contains( KNemoStats::OffpeakTraffic ) )
+        return bytes;
+    return QVariant( QVariant::ULongLong );
+}
+
+SqlStorage::SqlStorage( QString ifaceName, QString connectionName, Layout layout )
     : mValidDbVer( true )
     , mIfaceName( ifaceName )
 {
+    if ( layout == ConfiguredLayout )
+        layout = generalSettings->sharedStatistics ? SharedFile : InterfaceFile;
+
     KUrl dir( generalSettings->statisticsDir );
-    mDbPath = QString( "%1%2%3.db" ).arg( dir.path() ).arg( statistics_prefix ).arg( mIfaceName );
+    if ( layout == SharedFile )
+    {
+        mDbPath = dir.path() + shared_statistics_file;
+        mTablePrefix = mIfaceName + "_";
+        mConnectionName = connectionName.isEmpty() ? shared_connection : connectionName;
+    }
+    else
+    {
+        mDbPath = QString( "%1%2%3.db" ).arg( dir.path() ).arg( statistics_prefix ).arg( mIfaceName );
+        mConnectionName = connectionName.isEmpty() ? ifaceName : connectionName;
+    }
+
     QStringList drivers = QSqlDatabase::drivers();
     if ( drivers.contains( "QSQLITE" ) )
-        db = QSqlDatabase::addDatabase( "QSQLITE", mIfaceName );
-    mTypeMap.insert( KNemoStats::AllTraffic, "" );
-    mTypeMap.insert( KNemoStats::OffpeakTraffic, "_offpeak" );
+    {
+        QMutexLocker locker( &connectionMutex );
+        if ( QSqlDatabase::contains( mConnectionName ) )
+            db = QSqlDatabase::database( mConnectionName, false );
+        else
+            db = QSqlDatabase::addDatabase( "QSQLITE", mConnectionName );
+        ++connectionUsers[ mConnectionName ];
+    }
+
+    // Extra connections leave setting up the db to the main one
+    if ( !connectionName.isEmpty() )
+        return;
+
+    if ( isShared() && !dbExists() )
+        importInterfaceFile();
 
     if ( dbExists() && open() )
     {
         // KNemo 0.7.4 didn't create tables on a new db.  This lets us fix it
         // without forcing the user to intervene.
-        if ( db.tables().isEmpty() )
-            createDb();
-        else
+        if ( db.tables().contains( tableName( "general" ) ) )
             migrateDb();
+        else
+            createDb();
     }
 }
 
 SqlStorage::~SqlStorage()
 {
+    mQueries.clear();
+    if ( !db.isValid() )
+        return;
+
+    QMutexLocker locker( &connectionMutex );
+    // Other SqlStorages still use the connection
+    if ( --connectionUsers[ mConnectionName ] > 0 )
+        return;
+
+    connectionUsers.remove( mConnectionName );
     db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase( mConnectionName );
 }
 
 bool SqlStorage::dbExists()
 {
-    QFile dbfile( mDbPath );
-    return dbfile.exists();
+    if ( !QFile::exists( mDbPath ) )
+        return false;
+    if ( !isShared() )
+        return true;
+    return open() && db.tables().contains( tableName( "general" ) );
+}
+
+QString SqlStorage::tableName( const QString &name ) const
+{
+    return mTablePrefix + name;
+}
+
+QString SqlStorage::table( const QString &name ) const
+{
+    QString quoted = tableName( name );
+    quoted.replace( '"', "\"\"" );
+    return QString( "\"%1\"" ).arg( quoted );
+}
+
+QString SqlStorage::periodTable( int periodType ) const
+{
+    return table( periods.at( periodType ) + "s" );
+}
+
+// Copy the statistics_<iface>.db of an interface into the shared db.  The
+// file is upgraded to the current version first, so its tables match, but
+// it isn't removed.  Going back to a file per interface still finds it,
+// if not up to date.
+void SqlStorage::importInterfaceFile()
+{
+    KUrl dir( generalSettings->statisticsDir );
+    QString path = QString( "%1%2%3.db" ).arg( dir.path() ).arg( statistics_prefix ).arg( mIfaceName );
+    if ( !QFile::exists( path ) )
+        return;
+
+    {
+        // Bring the file up to the current version, so its tables match
+        SqlStorage file( mIfaceName, QString(), InterfaceFile );
+        if ( !file.mValidDbVer || !file.dbExists() )
+            return;
+    }
+
+    if ( !open() )
+        return;
+
+    QSqlQuery qry( db );
+    qry.prepare( "ATTACH DATABASE ? AS iface_file;" );
+    qry.addBindValue( path );
+    if ( !qry.exec() )
+        return;
+
+    QStringList names;
+    names << "general" << "stats_rules" << "stats_rules_offpeak" << "hour_archive_sums";
+    foreach ( QString period, periods )
+        names << period + "s";
+
+    bool ok = db.transaction();
+    createTables( qry );
+    foreach ( QString name, names )
+    {
+        if ( !ok )
+            break;
+        ok = qry.exec( QString( "INSERT INTO %1 SELECT * FROM iface_file.%2;" ).arg( table( name ) ).arg( name ) );
+    }
+    if ( ok )
+        db.commit();
+    else
+        db.rollback();
+    qry.exec( "DETACH DATABASE iface_file;" );
 }
 
 bool SqlStorage::createDb()
@@ -73,42 +220,154 @@ bool SqlStorage::createDb()
     if ( !open() )
         return ok;
 
-    QSqlDatabase::database( mIfaceName ).transaction();
+    db.transaction();
     QSqlQuery qry( db );
-    QString qryStr = "CREATE TABLE IF NOT EXISTS general (id INTEGER PRIMARY KEY, version INTEGER,"
-                     " last_saved BIGINT, calendar TEXT, next_hour_id INTEGER );";
-    qry.exec( qryStr );
+    createTables( qry );
+    ok = db.commit();
+    return ok;
+}
+
+void SqlStorage::createTables( QSqlQuery &qry )
+{
+    QString qryStr = "CREATE TABLE IF NOT EXISTS %1 (id INTEGER PRIMARY KEY, version INTEGER,"
+                     " last_saved BIGINT, calendar TEXT, next_hour_id INTEGER, journal_seq INTEGER );";
+    qry.exec( qryStr.arg( table( "general" ) ) );
 
-    qryStr = "CREATE TABLE IF NOT EXISTS stats_rules (id INTEGER PRIMARY KEY, start_date DATETIME,"
+    qryStr = "CREATE TABLE IF NOT EXISTS %1 (id INTEGER PRIMARY KEY, start_date DATETIME,"
              " period_units INTEGER, period_count INTEGER );";
-    qry.exec( qryStr );
+    qry.exec( qryStr.arg( table( "stats_rules" ) ) );
 
-    qryStr = "CREATE TABLE IF NOT EXISTS stats_rules_offpeak (id INTEGER PRIMARY KEY,"
+    qryStr = "CREATE TABLE IF NOT EXISTS %1 (id INTEGER PRIMARY KEY,"
              " offpeak_start_time TEXT, offpeak_end_time TEXT,"
              " weekend_is_offpeak BOOLEAN, weekend_start_time TEXT, weekend_end_time TEXT,"
              " weekend_start_day INTEGER, weekend_end_day INTEGER );";
-    qry.exec( qryStr );
+    qry.exec( qryStr.arg( table( "stats_rules_offpeak" ) ) );
 
     for ( int i = KNemoStats::Hour; i <= KNemoStats::HourArchive; ++i )
+        createPeriodTable( qry, i );
+    createArchiveSums( qry );
+}
+
+// One row per entry.  The off-peak columns are null if the entry doesn't
+// track off-peak traffic.  The index on the start time carries the traffic
+// too, so a range of entries can be read from the index alone.
+void SqlStorage::createPeriodTable( QSqlQuery &qry, int periodType )
+{
+    QString daysStr;
+    if ( periodType == KNemoStats::BillPeriod )
+        daysStr = " days INTEGER,";
+    qry.exec( QString( "CREATE TABLE IF NOT EXISTS %1 (id INTEGER PRIMARY KEY, datetime INTEGER NOT NULL,%2"
+                       " rx BIGINT, tx BIGINT, rx_offpeak BIGINT, tx_offpeak BIGINT );" )
+              .arg( periodTable( periodType ) ).arg( daysStr ) );
+    qry.exec( QString( "CREATE INDEX IF NOT EXISTS %1 ON %2"
+                       " (datetime, rx, tx, rx_offpeak, tx_offpeak);" )
+              .arg( table( periods.at( periodType ) + "s_datetime" ) )
+              .arg( periodTable( periodType ) ) );
+}
+
+void SqlStorage::createArchiveSums( QSqlQuery &qry )
+{
+    // Running totals of hour_archives up to and including each id.  The
+    // traffic of any span of archived hours is the difference of two rows.
+    qry.exec( QString( "CREATE TABLE IF NOT EXISTS %1 (id INTEGER PRIMARY KEY, datetime INTEGER NOT NULL,"
+                       " rx BIGINT, tx BIGINT, rx_offpeak BIGINT, tx_offpeak BIGINT );" )
+              .arg( table( "hour_archive_sums" ) ) );
+    // Lookups take the last row before a time, so the index stays in
+    // (datetime, id) order
+    qry.exec( QString( "CREATE INDEX IF NOT EXISTS %1 ON %2 (datetime);" )
+              .arg( table( "hour_archive_sums_datetime" ) )
+              .arg( table( "hour_archive_sums" ) ) );
+}
+
+// Recompute the running totals from fromId on.  Archived hours are only
+// ever appended or have their off-peak traffic rewritten from some id on,
+// so everything before fromId is still valid.
+void SqlStorage::updateArchiveSums( int fromId )
+{
+    TrafficTotals totals;
+    QSqlQuery qry( db );
+
+    qry.prepare( QString( "DELETE FROM %1 WHERE id >= ?;" ).arg( table( "hour_archive_sums" ) ) );
+    qry.addBindValue( fromId );
+    qry.exec();
+
+    qry.exec( QString( "SELECT * FROM %1 ORDER BY id DESC LIMIT 1;" ).arg( table( "hour_archive_sums" ) ) );
+    if ( qry.next() )
     {
-        foreach ( KNemoStats::TrafficType j, mTypeMap.keys() )
-        {
-            QString dateTimeStr;
-            qryStr = "CREATE TABLE IF NOT EXISTS %1s%2 (id INTEGER PRIMARY KEY,%3"
-                     " rx BIGINT, tx BIGINT );";
-            if ( j == KNemoStats::AllTraffic )
-            {
-                dateTimeStr = " datetime DATETIME,";
-                if ( i == KNemoStats::BillPeriod  )
-                    dateTimeStr += " days INTEGER,";
-            }
-            qryStr = qryStr.arg( periods.at( i ) ).arg( mTypeMap.value( j ) ).arg( dateTimeStr );
-            qry.exec( qryStr );
-        }
+        totals.rx = qry.value( qry.record().indexOf( "rx" ) ).toULongLong();
+        totals.tx = qry.value( qry.record().indexOf( "tx" ) ).toULongLong();
+        totals.rxOffpeak = qry.value( qry.record().indexOf( "rx_offpeak" ) ).toULongLong();
+        totals.txOffpeak = qry.value( qry.record().indexOf( "tx_offpeak" ) ).toULongLong();
     }
 
-    ok = QSqlDatabase::database( mIfaceName ).commit();
-    db.close();
+    QSqlQuery &ins = preparedQuery( QString( "INSERT INTO %1 (id, datetime, rx, tx, rx_offpeak, tx_offpeak )"
+                                             " VALUES (?, ?, ?, ?, ?, ? );" ).arg( table( "hour_archive_sums" ) ) );
+
+    QString qryStr = "SELECT id, datetime, rx, tx, rx_offpeak, tx_offpeak FROM %1"
+                     " WHERE id >= ? ORDER BY id;";
+    qry.prepare( qryStr.arg( periodTable( KNemoStats::HourArchive ) ) );
+    qry.addBindValue( fromId );
+    qry.exec();
+    while ( qry.next() )
+    {
+        // Untracked off-peak traffic reads as a null, which is 0
+        totals.rx += qry.value( 2 ).toULongLong();
+        totals.tx += qry.value( 3 ).toULongLong();
+        totals.rxOffpeak += qry.value( 4 ).toULongLong();
+        totals.txOffpeak += qry.value( 5 ).toULongLong();
+
+        ins.addBindValue( qry.value( 0 ) );
+        ins.addBindValue( qry.value( 1 ) );
+        ins.addBindValue( totals.rx );
+        ins.addBindValue( totals.tx );
+        ins.addBindValue( totals.rxOffpeak );
+        ins.addBindValue( totals.txOffpeak );
+        ins.exec();
+    }
+}
+
+// The running totals of all archived hours that start before dateTime
+bool SqlStorage::archiveSumBefore( const QDateTime &dateTime, TrafficTotals *totals )
+{
+    QSqlQuery qry( db );
+    qry.prepare( QString( "SELECT rx, tx, rx_offpeak, tx_offpeak FROM %1"
+                          " WHERE datetime < ? ORDER BY datetime DESC, id DESC LIMIT 1;" )
+                 .arg( table( "hour_archive_sums" ) ) );
+    qry.addBindValue( toDbTime( dateTime ) );
+    if ( !qry.exec() )
+        return false;
+
+    *totals = TrafficTotals();
+    if ( qry.next() )
+    {
+        totals->rx = qry.value( 0 ).toULongLong();
+        totals->tx = qry.value( 1 ).toULongLong();
+        totals->rxOffpeak = qry.value( 2 ).toULongLong();
+        totals->txOffpeak = qry.value( 3 ).toULongLong();
+    }
+    return true;
+}
+
+bool SqlStorage::trafficBetween( const QDateTime &start, const QDateTime &end, TrafficTotals *totals )
+{
+    bool ok = false;
+    *totals = TrafficTotals();
+    if ( !open() )
+        return ok;
+
+    db.transaction();
+    TrafficTotals before;
+    TrafficTotals upTo;
+    if ( start < end &&
+         archiveSumBefore( start, &before ) &&
+         archiveSumBefore( end, &upTo ) )
+    {
+        totals->rx = upTo.rx - before.rx;
+        totals->tx = upTo.tx - before.tx;
+        totals->rxOffpeak = upTo.rxOffpeak - before.rxOffpeak;
+        totals->txOffpeak = upTo.txOffpeak - before.txOffpeak;
+    }
+    ok = db.commit();
     return ok;
 }
 
@@ -121,68 +380,128 @@ bool SqlStorage::loadHourArchives( StatisticsModel *hourArchive, const QDate &st
     QDateTime startDateTime = QDateTime( startDate, QTime() );
     QDateTime nextStartDateTime = QDateTime( nextStartDate, QTime() );
 
-    QSqlDatabase::database( mIfaceName ).transaction();
+    db.transaction();
     QSqlQuery qry( db );
 
-    QString searchCol;
-    QString startVal;
-    QString endVal;
-    foreach ( KNemoStats::TrafficType trafficType, mTypeMap.keys() )
+    int firstRow = hourArchive->rowCount();
+    // This is answered from the datetime index alone
+    QString qryStr = "SELECT id, datetime, rx, tx, rx_offpeak, tx_offpeak FROM %1 WHERE datetime >= ?";
+    if ( nextStartDate.isValid() )
+        qryStr += " AND datetime < ?";
+    qryStr += " ORDER BY datetime;";
+    qry.prepare( qryStr.arg( periodTable( KNemoStats::HourArchive ) ) );
+    qry.addBindValue( toDbTime( startDateTime ) );
+    if ( nextStartDate.isValid() )
+        qry.addBindValue( toDbTime( nextStartDateTime ) );
+    qry.exec();
+    int cId = qry.record().indexOf( "id" );
+    int cDt = qry.record().indexOf( "datetime" );
+    int cRx = qry.record().indexOf( "rx" );
+    int cTx = qry.record().indexOf( "tx" );
+    int cRxOffpeak = qry.record().indexOf( "rx_offpeak" );
+    int cTxOffpeak = qry.record().indexOf( "tx_offpeak" );
+
+    while ( qry.next() )
     {
-        if ( trafficType == KNemoStats::AllTraffic )
+        // Hours that couldn't be written yet are in memory already
+        if ( hourArchive->indexOfId( qry.value( cId ).toInt() ) >= 0 )
+            continue;
+        hourArchive->createEntry( fromDbTime( qry.value( cDt ).toLongLong() ), qry.value( cId ).toInt() );
+        int row = hourArchive->rowCount() - 1;
+        hourArchive->setTraffic( row, qry.value( cRx ).toULongLong(), qry.value( cTx ).toULongLong() );
+        if ( !qry.value( cRxOffpeak ).isNull() )
         {
-            searchCol = "datetime";
-            startVal = startDateTime.toString( Qt::ISODate );
-            endVal = nextStartDateTime.toString( Qt::ISODate );
-        }
-        else
-        {
-            searchCol = "id";
-            startVal = QString::number( hourArchive->id( 0 ) );
-            endVal = QString::number( hourArchive->id()+1 );
+            hourArchive->setTraffic( row, qry.value( cRxOffpeak ).toULongLong(), qry.value( cTxOffpeak ).toULongLong(),
+                                     KNemoStats::OffpeakTraffic );
+            hourArchive->addTrafficType( KNemoStats::OffpeakTraffic, row );
         }
+    }
+    for ( int row = firstRow; row < hourArchive->rowCount(); ++row )
+        hourArchive->setSaved( row );
 
-        QString qryStr = "SELECT * FROM %1s%2 WHERE %3 >= '%4'";
-        if ( nextStartDate.isValid() )
-        {
-            qryStr += " AND datetime < '%5'";
-            qryStr = qryStr.arg( periods.at( KNemoStats::HourArchive ) )
-                           .arg( mTypeMap.value( trafficType ) )
-                           .arg( searchCol )
-                           .arg( startVal )
-                           .arg( endVal );
-        }
-        else
-        {
-            qryStr = qryStr.arg( periods.at( KNemoStats::HourArchive ) )
-                           .arg( mTypeMap.value( trafficType ) )
-                           .arg( searchCol )
-                           .arg( startVal );
-        }
-        qryStr += " ORDER BY id;";
-        qry.exec( qryStr );
-        int cId = qry.record().indexOf( "id" );
-        int cRx = qry.record().indexOf( "rx" );
-        int cTx = qry.record().indexOf( "tx" );
-        int cDt = 0;
-        if ( trafficType == KNemoStats::AllTraffic )
-            cDt = qry.record().indexOf( "datetime" );
+    ok = db.commit();
+    return ok;
+}
 
-        while ( qry.next() )
+bool SqlStorage::loadOlderRows( StatisticsModel *s, int count )
+{
+    bool ok = false;
+    if ( !open() )
+        return ok;
+
+    db.transaction();
+    QSqlQuery qry( db );
+    loadRows( qry, s, count );
+    ok = db.commit();
+    return ok;
+}
+
+void SqlStorage::loadRows( QSqlQuery &qry, StatisticsModel *s, int count )
+{
+    QString name = periodTable( s->periodType() );
+    // Newest first so LIMIT takes the rows nearest the ones we have
+    QString qryStr = "SELECT * FROM %1";
+    if ( s->rowCount() )
+        qryStr += QString( " WHERE id < '%1'" ).arg( s->id( 0 ) );
+    qryStr += QString( " ORDER BY id DESC LIMIT %1;" ).arg( count );
+    qry.exec( qryStr.arg( name ) );
+    int cId = qry.record().indexOf( "id" );
+    int cDt = qry.record().indexOf( "datetime" );
+    int cDays = qry.record().indexOf( "days" );
+    int cRx = qry.record().indexOf( "rx" );
+    int cTx = qry.record().indexOf( "tx" );
+    int cRxOffpeak = qry.record().indexOf( "rx_offpeak" );
+    int cTxOffpeak = qry.record().indexOf( "tx_offpeak" );
+
+    QList<StatisticsEntry> entries;
+    while ( qry.next() )
+    {
+        qint64 secs = qry.value( cDt ).toLongLong() + unix_epoch_day * 86400;
+        StatisticsEntry entry;
+        entry.julianDay = secs / 86400;
+        entry.seconds = secs % 86400;
+        entry.id = qry.value( cId ).toInt();
+        if ( s->periodType() == KNemoStats::BillPeriod )
+            entry.span = qMax( 0, qry.value( cDays ).toInt() );
+        entry.rx[ KNemoStats::AllTraffic ] = qry.value( cRx ).toULongLong();
+        entry.tx[ KNemoStats::AllTraffic ] = qry.value( cTx ).toULongLong();
+        if ( !qry.value( cRxOffpeak ).isNull() )
         {
-            int id = qry.value( cId ).toInt();
-            if ( trafficType == KNemoStats::AllTraffic )
-            {
-                hourArchive->createEntry( QDateTime::fromString( qry.value( cDt ).toString(), Qt::ISODate ), id );
-            }
-            hourArchive->setTraffic( hourArchive->indexOfId( id ), qry.value( cRx ).toULongLong(), qry.value( cTx ).toULongLong(), trafficType );
-            hourArchive->addTrafficType( trafficType, hourArchive->indexOfId( id ) );
+            entry.trafficTypes |= KNemoStats::OffpeakTraffic;
+            entry.rx[ KNemoStats::OffpeakTraffic ] = qry.value( cRxOffpeak ).toULongLong();
+            entry.tx[ KNemoStats::OffpeakTraffic ] = qry.value( cTxOffpeak ).toULongLong();
         }
+        entries.prepend( entry );
     }
 
-    ok = QSqlDatabase::database( mIfaceName ).commit();
-    db.close();
-    return ok;
+    StatisticsStore older;
+    foreach ( const StatisticsEntry &entry, entries )
+    {
+        older.append( entry );
+        // All of these are in the db already
+        int bits = 1 << KNemoStats::AllTraffic;
+        if ( entry.trafficTypes & KNemoStats::OffpeakTraffic )
+            bits |= 1 << KNemoStats::OffpeakTraffic;
+        older.setSaved( older.count() - 1, bits );
+    }
+
+    int olderRows = 0;
+    if ( older.count() || s->rowCount() )
+    {
+        int firstId = older.count() ? older.id( 0 ) : s->id( 0 );
+        qry.exec( QString( "SELECT COUNT(*) FROM %1 WHERE id < '%2';" ).arg( name ).arg( firstId ) );
+        if ( qry.next() )
+            olderRows = qry.value( 0 ).toInt();
+    }
+    if ( olderRows > 0 && s->olderRows() == 0 )
+    {
+        qry.exec( QString( "SELECT datetime FROM %1 ORDER BY id LIMIT 1;" ).arg( name ) );
+        if ( qry.next() )
+            s->setFirstDate( fromDbTime( qry.value( 0 ).toLongLong() ).date() );
+    }
+
+    s->prependEntries( older );
+    s->setOlderRows( olderRows );
 }
 
 bool SqlStorage::migrateDb()
@@ -191,17 +510,19 @@ bool SqlStorage::migrateDb()
     if ( !open() )
         return ok;
 
-    QSqlDatabase::database( mIfaceName ).transaction();
+    db.transaction();
     QSqlQuery qry( db );
-    qry.exec( "SELECT * FROM general;" );
+    qry.exec( QString( "SELECT * FROM %1;" ).arg( table( "general" ) ) );
     if ( qry.next() )
     {
         int dbVersion = qry.value( qry.record().indexOf( "version" ) ).toInt();
         if ( dbVersion > current_db_version )
         {
             mValidDbVer = false;
-            QSqlDatabase::database( mIfaceName ).commit();
-            db.close();
+            db.commit();
+            // The other interfaces still need a shared connection
+            if ( !isShared() )
+                db.close();
             KMessageBox::error( NULL, i18n( "The statistics database for interface \"%1\" is incompatible with this version of KNemo.\n\nPlease upgrade to a more recent KNemo release.", mIfaceName ) );
             return false;
         }
@@ -210,9 +531,9 @@ bool SqlStorage::migrateDb()
             int lastSaved = qry.value( qry.record().indexOf( "last_saved" ) ).toInt();
             QString calendarType = qry.value( qry.record().indexOf( "calendar" ) ).toString();
             int nextHourId = qry.value( qry.record().indexOf( "next_hour_id" ) ).toInt();
-            QString qryStr = "REPLACE INTO general (id, version, last_saved, calendar, next_hour_id )"
+            QString qryStr = "REPLACE INTO %1 (id, version, last_saved, calendar, next_hour_id )"
                              " VALUES (?, ?, ?, ?, ? );";
-            qry.prepare( qryStr );
+            qry.prepare( qryStr.arg( table( "general" ) ) );
             qry.addBindValue( 1 );
             qry.addBindValue( current_db_version );
             qry.addBindValue( lastSaved );
@@ -220,32 +541,93 @@ bool SqlStorage::migrateDb()
             qry.addBindValue( nextHourId );
             qry.exec();
         }
+        if ( dbVersion < 3 && !migrateToV3( qry ) )
+        {
+            mValidDbVer = false;
+            db.rollback();
+            // The other interfaces still need a shared connection
+            if ( !isShared() )
+                db.close();
+            KMessageBox::error( NULL, i18n( "The statistics database for interface \"%1\" could not be upgraded.", mIfaceName ) );
+            return false;
+        }
     }
-    ok = QSqlDatabase::database( mIfaceName ).commit();
-    db.close();
+
+    // Older readers ignore the extra column, so it doesn't need a new
+    // version.
+    if ( !db.record( tableName( "general" ) ).contains( "journal_seq" ) )
+        qry.exec( QString( "ALTER TABLE %1 ADD COLUMN journal_seq INTEGER;" ).arg( table( "general" ) ) );
+
+    // Databases from before the range index get their running totals
+    // filled in here.
+    createArchiveSums( qry );
+    int sumFromId = 0;
+    qry.exec( QString( "SELECT MAX(id) FROM %1;" ).arg( table( "hour_archive_sums" ) ) );
+    if ( qry.next() && !qry.value( 0 ).isNull() )
+        sumFromId = qry.value( 0 ).toInt() + 1;
+    updateArchiveSums( sumFromId );
+
+    ok = db.commit();
     return ok;
 }
 
+// Version 3 keeps times as integers and merges the off-peak tables into
+// their period tables.  The rows are copied by SQLite itself, one at a
+// time, so a long history never has to fit in memory.
+bool SqlStorage::migrateToV3( QSqlQuery &qry )
+{
+    for ( int i = KNemoStats::Hour; i <= KNemoStats::HourArchive; ++i )
+    {
+        QString name = periods.at( i ) + "s";
+        QString days;
+        QString oldDays;
+        if ( i == KNemoStats::BillPeriod )
+        {
+            days = " days,";
+            oldDays = " a.days,";
+        }
+
+        if ( !qry.exec( QString( "ALTER TABLE %1 RENAME TO %2;" ).arg( table( name ) ).arg( table( name + "_v2" ) ) ) )
+            return false;
+        createPeriodTable( qry, i );
+        QString qryStr = "INSERT INTO %1 (id, datetime,%2 rx, tx, rx_offpeak, tx_offpeak )"
+                         " SELECT a.id, CAST(strftime('%s', a.datetime) AS INTEGER),%3 a.rx, a.tx, o.rx, o.tx"
+                         " FROM %4 a LEFT JOIN %5 o ON o.id = a.id;";
+        if ( !qry.exec( qryStr.arg( table( name ) ).arg( days ).arg( oldDays )
+                              .arg( table( name + "_v2" ) ).arg( table( name + "_offpeak" ) ) ) )
+            return false;
+        qry.exec( QString( "DROP TABLE %1;" ).arg( table( name + "_v2" ) ) );
+        qry.exec( QString( "DROP TABLE %1;" ).arg( table( name + "_offpeak" ) ) );
+    }
+
+    // The running totals are rebuilt from the new hour_archives
+    qry.exec( QString( "DROP TABLE IF EXISTS %1;" ).arg( table( "hour_archive_sums" ) ) );
+    qry.exec( QString( "UPDATE %1 SET version = %2;" ).arg( table( "general" ) ).arg( current_db_version ) );
+    return true;
+}
+
 bool SqlStorage::loadStats( StorageData *sd, QHash<int, StatisticsModel*> *models, QList<StatsRule> *rules )
 {
     bool ok = false;
     if ( !open() )
         return ok;
 
-    QSqlDatabase::database( mIfaceName ).transaction();
+    db.transaction();
     QSqlQuery qry( db );
     QDateTime curDateTime = QDateTime::currentDateTime();
 
     KLocale::CalendarSystem calSystem = KLocale::QDateCalendar;
-    qry.exec( "SELECT * FROM general;" );
+    qry.exec( QString( "SELECT * FROM %1;" ).arg( table( "general" ) ) );
     if ( qry.next() )
     {
         int cLastSaved = qry.record().indexOf( "last_saved" );
         int cCalendarSystem = qry.record().indexOf( "calendar" );
         int cNextHourId = qry.record().indexOf( "next_hour_id" );
+        int cJournalSeq = qry.record().indexOf( "journal_seq" );
         sd->lastSaved = qry.value( cLastSaved ).toUInt();
         calSystem = static_cast<KLocale::CalendarSystem>(qry.value( cCalendarSystem ).toInt());
         sd->nextHourId = qry.value( cNextHourId ).toInt();
+        sd->journalSeq = qry.value( cJournalSeq ).toULongLong();
     }
     sd->calendar = KCalendarSystem::create( calSystem );
 
@@ -258,51 +640,18 @@ bool SqlStorage::loadStats( StorageData *sd, QHash<int, StatisticsModel*> *model
         {
             if ( s->periodType() == KNemoStats::HourArchive )
                 continue;
-            foreach ( KNemoStats::TrafficType trafficType, mTypeMap.keys() )
+            // There are never more than a day's worth of hours
+            loadRows( qry, s, s->periodType() == KNemoStats::Hour ? -1 : StatisticsModel::PageRows );
+            if ( s->rowCount() )
             {
-                qry.exec( QString( "SELECT * FROM %1s%2 ORDER BY id;" )
-                        .arg( periods.at( s->periodType() ) )
-                        .arg( mTypeMap.value( trafficType ) ) );
-                int cId = qry.record().indexOf( "id" );
-                int cRx = qry.record().indexOf( "rx" );
-                int cTx = qry.record().indexOf( "tx" );
-                int cDt = 0;
-                int cDays = 0;
-                if ( trafficType == KNemoStats::AllTraffic )
-                {
-                    cDt = qry.record().indexOf( "datetime" );
-                    if ( s->periodType() == KNemoStats::BillPeriod )
-                    {
-                        cDays = qry.record().indexOf( "days" );
-                    }
-                }
-
-                while ( qry.next() )
-                {
-                    int id = qry.value( cId ).toInt();
-                    if ( trafficType == KNemoStats::AllTraffic )
-                    {
-                        int days = -1;
-                        if ( s->periodType() == KNemoStats::BillPeriod )
-                        {
-                            days = qry.value( cDays ).toInt();
-                        }
-                        s->createEntry( QDateTime::fromString( qry.value( cDt ).toString(), Qt::ISODate ), id, days );
-                    }
-                    s->setTraffic( id, qry.value( cRx ).toULongLong(), qry.value( cTx ).toULongLong(), trafficType );
-                    s->addTrafficType( trafficType, id );
-                }
-                if ( trafficType == KNemoStats::AllTraffic && s->rowCount() )
-                {
-                    sd->saveFromId.insert( s->periodType(), s->id() );
-                }
+                sd->saveFromId.insert( s->periodType(), s->id() );
             }
         }
     }
 
     if ( rules )
     {
-        qry.exec( "SELECT * FROM stats_rules ORDER BY id;" );
+        qry.exec( QString( "SELECT * FROM %1 ORDER BY id;" ).arg( table( "stats_rules" ) ) );
         int cDt = qry.record().indexOf( "start_date" );
         int cType = qry.record().indexOf( "period_units" );
         int cUnits = qry.record().indexOf( "period_count" );
@@ -315,7 +664,7 @@ bool SqlStorage::loadStats( StorageData *sd, QHash<int, StatisticsModel*> *model
             *rules << entry;
         }
 
-        qry.exec( "SELECT * FROM stats_rules_offpeak ORDER BY id;" );
+        qry.exec( QString( "SELECT * FROM %1 ORDER BY id;" ).arg( table( "stats_rules_offpeak" ) ) );
         int cId = qry.record().indexOf( "id" );
         int cOpStartTime = qry.record().indexOf( "offpeak_start_time" );
         int cOpEndTime = qry.record().indexOf( "offpeak_end_time" );
@@ -340,56 +689,260 @@ bool SqlStorage::loadStats( StorageData *sd, QHash<int, StatisticsModel*> *model
             }
         }
     }
-    ok = QSqlDatabase::database( mIfaceName ).commit();
-    qry.exec( "VACUUM;" );
-    db.close();
+    ok = db.commit();
     return ok;
 }
 
-bool SqlStorage::saveStats( StorageData *sd, QHash<int, StatisticsModel*> *models, QList<StatsRule> *rules, bool fullSave )
+static StatisticsRow dbRow( const StatisticsModel *s, int row, bool update )
 {
-    bool ok = false;
-    if ( !open() )
-        return ok;
+    StatisticsRow r;
+    r.id = s->id( row );
+    r.dateTime = toDbTime( s->dateTime( row ) );
+    if ( s->periodType() == KNemoStats::BillPeriod )
+        r.days = s->days( row );
+    r.rx = s->rxBytes( row );
+    r.tx = s->txBytes( row );
+    r.rxOffpeak = offpeakValue( s, row, s->rxBytes( row, KNemoStats::OffpeakTraffic ) );
+    r.txOffpeak = offpeakValue( s, row, s->txBytes( row, KNemoStats::OffpeakTraffic ) );
+    r.update = update;
+    return r;
+}
 
-    QSqlDatabase::database( mIfaceName ).transaction();
+StatisticsChangeSet SqlStorage::changeSet( StorageData *sd, QHash<int, StatisticsModel*> *models,
+                                           QList<StatsRule> *rules, bool fullSave ) const
+{
+    StatisticsChangeSet changes;
+    changes.ifaceName = mIfaceName;
+    changes.lastSaved = QDateTime::currentDateTime().toTime_t();
+    changes.calendarSystem = sd->calendar->calendarSystem();
+    changes.nextHourId = sd->nextHourId;
+    changes.journalSeq = sd->journalSeq;
 
-    save( sd, models, rules, fullSave );
+    if ( models )
+    {
+        int archiveFromId = sd->saveFromId.value( KNemoStats::HourArchive );
+        foreach ( StatisticsModel * s, *models )
+        {
+            PeriodChanges period;
+            period.periodType = s->periodType();
+            period.deletedIds = s->takeDeletedIds();
+            if ( fullSave )
+            {
+                // A rebuild may have changed anything from fromId on, so
+                // rewrite it all.  Rows from fromId on are never evicted,
+                // so they are all here.
+                period.fromId = sd->saveFromId.value( s->periodType() );
+                for ( int j = qMax( s->indexOfId( period.fromId ), 0 ); j < s->rowCount(); ++j )
+                {
+                    period.rows << dbRow( s, j, false );
+                    s->setSaved( j );
+                }
+            }
+            else
+            {
+                // Only the rows that changed since the last save
+                for ( int j = 0; j < s->rowCount(); ++j )
+                {
+                    if ( !s->dirtyTypes( j ) )
+                        continue;
+                    period.rows << dbRow( s, j, s->savedTypes( j ) != 0 );
+                    s->setSaved( j );
+                }
+            }
+            changes.periods << period;
 
-    ok = QSqlDatabase::database( mIfaceName ).commit();
-    if ( fullSave )
+            if ( s->rowCount() )
+                sd->saveFromId.insert( s->periodType(), s->id() );
+            // The archived hours stay in memory until the owner learns
+            // that they were written
+            if ( s->periodType() == KNemoStats::HourArchive && period.rows.count() )
+                changes.archiveFromId = archiveFromId;
+        }
+    }
+
+    if ( fullSave && rules )
     {
-        QSqlQuery qry( db );
-        qry.exec( "VACUUM;" );
+        changes.hasRules = true;
+        changes.rules = *rules;
     }
-    db.close();
-    return ok;
+    return changes;
 }
 
-bool SqlStorage::clearStats( StorageData *sd )
+bool SqlStorage::beginWrite()
 {
-    bool ok = false;
+    mError.clear();
     if ( !open() )
-        return ok;
+    {
+        mError = db.lastError().text();
+        return false;
+    }
+    if ( !db.transaction() )
+    {
+        mError = db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool SqlStorage::endWrite()
+{
+    mError.clear();
+    if ( !db.commit() )
+    {
+        mError = db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+void SqlStorage::abortWrite()
+{
+    db.rollback();
+}
+
+bool SqlStorage::exec( QSqlQuery &qry )
+{
+    if ( qry.exec() )
+        return true;
+    if ( mError.isEmpty() )
+        mError = qry.lastError().text();
+    return false;
+}
+
+bool SqlStorage::exec( QSqlQuery &qry, const QString &qryStr )
+{
+    if ( qry.exec( qryStr ) )
+        return true;
+    if ( mError.isEmpty() )
+        mError = qry.lastError().text();
+    return false;
+}
+
+// A batch that failed is rolled back and written again later
+bool SqlStorage::write( const StatisticsChangeSet &changes )
+{
+    mError.clear();
+    if ( changes.clear )
+        clearTables();
+    foreach ( const PeriodChanges &period, changes.periods )
+        writePeriod( period );
+
+    if ( changes.clear )
+    {
+        // The off-peak archives are gone
+        updateArchiveSums( 0 );
+    }
+    else if ( changes.archiveFromId >= 0 )
+        updateArchiveSums( changes.archiveFromId );
+
+    if ( changes.hasRules )
+        writeRules( changes.rules );
 
-    QSqlDatabase::database( mIfaceName ).transaction();
+    // The journal is replayed from journal_seq on, so it may only move
+    // once everything else is in
+    if ( !mError.isEmpty() )
+        return false;
+    QString qryStr = "REPLACE INTO %1 (id, version, last_saved, calendar, next_hour_id, journal_seq )"
+                     " VALUES (?, ?, ?, ?, ?, ? );";
+    QSqlQuery &general = preparedQuery( qryStr.arg( table( "general" ) ) );
+    general.addBindValue( 1 );
+    general.addBindValue( current_db_version );
+    general.addBindValue( changes.lastSaved );
+    general.addBindValue( QVariant( changes.calendarSystem ).toString() );
+    general.addBindValue( changes.nextHourId );
+    general.addBindValue( changes.journalSeq );
+    exec( general );
+    return mError.isEmpty();
+}
+
+void SqlStorage::clearTables()
+{
     QSqlQuery qry( db );
-    foreach ( QString period, periods )
+    for ( int i = KNemoStats::Hour; i <= KNemoStats::HourArchive; ++i )
+    {
+        // Archived hours keep their traffic, just not how much was off-peak
+        if ( i == KNemoStats::HourArchive )
+            exec( qry, QString( "UPDATE %1 SET rx_offpeak = NULL, tx_offpeak = NULL;" ).arg( periodTable( i ) ) );
+        else
+            exec( qry, QString( "DELETE FROM %1;" ).arg( periodTable( i ) ) );
+    }
+}
+
+void SqlStorage::writePeriod( const PeriodChanges &changes )
+{
+    QString name = periodTable( changes.periodType );
+
+    // Rows that were removed or renumbered go first, since another row may
+    // be about to take their id
+    if ( changes.deletedIds.count() )
     {
-        foreach ( KNemoStats::TrafficType i, mTypeMap.keys() )
+        QSqlQuery &del = preparedQuery( QString( "DELETE FROM %1 WHERE id = ?;" ).arg( name ) );
+        foreach ( int id, changes.deletedIds )
         {
-            if ( i == KNemoStats::AllTraffic &&
-                 ( period == periods.at( KNemoStats::Hour ) || period == periods.at( KNemoStats::HourArchive ) ) )
-                continue;
-            qry.exec( QString( "DELETE FROM %1s%2;" ).arg( period ).arg( mTypeMap.value( i ) ) );
+            del.addBindValue( id );
+            exec( del );
         }
     }
-    save( sd );
-    ok = QSqlDatabase::database( mIfaceName ).commit();
-    qry.exec( "VACUUM;" );
 
-    db.close();
-    return ok;
+    if ( changes.fromId >= 0 )
+    {
+        /* Delete the rows from fromId on, except from:
+             days
+             hour_archives
+           Those only lose their off-peak traffic, and hour_archives not
+           even that if there are no new archived hours.
+         */
+        QString qryStr;
+        if ( changes.periodType == KNemoStats::Hour ||
+             !( changes.periodType == KNemoStats::Day || changes.periodType == KNemoStats::HourArchive ) )
+            qryStr = "DELETE FROM %1 WHERE id >= ?;";
+        else if ( changes.periodType == KNemoStats::Day || changes.rows.count() )
+            qryStr = "UPDATE %1 SET rx_offpeak = NULL, tx_offpeak = NULL WHERE id >= ?;";
+        if ( !qryStr.isEmpty() )
+        {
+            QSqlQuery &clear = preparedQuery( qryStr.arg( name ) );
+            clear.addBindValue( changes.fromId );
+            exec( clear );
+        }
+    }
+
+    QString daysStr;
+    QString daysStr2;
+    if ( changes.periodType == KNemoStats::BillPeriod )
+    {
+        daysStr = " days,";
+        daysStr2 = " ?,";
+    }
+    QString replaceStr = QString( "REPLACE INTO %1 (id, datetime,%2 rx, tx, rx_offpeak, tx_offpeak )"
+                                  " VALUES (?, ?,%3 ?, ?, ?, ? );" ).arg( name ).arg( daysStr ).arg( daysStr2 );
+    QString updateStr = QString( "UPDATE %1 SET rx = ?, tx = ?,"
+                                 " rx_offpeak = ?, tx_offpeak = ? WHERE id = ?;" ).arg( name );
+
+    foreach ( const StatisticsRow &row, changes.rows )
+    {
+        if ( row.update )
+        {
+            QSqlQuery &update = preparedQuery( updateStr );
+            update.addBindValue( row.rx );
+            update.addBindValue( row.tx );
+            update.addBindValue( row.rxOffpeak );
+            update.addBindValue( row.txOffpeak );
+            update.addBindValue( row.id );
+            exec( update );
+            continue;
+        }
+
+        QSqlQuery &replace = preparedQuery( replaceStr );
+        replace.addBindValue( row.id );
+        replace.addBindValue( row.dateTime );
+        if ( changes.periodType == KNemoStats::BillPeriod )
+            replace.addBindValue( row.days );
+        replace.addBindValue( row.rx );
+        replace.addBindValue( row.tx );
+        replace.addBindValue( row.rxOffpeak );
+        replace.addBindValue( row.txOffpeak );
+        exec( replace );
+    }
 }
 
 bool SqlStorage::open()
@@ -404,168 +957,116 @@ bool SqlStorage::open()
         return true;
 
     db.setDatabaseName( mDbPath );
-    return db.open();
+    if ( !db.open() )
+        return false;
+
+    // The connection stays open until we are destroyed, so this is only
+    // done once.
+    QSqlQuery qry( db );
+    qry.exec( "PRAGMA auto_vacuum;" );
+    if ( qry.next() && qry.value( 0 ).toInt() != 2 )
+    {
+        // Free pages are handed back a few at a time by compact() rather
+        // than by rewriting the whole file.  A db that already has tables
+        // needs one last VACUUM to switch over.
+        qry.exec( "PRAGMA auto_vacuum = INCREMENTAL;" );
+        qry.exec( "VACUUM;" );
+    }
+    // With a write-ahead log a commit only has to sync the log, and only
+    // at checkpoints with synchronous=NORMAL.
+    qry.exec( "PRAGMA journal_mode = WAL;" );
+    qry.exec( "PRAGMA synchronous = NORMAL;" );
+    return true;
 }
 
-void SqlStorage::save( StorageData *sd, QHash<int, StatisticsModel*> *models, QList<StatsRule> *rules, bool fullSave )
+QSqlQuery &SqlStorage::preparedQuery( const QString &qryStr )
 {
+    QHash<QString, QSqlQuery>::iterator i = mQueries.find( qryStr );
+    if ( i == mQueries.end() )
+    {
+        i = mQueries.insert( qryStr, QSqlQuery( db ) );
+        i.value().prepare( qryStr );
+    }
+    return i.value();
+}
+
+bool SqlStorage::compact( int pages )
+{
+    if ( !open() )
+        return false;
+
     QSqlQuery qry( db );
-    QString qryStr = "REPLACE INTO general (id, version, last_saved, calendar, next_hour_id )"
-                     " VALUES (?, ?, ?, ?, ? );";
-    qry.prepare( qryStr );
-    qry.addBindValue( 1 );
-    qry.addBindValue( current_db_version );
-    qry.addBindValue( QDateTime::currentDateTime().toTime_t() );
-    qry.addBindValue( QVariant( sd->calendar->calendarSystem() ).toString() );
-    qry.addBindValue( sd->nextHourId );
-    qry.exec();
+    qry.exec( QString( "PRAGMA incremental_vacuum(%1);" ).arg( pages ) );
+    // Step through the pragma; each row is a page given back
+    while ( qry.next() )
+        ;
+    qry.exec( "PRAGMA freelist_count;" );
+    return qry.next() && qry.value( 0 ).toInt() > 0;
+}
 
-    if ( models )
-    {
-        foreach ( StatisticsModel * s, *models )
-        {
-            foreach ( KNemoStats::TrafficType trafficType, mTypeMap.keys() )
-            {
-                /* Always do deletes for:
-                     hour*
-                   Even on a full save, don't delete anything from:
-                     days
-                     hour_archives
-                     hour_archives_* if the model is empty
-                 */
-                if ( s->periodType() == KNemoStats::Hour ||
-                     ( fullSave && !( ( trafficType == KNemoStats::AllTraffic && ( s->periodType() == KNemoStats::Day || s->periodType() == KNemoStats::HourArchive ) ) ||
-                                      ( s->periodType() == KNemoStats::HourArchive && !s->rowCount() )
-                                    )
-                     )
-                   )
-                {
-                    int deleteFrom = sd->saveFromId.value( s->periodType() );
-                    qryStr = QString( "DELETE FROM %1s%2 WHERE id >= '%3';" )
-                                .arg( periods.at( s->periodType() ) )
-                                .arg( mTypeMap.value( trafficType ) )
-                                .arg( deleteFrom );
-                    qry.exec( qryStr );
-                }
+void SqlStorage::writeRules( const QList<StatsRule> &rules )
+{
+    QSqlQuery qry( db );
+    QString qryStr = QString( "DELETE FROM %1 WHERE id >= '%2';" ).arg( table( "stats_rules" ) ).arg( rules.count() );
+    exec( qry, qryStr );
+    qryStr = QString( "DELETE FROM %1 WHERE id >= '%2';" ).arg( table( "stats_rules_offpeak" ) ).arg( rules.count() );
+    exec( qry, qryStr );
 
-                if ( !s->rowCount() )
-                {
-                    continue;
-                }
+    if ( rules.count() )
+    {
+        qryStr = "REPLACE INTO %1 (id, start_date, period_units, period_count )"
+                 " VALUES( ?, ?, ?, ? );";
+        qry.prepare( qryStr.arg( table( "stats_rules" ) ) );
 
-                QString dateTimeStr;
-                QString dateTimeStr2;
-                if ( trafficType == KNemoStats::AllTraffic )
-                {
-                    dateTimeStr = " datetime,";
-                    dateTimeStr2 = " ?,";
-                    if ( s->periodType() == KNemoStats::BillPeriod )
-                    {
-                        dateTimeStr += " days,";
-                        dateTimeStr2 += " ?,";
-                    }
-                }
-                qryStr = "REPLACE INTO %1s%2 (id,%3 rx, tx )"
-                             " VALUES (?,%4 ?, ? );";
-                qryStr = qryStr
-                            .arg( periods.at( s->periodType() ) )
-                            .arg( mTypeMap.value( trafficType ) )
-                            .arg( dateTimeStr )
-                            .arg( dateTimeStr2 );
-                qry.prepare( qryStr );
-
-                int j = sd->saveFromId.value( s->periodType() );
-                for ( j = s->indexOfId( j ); j < s->rowCount(); ++j )
-                {
-                    if ( s->trafficTypes( j ).contains( trafficType ) )
-                    {
-                        qry.addBindValue( s->id( j ) );
-                        if ( trafficType == KNemoStats::AllTraffic )
-                        {
-                            qry.addBindValue( s->dateTime( j ).toString( Qt::ISODate ) );
-                            if ( s->periodType() == KNemoStats::BillPeriod )
-                            {
-                                qry.addBindValue( s->days( j ) );
-                            }
-                        }
-                        qry.addBindValue( s->rxBytes( j, trafficType ) );
-                        qry.addBindValue( s->txBytes( j, trafficType ) );
-                        qry.exec();
-                    }
-                }
-            }
-            if ( s->rowCount() )
-            {
-                sd->saveFromId.insert( s->periodType(), s->id() );
-                if ( s->periodType() == KNemoStats::HourArchive )
-                    s->clearRows();
-            }
+        for ( int i = 0; i < rules.count(); ++i )
+        {
+            qry.addBindValue( i );
+            qry.addBindValue( rules.at(i).startDate.toString( Qt::ISODate ) );
+            qry.addBindValue( rules.at(i).periodUnits );
+            qry.addBindValue( rules.at(i).periodCount );
+            exec( qry );
         }
-    }
 
-    if ( fullSave && rules )
-    {
-        qryStr = QString( "DELETE FROM stats_rules WHERE id >= '%1';" ).arg( rules->count() );
-        qry.exec( qryStr );
-        qryStr = QString( "DELETE FROM stats_rules_offpeak WHERE id >= '%1';" ).arg( rules->count() );
-        qry.exec( qryStr );
+        qryStr = "REPLACE INTO %1 (id,"
+                 " offpeak_start_time, offpeak_end_time, weekend_is_offpeak,"
+                 " weekend_start_time, weekend_end_time, weekend_start_day, weekend_end_day )"
+                 " VALUES( ?, ?, ?, ?, ?, ?, ?, ? );";
+        qry.prepare( qryStr.arg( table( "stats_rules_offpeak" ) ) );
 
-        if ( rules->count() )
+        for ( int i = 0; i < rules.count(); ++i )
         {
-            qryStr = "REPLACE INTO stats_rules (id, start_date, period_units, period_count )"
-                     " VALUES( ?, ?, ?, ? );";
-            qry.prepare( qryStr );
+            QVariant startTime = QVariant::String;
+            QVariant stopTime = QVariant::String;
+            QVariant weekendIsOffpeak = QVariant::Bool;
+            QVariant wStartTime = QVariant::String;
+            QVariant wEndTime = QVariant::String;
+            QVariant wStartDay = QVariant::Int;
+            QVariant wEndDay = QVariant::Int;
 
-            for ( int i = 0; i < rules->count(); ++i )
-            {
-                qry.addBindValue( i );
-                qry.addBindValue( rules->at(i).startDate.toString( Qt::ISODate ) );
-                qry.addBindValue( rules->at(i).periodUnits );
-                qry.addBindValue( rules->at(i).periodCount );
-                qry.exec();
-            }
+            if ( !rules.at(i).logOffpeak )
+                continue;
 
-            qryStr = "REPLACE INTO stats_rules_offpeak (id,"
-                     " offpeak_start_time, offpeak_end_time, weekend_is_offpeak,"
-                     " weekend_start_time, weekend_end_time, weekend_start_day, weekend_end_day )"
-                     " VALUES( ?, ?, ?, ?, ?, ?, ?, ? );";
-            qry.prepare( qryStr );
+            startTime = rules.at(i).offpeakStartTime.toString( time_format );
+            stopTime = rules.at(i).offpeakEndTime.toString( time_format );
+            weekendIsOffpeak = rules.at(i).weekendIsOffpeak;
 
-            for ( int i = 0; i < rules->count(); ++i )
+            if ( rules.at(i).weekendIsOffpeak )
             {
-                QVariant startTime = QVariant::String;
-                QVariant stopTime = QVariant::String;
-                QVariant weekendIsOffpeak = QVariant::Bool;
-                QVariant wStartTime = QVariant::String;
-                QVariant wEndTime = QVariant::String;
-                QVariant wStartDay = QVariant::Int;
-                QVariant wEndDay = QVariant::Int;
-
-                if ( !rules->at(i).logOffpeak )
-                    continue;
-
-                startTime = rules->at(i).offpeakStartTime.toString( time_format );
-                stopTime = rules->at(i).offpeakEndTime.toString( time_format );
-                weekendIsOffpeak = rules->at(i).weekendIsOffpeak;
-
-                if ( rules->at(i).weekendIsOffpeak )
-                {
-                    wStartTime = rules->at(i).weekendTimeStart.toString( time_format );
-                    wEndTime = rules->at(i).weekendTimeEnd.toString( time_format );
-                    wStartDay = rules->at(i).weekendDayStart;
-                    wEndDay = rules->at(i).weekendDayEnd;
-                }
-
-                qry.addBindValue( i );
-                qry.addBindValue( startTime );
-                qry.addBindValue( stopTime );
-                qry.addBindValue( weekendIsOffpeak );
-                qry.addBindValue( wStartTime );
-                qry.addBindValue( wEndTime );
-                qry.addBindValue( wStartDay );
-                qry.addBindValue( wEndDay );
-                qry.exec();
+                wStartTime = rules.at(i).weekendTimeStart.toString( time_format );
+                wEndTime = rules.at(i).weekendTimeEnd.toString( time_format );
+                wStartDay = rules.at(i).weekendDayStart;
+                wEndDay = rules.at(i).weekendDayEnd;
             }
+
+            qry.addBindValue( i );
+            qry.addBindValue( startTime );
+            qry.addBindValue( stopTime );
+            qry.addBindValue( weekendIsOffpeak );
+            qry.addBindValue( wStartTime );
+            qry.addBindValue( wEndTime );
+            qry.addBindValue( wStartDay );
+            qry.addBindValue( wEndDay );
+            exec( qry );
         }
     }
 }
@@ -21,30 +21,119 @@
 #define SQLSTORAGE_H
 
 #include "storagedata.h"
+#include <QHash>
 #include <QSqlDatabase>
+#include <QSqlQuery>
 
 class SqlStorage
 {
     public:
-        SqlStorage( QString ifaceName );
+        enum Layout
+        {
+            // Whatever generalSettings->sharedStatistics says
+            ConfiguredLayout = 0,
+            // statistics_<iface>.db
+            InterfaceFile,
+            // Tables prefixed with the interface name in statistics.db
+            SharedFile
+        };
+
+        /**
+         * Every thread needs a connection of its own.  Pass a connectionName
+         * to open another one to the db of ifaceName.  In a shared db the
+         * main connection is shared by all interfaces.
+         */
+        SqlStorage( QString ifaceName, QString connectionName = QString(), Layout layout = ConfiguredLayout );
         ~SqlStorage();
+        bool isShared() const { return !mTablePrefix.isEmpty(); }
+        /**
+         * Whether there are statistics for the interface, i.e. its file or
+         * its tables in the shared db.
+         */
         bool dbExists();
         bool createDb();
         bool loadHourArchives( StatisticsModel *hourArchive, const QDate &startDate, const QDate &endDate );
+        /**
+         * Loads everything but the models' older rows, which are left for
+         * loadOlderRows().
+         */
         bool loadStats( StorageData *gd, QHash<int, StatisticsModel*> *models, QList<StatsRule> *rules );
-        bool saveStats( StorageData *gd, QHash<int, StatisticsModel*> *models, QList<StatsRule> *rules = 0, bool fullSave = false );
-        bool clearStats( StorageData *gd );
+        /**
+         * Load up to count rows from before the first row of s.  A negative
+         * count loads all of them.
+         */
+        bool loadOlderRows( StatisticsModel *s, int count );
+        /**
+         * Collect what changed in the models since the last save, and mark
+         * it saved.  This doesn't touch the db; write() does that later.
+         */
+        StatisticsChangeSet changeSet( StorageData *gd, QHash<int, StatisticsModel*> *models = 0,
+                                       QList<StatsRule> *rules = 0, bool fullSave = false ) const;
+        /**
+         * Writes between beginWrite() and endWrite() go into one
+         * transaction.  All three return false on failure and leave the
+         * first error in lastError().  abortWrite() drops the transaction
+         * instead.
+         */
+        bool beginWrite();
+        bool write( const StatisticsChangeSet &changes );
+        bool endWrite();
+        void abortWrite();
+        QString lastError() const { return mError; }
+        /**
+         * Sum the archived hours that start in [start, end).  This takes two
+         * lookups in the running totals kept in hour_archive_sums.
+         */
+        bool trafficBetween( const QDateTime &start, const QDateTime &end, TrafficTotals *totals );
+        /**
+         * Give up to pages free pages back to the filesystem.  Returns true
+         * if there are more left.
+         */
+        bool compact( int pages );
 
     private:
+        QString tableName( const QString &name ) const;
+        /**
+         * The quoted name of a table or index, for use in statements.
+         */
+        QString table( const QString &name ) const;
+        QString periodTable( int periodType ) const;
+        void importInterfaceFile();
+        void createTables( QSqlQuery &qry );
+        /**
+         * Open the connection the first time it's needed.  It stays open
+         * until the SqlStorage is destroyed.
+         */
         bool open();
-        void save( StorageData *gd, QHash<int, StatisticsModel*> *models = 0, QList<StatsRule> *rules = 0, bool fullSave = false );
+        /**
+         * Statements are prepared once per connection and reused.
+         */
+        QSqlQuery &preparedQuery( const QString &qryStr );
+        /**
+         * Remember the first error of a write
+         */
+        bool exec( QSqlQuery &qry );
+        bool exec( QSqlQuery &qry, const QString &qryStr );
+        void clearTables();
+        void writePeriod( const PeriodChanges &changes );
+        void writeRules( const QList<StatsRule> &rules );
         bool migrateDb();
+        bool migrateToV3( QSqlQuery &qry );
+        void createPeriodTable( QSqlQuery &qry, int periodType );
+        void loadRows( QSqlQuery &qry, StatisticsModel *s, int count );
+        void createArchiveSums( QSqlQuery &qry );
+        void updateArchiveSums( int fromId );
+        bool archiveSumBefore( const QDateTime &dateTime, TrafficTotals *totals );
         QString mDbPath;
 
         QSqlDatabase db;
         bool mValidDbVer;
         QString mIfaceName;
-        QMap<KNemoStats::TrafficType,QString> mTypeMap;
+        QString mConnectionName;
+        // Empty unless the db is shared
+        QString mTablePrefix;
+        QHash<QString, QSqlQuery> mQueries;
+        QString mError;
 };
 
 #endif
@@ -0,0 +1,166 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <QFile>
+#include <QtAlgorithms>
+
+#include "global.h"
+#include "commonstorage.h"
+#include "statisticsjournal.h"
+
+static const char journal_magic[ 8 ] = { 'K', 'N', 'J', 'O', 'U', 'R', 'N', '1' };
+
+// Takes up the first record slot of the file
+struct JournalHeader
+{
+    char magic[ 8 ];
+    quint32 capacity;
+    quint32 recordSize;
+};
+
+static const size_t map_size = ( StatisticsJournal::Capacity + 1 ) * sizeof( JournalRecord );
+
+static bool seqLessThan( const JournalRecord &a, const JournalRecord &b )
+{
+    return a.seq < b.seq;
+}
+
+StatisticsJournal::StatisticsJournal( const QString &ifaceName )
+    : mFd( -1 ),
+      mMap( 0 ),
+      mRecords( 0 ),
+      mNextSeq( 1 ),
+      mUnsynced( 0 )
+{
+    KUrl dir( generalSettings->statisticsDir );
+    QString path = QString( "%1%2%3.journal" ).arg( dir.path() ).arg( statistics_prefix ).arg( ifaceName );
+    mFd = ::open( QFile::encodeName( path ).constData(), O_RDWR | O_CREAT, 0600 );
+    if ( mFd < 0 )
+        return;
+
+    struct stat st;
+    bool fresh = fstat( mFd, &st ) != 0 || st.st_size != static_cast<off_t>(map_size);
+    if ( fresh && ( ftruncate( mFd, 0 ) != 0 || ftruncate( mFd, map_size ) != 0 ) )
+    {
+        ::close( mFd );
+        mFd = -1;
+        return;
+    }
+
+    void *map = mmap( 0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0 );
+    if ( map == MAP_FAILED )
+    {
+        ::close( mFd );
+        mFd = -1;
+        return;
+    }
+    mMap = static_cast<char *>(map);
+    mRecords = reinterpret_cast<JournalRecord *>(mMap + sizeof( JournalRecord ));
+
+    JournalHeader *header = reinterpret_cast<JournalHeader *>(mMap);
+    if ( fresh ||
+         memcmp( header->magic, journal_magic, sizeof( journal_magic ) ) != 0 ||
+         header->capacity != Capacity ||
+         header->recordSize != sizeof( JournalRecord ) )
+    {
+        // Not ours, or from a different layout; start over
+        memset( mMap, 0, map_size );
+        memcpy( header->magic, journal_magic, sizeof( journal_magic ) );
+        header->capacity = Capacity;
+        header->recordSize = sizeof( JournalRecord );
+        sync( true );
+    }
+
+    for ( int i = 0; i < Capacity; ++i )
+        mNextSeq = qMax( mNextSeq, mRecords[ i ].seq + 1 );
+}
+
+StatisticsJournal::~StatisticsJournal()
+{
+    if ( mMap )
+    {
+        sync( true );
+        munmap( mMap, map_size );
+    }
+    if ( mFd >= 0 )
+        ::close( mFd );
+}
+
+quint64 StatisticsJournal::append( uint time, quint64 rx, quint64 tx )
+{
+    quint64 seq = mNextSeq++;
+    if ( !mRecords )
+        return seq;
+
+    JournalRecord &record = mRecords[ seq % Capacity ];
+    // The sequence number goes in last, so a record cut short by a crash
+    // still carries the number of the one it replaces.  The barrier keeps
+    // the compiler and CPU from moving it ahead of the rest.
+    record.time = time;
+    record.rx = rx;
+    record.tx = tx;
+    __sync_synchronize();
+    record.seq = seq;
+
+    // This runs on the GUI thread, so it must not wait for the disk
+    if ( ++mUnsynced >= SyncRecords )
+        sync( false );
+    return seq;
+}
+
+void StatisticsJournal::setMinSeq( quint64 seq )
+{
+    mNextSeq = qMax( mNextSeq, seq + 1 );
+}
+
+QList<JournalRecord> StatisticsJournal::recordsAfter( quint64 seq ) const
+{
+    QList<JournalRecord> records;
+    if ( !mRecords )
+        return records;
+
+    for ( int i = 0; i < Capacity; ++i )
+    {
+        // Pairs with the barrier in append(): read the rest only after
+        // the sequence number says the record is complete
+        quint64 recordSeq = mRecords[ i ].seq;
+        __sync_synchronize();
+        if ( recordSeq > seq )
+        {
+            JournalRecord record = mRecords[ i ];
+            record.seq = recordSeq;
+            records << record;
+        }
+    }
+    qSort( records.begin(), records.end(), seqLessThan );
+    return records;
+}
+
+void StatisticsJournal::sync( bool wait )
+{
+    mUnsynced = 0;
+    // Only the dirty pages get written
+    msync( mMap, map_size, wait ? MS_SYNC : MS_ASYNC );
+}
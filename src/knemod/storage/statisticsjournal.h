@@ -0,0 +1,101 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef STATISTICSJOURNAL_H
+#define STATISTICSJOURNAL_H
+
+#include <QList>
+#include <QString>
+
+/**
+ * A record of the traffic of one poll.  The sequence numbers go up
+ * by one per record; 0 marks a slot that was never written.
+ */
+struct JournalRecord
+{
+    quint64 seq;
+    // Seconds since the epoch, UTC
+    qint64 time;
+    quint64 rx;
+    quint64 tx;
+};
+
+/**
+ * Keeps the traffic counted since the last save in a small memory mapped
+ * file next to the statistics db, so it survives a crash.  The file is a
+ * ring of Capacity records.  Saves store the sequence number of the last
+ * record they include, and on startup the records after it are put back
+ * into the models.
+ *
+ * The records are written to the mapping only; the kernel writes them
+ * out on its own, which is enough if knemo itself crashes.  Against
+ * power loss the kernel is asked to start writing them after every
+ * SyncRecords records, without waiting for it.  Only closing the journal
+ * waits until they are on disk.
+ *
+ * @short Crash safe journal of the traffic since the last save
+ */
+
+class StatisticsJournal
+{
+public:
+    enum
+    {
+        // There is a record per poll, at most 20 a second, and saves are
+        // at most 300 seconds apart, so this holds a save interval even at
+        // the shortest poll interval.  Only failing saves or saving on
+        // demand alone can wrap it.
+        Capacity = 8192,
+        SyncRecords = 16
+    };
+
+    StatisticsJournal( const QString &ifaceName );
+    ~StatisticsJournal();
+
+    /**
+     * Append a record and return its sequence number.  Without a file the
+     * number is still handed out, there is just nothing to replay later.
+     */
+    quint64 append( uint time, quint64 rx, quint64 tx );
+    /**
+     * The sequence number of the newest record
+     */
+    quint64 lastSeq() const { return mNextSeq - 1; }
+    /**
+     * New records are numbered after seq.  A db can be ahead of the
+     * journal if the file got lost.
+     */
+    void setMinSeq( quint64 seq );
+    /**
+     * The records after seq, oldest first.  If the ring wrapped since then
+     * the oldest of them are gone.
+     */
+    QList<JournalRecord> recordsAfter( quint64 seq ) const;
+
+private:
+    void sync( bool wait );
+
+    int mFd;
+    char *mMap;
+    JournalRecord *mRecords;
+    quint64 mNextSeq;
+    int mUnsynced;
+};
+
+#endif // STATISTICSJOURNAL_H
@@ -20,6 +20,12 @@
 #ifndef STORAGEDATA_H
 #define STORAGEDATA_H
 
+#include <QList>
+#include <QString>
+#include <QVariant>
+
+#include "data.h"
+
 class KCalendarSystem;
 
 struct StorageData
@@ -27,12 +33,109 @@ struct StorageData
     StorageData()
         : lastSaved( 0 ),
         nextHourId( 0 ),
+        journalSeq( 0 ),
         calendar( 0 )
     {}
     uint lastSaved;
     int nextHourId;
+    // The last journal record that the models include
+    quint64 journalSeq;
     QHash<int, int> saveFromId;
     KCalendarSystem* calendar;
 };
 
+/**
+ * Traffic of an arbitrary span of time.  The off-peak bytes are also
+ * counted in rx and tx.
+ */
+struct TrafficTotals
+{
+    TrafficTotals()
+        : rx( 0 ),
+        tx( 0 ),
+        rxOffpeak( 0 ),
+        txOffpeak( 0 )
+    {}
+    quint64 rx;
+    quint64 tx;
+    quint64 rxOffpeak;
+    quint64 txOffpeak;
+};
+
+/**
+ * One row of a period table as it goes to the db.  The off-peak values
+ * are null if the row doesn't track off-peak traffic.
+ */
+struct StatisticsRow
+{
+    StatisticsRow()
+        : id( 0 ),
+        dateTime( 0 ),
+        days( 0 ),
+        rx( 0 ),
+        tx( 0 ),
+        update( false )
+    {}
+    int id;
+    qint64 dateTime;
+    int days;
+    quint64 rx;
+    quint64 tx;
+    QVariant rxOffpeak;
+    QVariant txOffpeak;
+    // The row is in the db already and only its traffic changed
+    bool update;
+};
+
+/**
+ * What a save writes to the table of one period.
+ */
+struct PeriodChanges
+{
+    PeriodChanges()
+        : periodType( 0 ),
+        fromId( -1 )
+    {}
+    int periodType;
+    // Rows that were removed or renumbered
+    QList<int> deletedIds;
+    // A full save rewrites everything from this id on; -1 otherwise
+    int fromId;
+    QList<StatisticsRow> rows;
+};
+
+/**
+ * Everything one save of an interface writes.  It is a copy of what
+ * changed in the models, so it can be written from another thread while
+ * the models go on counting.
+ */
+struct StatisticsChangeSet
+{
+    StatisticsChangeSet()
+        : clear( false ),
+        lastSaved( 0 ),
+        calendarSystem( 0 ),
+        nextHourId( 0 ),
+        journalSeq( 0 ),
+        archiveFromId( -1 ),
+        hasRules( false ),
+        serial( 0 )
+    {}
+    QString ifaceName;
+    // Empty the tables before writing anything
+    bool clear;
+    uint lastSaved;
+    int calendarSystem;
+    int nextHourId;
+    quint64 journalSeq;
+    QList<PeriodChanges> periods;
+    // Hours were archived from this id on; -1 if none were
+    int archiveFromId;
+    // Only full saves write the rules
+    bool hasRules;
+    QList<StatsRule> rules;
+    // Grows with every save, so the owner can tell which are in the db
+    quint64 serial;
+};
+
 #endif
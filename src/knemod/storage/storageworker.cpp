@@ -0,0 +1,218 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#include "storageworker.h"
+
+static QAtomicInt connectionSerial( 0 );
+
+StorageWorker::StorageWorker( SqlStorage::Layout layout )
+    : QThread(),
+      mLayout( layout ),
+      mStop( false ),
+      mFailing( false )
+{
+    mConnectionName = QString( "storage_worker_%1" ).arg( connectionSerial.fetchAndAddOrdered( 1 ) );
+}
+
+StorageWorker::~StorageWorker()
+{
+    mMutex.lock();
+    mStop = true;
+    mWork.wakeAll();
+    mMutex.unlock();
+    wait();
+}
+
+void StorageWorker::enqueue( const QList<StatisticsChangeSet> &batch )
+{
+    if ( batch.isEmpty() )
+        return;
+
+    QMutexLocker locker( &mMutex );
+    // Back-pressure: hold the caller until there is room
+    while ( mQueue.count() >= QueueLimit && !mFailing )
+        mWritten.wait( &mMutex );
+    // Nothing makes room while writes fail, so the newest batch takes
+    // this one along.  The head is never the newest here.
+    if ( mQueue.count() >= QueueLimit )
+        mQueue.last() += batch;
+    else
+        mQueue.enqueue( batch );
+    mWork.wakeAll();
+}
+
+void StorageWorker::enqueue( const StatisticsChangeSet &changes )
+{
+    enqueue( QList<StatisticsChangeSet>() << changes );
+}
+
+bool StorageWorker::flush( unsigned long time )
+{
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker( &mMutex );
+    while ( !mQueue.isEmpty() && !mFailing )
+    {
+        unsigned long left = ULONG_MAX;
+        if ( time != ULONG_MAX )
+        {
+            qint64 elapsed = timer.elapsed();
+            if ( elapsed >= static_cast<qint64>(time) )
+                break;
+            left = time - elapsed;
+        }
+        mWritten.wait( &mMutex, left );
+    }
+    return mQueue.isEmpty();
+}
+
+bool StorageWorker::waitWritten( const QString &ifaceName, quint64 serial, unsigned long time )
+{
+    QMutexLocker locker( &mMutex );
+    while ( mWrittenSerials.value( ifaceName ) < serial && !mFailing )
+    {
+        if ( !mWritten.wait( &mMutex, time ) )
+            break;
+    }
+    return mWrittenSerials.value( ifaceName ) >= serial;
+}
+
+bool StorageWorker::isFailing()
+{
+    QMutexLocker locker( &mMutex );
+    return mFailing;
+}
+
+quint64 StorageWorker::writtenSerial( const QString &ifaceName )
+{
+    QMutexLocker locker( &mMutex );
+    return mWrittenSerials.value( ifaceName );
+}
+
+void StorageWorker::compact( const QString &ifaceName )
+{
+    QMutexLocker locker( &mMutex );
+    mCompactIface = ifaceName;
+    mWork.wakeAll();
+}
+
+SqlStorage *StorageWorker::storage( const QString &ifaceName )
+{
+    SqlStorage *sql = mStorages.value( ifaceName );
+    if ( !sql )
+    {
+        // All of them share our connection
+        sql = new SqlStorage( ifaceName, mConnectionName, mLayout );
+        mStorages.insert( ifaceName, sql );
+    }
+    return sql;
+}
+
+bool StorageWorker::writeBatch( const QList<StatisticsChangeSet> &batch, QString *ifaceName, QString *message )
+{
+    SqlStorage *first = storage( batch.first().ifaceName );
+    *ifaceName = batch.first().ifaceName;
+    if ( !first->beginWrite() )
+    {
+        *message = first->lastError();
+        return false;
+    }
+
+    // The batch goes in whole or not at all, since it is tried again
+    foreach ( const StatisticsChangeSet &changes, batch )
+    {
+        SqlStorage *sql = storage( changes.ifaceName );
+        if ( !sql->write( changes ) )
+        {
+            *ifaceName = changes.ifaceName;
+            *message = sql->lastError();
+            first->abortWrite();
+            return false;
+        }
+    }
+
+    if ( !first->endWrite() )
+    {
+        *message = first->lastError();
+        first->abortWrite();
+        return false;
+    }
+    return true;
+}
+
+void StorageWorker::run()
+{
+    QMutexLocker locker( &mMutex );
+    forever
+    {
+        if ( !mQueue.isEmpty() )
+        {
+            QList<StatisticsChangeSet> batch = mQueue.head();
+            locker.unlock();
+
+            QString ifaceName;
+            QString message;
+            bool ok = writeBatch( batch, &ifaceName, &message );
+
+            locker.relock();
+            if ( ok )
+            {
+                mQueue.dequeue();
+                foreach ( const StatisticsChangeSet &changes, batch )
+                    mWrittenSerials.insert( changes.ifaceName, changes.serial );
+            }
+            else if ( !mFailing )
+                emit error( ifaceName, message );
+            mFailing = !ok;
+            mWritten.wakeAll();
+
+            if ( !ok )
+            {
+                // Whatever was left is in the journal, for the next start
+                if ( mStop )
+                    break;
+                // The batch stays at the head.  New work tries it again
+                // sooner.
+                mWork.wait( &mMutex, RetryInterval );
+            }
+        }
+        else if ( !mCompactIface.isEmpty() && !mStop )
+        {
+            QString ifaceName = mCompactIface;
+            locker.unlock();
+            bool more = storage( ifaceName )->compact( 128 );
+            locker.relock();
+            if ( !more && mCompactIface == ifaceName )
+                mCompactIface.clear();
+        }
+        else if ( mStop )
+            break;
+        else
+            mWork.wait( &mMutex );
+    }
+    locker.unlock();
+
+    qDeleteAll( mStorages );
+    mStorages.clear();
+}
+
+#include "storageworker.moc"
@@ -0,0 +1,122 @@
+/* This file is part of KNemo
+   Copyright (C) 2026 John Stamp <jstamp@users.sourceforge.net>
+
+   KNemo is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   KNemo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef STORAGEWORKER_H
+#define STORAGEWORKER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "sqlstorage.h"
+
+/**
+ * Writes statistics to the db in a thread of its own, so a slow disk
+ * never holds up the GUI thread.  Saves are queued as change sets and
+ * each batch is written in one transaction.  The queue is bounded: once
+ * it is full, enqueue() waits for the worker to catch up.
+ *
+ * A batch that fails stays at the head of the queue and is tried again
+ * before anything newer, so batches always reach the db in order.
+ *
+ * With a shared db one worker writes for all interfaces.
+ *
+ * @short Background writer for statistics
+ */
+
+class StorageWorker : public QThread
+{
+    Q_OBJECT
+public:
+    // Batches waiting to be written before enqueue() blocks
+    enum { QueueLimit = 4 };
+    // How long to wait before trying a failed batch again
+    enum { RetryInterval = 10000 };
+    // How long a flush waits at most when shutting down
+    enum { ShutdownTimeout = 5000 };
+
+    StorageWorker( SqlStorage::Layout layout );
+    /**
+     * Writes everything still queued before it returns.
+     */
+    virtual ~StorageWorker();
+
+    /**
+     * Queue changes to be written in one transaction.
+     */
+    void enqueue( const QList<StatisticsChangeSet> &batch );
+    void enqueue( const StatisticsChangeSet &changes );
+    /**
+     * Wait until everything queued so far is in the db, until writes are
+     * failing, or until time milliseconds went by.  Returns true if the
+     * queue is empty.
+     */
+    bool flush( unsigned long time = ULONG_MAX );
+    /**
+     * Wait until the change set with serial is in the db for ifaceName.
+     * Gives up and returns false when writes are failing, or when no batch
+     * got written within time milliseconds.
+     */
+    bool waitWritten( const QString &ifaceName, quint64 serial, unsigned long time );
+    bool isFailing();
+    /**
+     * The serial of the newest change set of ifaceName in the db.  All of
+     * its older ones are in there too.
+     */
+    quint64 writtenSerial( const QString &ifaceName );
+    /**
+     * Give the free pages of the db back to the filesystem, a few at a
+     * time whenever there is nothing to write.
+     */
+    void compact( const QString &ifaceName );
+
+signals:
+    /**
+     * Writes started failing, first with the changes of ifaceName.  This
+     * isn't emitted again until one has succeeded.
+     */
+    void error( const QString &ifaceName, const QString &message );
+
+protected:
+    virtual void run();
+
+private:
+    SqlStorage *storage( const QString &ifaceName );
+    bool writeBatch( const QList<StatisticsChangeSet> &batch, QString *ifaceName, QString *message );
+
+    SqlStorage::Layout mLayout;
+    QString mConnectionName;
+    QMutex mMutex;
+    // Work arrived, or we are stopping
+    QWaitCondition mWork;
+    // A batch was written
+    QWaitCondition mWritten;
+    // The batch being written stays at the head until it is done
+    QQueue< QList<StatisticsChangeSet> > mQueue;
+    QHash<QString, quint64> mWrittenSerials;
+    QString mCompactIface;
+    bool mStop;
+    bool mFailing;
+    // Only used by the thread
+    QHash<QString, SqlStorage*> mStorages;
+};
+
+#endif // STORAGEWORKER_H
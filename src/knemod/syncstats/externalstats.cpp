@@ -30,9 +30,7 @@ ExternalStats::ExternalStats( Interface * interface, KCalendarSystem * calendar,
       mExternalHours( 0 )
 {
     mExternalHours = new StatisticsModel( KNemoStats::Hour );
-    mExternalHours->setSortRole( StatisticsModel::DataRole );
     mExternalDays = new StatisticsModel( KNemoStats::Day );
-    mExternalDays->setSortRole( StatisticsModel::DataRole );
     mExternalHours->setCalendar( calendar );
     mExternalDays->setCalendar( calendar );
 }